@@ -5,6 +5,7 @@ COMPONENT_SRCDIRS := \
 	src/File \
 	src/FWFS \
 	src/HYFS \
+	src/Union \
 	src/Arch/$(SMING_ARCH)
 
 COMPONENT_INCDIRS := \
@@ -44,6 +45,10 @@ DEBUG_VARS += FSBUILD
 FSBUILD_PATH := $(COMPONENT_PATH)/tools/fsbuild/fsbuild.py
 FSBUILD := $(PYTHON) $(FSBUILD_PATH) $(if $V,--verbose -l -)
 
+DEBUG_VARS += FSDELTA
+FSDELTA_PATH := $(COMPONENT_PATH)/tools/fsbuild/delta.py
+FSDELTA := $(PYTHON) $(FSDELTA_PATH) $(if $V,--verbose)
+
 CACHE_VARS += FSBUILD_OPTIONS
 FSBUILD_OPTIONS ?=
 
@@ -52,9 +57,10 @@ ifneq (,$(filter fwfs-build,$(MAKECMDGOALS)))
 PART_TARGET := $(PARTITION_$(PART)_FILENAME)
 ifneq (,$(PART_TARGET))
 $(eval PART_CONFIG := $(call HwExpr,part.build['config']))
+$(eval PART_HEADER := $(call HwExpr,part.build.get('header') or ''))
 .PHONY: fwfs-build
 fwfs-build:
 	@echo "Creating FWFS image '$(PART_TARGET)'"
-	$(Q) $(FSBUILD) $(FSBUILD_OPTIONS) -i "$(subst ",\",$(PART_CONFIG))" -o $(PART_TARGET)
+	$(Q) $(FSBUILD) $(FSBUILD_OPTIONS) -i "$(subst ",\",$(PART_CONFIG))" -o $(PART_TARGET) $(if $(PART_HEADER),--header $(PART_HEADER))
 endif
 endif
@@ -76,6 +76,17 @@ struct FileDir {
 	DIR* d;
 };
 
+/*
+ * Paths are resolved into a stack buffer to avoid heap allocation
+ */
+using HostPath = PathBuffer<PATH_MAX>;
+
+#define GET_FULLPATH(path, fullpath)                                                                                   \
+	HostPath fullpath;                                                                                                 \
+	if(resolvePath(path, fullpath) < 0) {                                                                              \
+		return Error::NameTooLong;                                                                                     \
+	}
+
 namespace
 {
 #define CHECK_MOUNTED()                                                                                                \
@@ -87,6 +98,26 @@ FileSystem hostFileSystem;
 
 const char* extendedAttributePrefix{"user.ifs."};
 
+/**
+ * @brief Get the host extended attribute name for a tag
+ * @param tag
+ * @param name Buffer to receive the name
+ * @retval bool false if tag is invalid
+ */
+bool getExtendedAttributeName(AttributeTag tag, char (&name)[64])
+{
+	auto prefixLen = strlen(extendedAttributePrefix);
+	memcpy(name, extendedAttributePrefix, prefixLen);
+	auto len = getAttributeName(tag, &name[prefixLen], sizeof(name) - prefixLen);
+	if(len == 0) {
+		return false;
+	}
+	for(auto s = &name[prefixLen]; *s != '\0'; ++s) {
+		*s = tolower(*s);
+	}
+	return true;
+}
+
 int setXAttr(FileHandle file, const char* name, const void* value, size_t size)
 {
 #if defined(__APPLE__)
@@ -119,13 +150,11 @@ int listXAttr(FileHandle file, char* namebuf, size_t size)
 
 int getExtendedAttribute(FileHandle file, AttributeTag tag, void* buffer, size_t bufsize)
 {
-	String tagString = toString(tag);
-	if(!tagString) {
+	char name[64];
+	if(!getExtendedAttributeName(tag, name)) {
 		return Error::BadParam;
 	}
-	String name = extendedAttributePrefix + tagString;
-	name.toLowerCase();
-	auto len = getXAttr(file, name.c_str(), buffer, bufsize);
+	auto len = getXAttr(file, name, buffer, bufsize);
 	if(len >= 0) {
 		return len;
 	}
@@ -153,13 +182,11 @@ template <typename T> int getExtendedAttribute(FileHandle file, AttributeTag tag
 
 int setExtendedAttribute(FileHandle file, AttributeTag tag, const void* data, size_t size)
 {
-	String tagString = toString(tag);
-	if(!tagString) {
+	char name[64];
+	if(!getExtendedAttributeName(tag, name)) {
 		return Error::BadParam;
 	}
-	String name = extendedAttributePrefix + tagString;
-	name.toLowerCase();
-	return setXAttr(file, name.c_str(), data, size);
+	return setXAttr(file, name, data, size);
 }
 
 void getExtendedAttributes(FileHandle file, Stat& stat)
@@ -248,26 +275,39 @@ String FileSystem::getErrorString(int err)
 	return IFS::Host::getErrorString(err);
 }
 
-String FileSystem::resolvePath(const char* path)
+int FileSystem::resolvePath(PathView path, NameBuffer& fullpath)
 {
-	if(path == nullptr || path[0] == '\0') {
-		if(rootpath) {
-			return rootpath;
+	fullpath.length = 0;
+	if(rootpath) {
+		fullpath.copy(rootpath.c_str(), rootpath.length());
+	}
+	if(path.length == 0) {
+		if(!rootpath) {
+			// Interpret empty path as current directory
+			fullpath.copy(".");
 		}
-		// Interpret empty path as current directory
-		return ".";
+	} else if(rootpath) {
+		fullpath.addSep();
+		fullpath.append(path);
+	} else {
+		fullpath.copy(path);
 	}
 
-	return rootpath ? (rootpath + '/' + path) : path;
+	return fullpath.overflow() ? Error::NameTooLong : FS_OK;
 }
 
 int FileSystem::opendir(const char* path, DirHandle& dir)
+{
+	return opendir(PathView(path), dir);
+}
+
+int FileSystem::opendir(PathView path, DirHandle& dir)
 {
 	CHECK_MOUNTED()
 
-	auto d = new FileDir{};
+	GET_FULLPATH(path, fullpath)
 
-	String fullpath = resolvePath(path);
+	auto d = new FileDir{};
 
 	d->d = ::opendir(fullpath.c_str());
 	if(d->d == nullptr) {
@@ -276,7 +316,7 @@ int FileSystem::opendir(const char* path, DirHandle& dir)
 		return err;
 	}
 
-	d->path = path;
+	d->path.assign(path.text, path.length);
 	dir = DirHandle(d);
 	return FS_OK;
 }
@@ -288,6 +328,24 @@ int FileSystem::rewinddir(DirHandle dir)
 	return FS_OK;
 }
 
+int FileSystem::telldir(DirHandle dir, DirCookie& cookie)
+{
+	GET_FILEDIR()
+	auto pos = ::telldir(d->d);
+	if(pos < 0) {
+		return syserr();
+	}
+	cookie = pos;
+	return FS_OK;
+}
+
+int FileSystem::seekdir(DirHandle dir, DirCookie cookie)
+{
+	GET_FILEDIR()
+	::seekdir(d->d, long(cookie));
+	return FS_OK;
+}
+
 int FileSystem::readdir(DirHandle dir, Stat& stat)
 {
 	GET_FILEDIR()
@@ -303,11 +361,17 @@ int FileSystem::readdir(DirHandle dir, Stat& stat)
 			continue;
 		}
 
-		String path = d->path.c_str();
-		path += '/';
-		path += e->d_name;
-		int res = this->stat(path.c_str(), &stat);
-		return res;
+#ifdef __WIN32
+		HostPath path;
+		path.copy(d->path.c_str());
+		path.join(e->d_name);
+		if(path.overflow()) {
+			return Error::NameTooLong;
+		}
+		return this->stat(PathView(path.c_str(), path.length), &stat);
+#else
+		return statat(dir, e->d_name, &stat);
+#endif
 	}
 }
 
@@ -327,7 +391,7 @@ int FileSystem::mkdir(const char* path)
 {
 	CHECK_MOUNTED()
 
-	String fullpath = resolvePath(path);
+	GET_FULLPATH(path, fullpath)
 
 #ifdef __WIN32
 	int res = ::mkdir(fullpath.c_str());
@@ -357,10 +421,15 @@ void FileSystem::fillStat(const os_stat_t& s, Stat& stat)
 }
 
 int FileSystem::stat(const char* path, Stat* stat)
+{
+	return this->stat(PathView(path), stat);
+}
+
+int FileSystem::stat(PathView path, Stat* stat)
 {
 	CHECK_MOUNTED()
 
-	String fullpath = resolvePath(path);
+	GET_FULLPATH(path, fullpath)
 
 	os_stat_t s;
 #ifdef __APPLE__
@@ -374,8 +443,7 @@ int FileSystem::stat(const char* path, Stat* stat)
 
 	if(stat != nullptr) {
 		fillStat(s, *stat);
-		const char* lastSep = strrchr(path, '/');
-		stat->name.copy(lastSep ? lastSep + 1 : path);
+		stat->name.copy(path.name());
 		FileHandle f = ::open(fullpath.c_str(), O_RDONLY);
 		if(f >= 0) {
 			getExtendedAttributes(f, *stat);
@@ -386,6 +454,39 @@ int FileSystem::stat(const char* path, Stat* stat)
 	return FS_OK;
 }
 
+int FileSystem::statat(DirHandle dir, const char* name, Stat* stat)
+{
+	GET_FILEDIR()
+
+#ifdef __WIN32
+	(void)d;
+	return Error::NotImplemented;
+#else
+	int fd = dirfd(d->d);
+	os_stat_t s;
+#ifdef __APPLE__
+	int res = ::fstatat(fd, name, &s, 0);
+#else
+	int res = ::fstatat64(fd, name, &s, 0);
+#endif
+	if(res < 0) {
+		return syserr();
+	}
+
+	if(stat != nullptr) {
+		fillStat(s, *stat);
+		stat->name.copy(PathView(name).name());
+		FileHandle f = ::openat(fd, name, O_RDONLY);
+		if(f >= 0) {
+			getExtendedAttributes(f, *stat);
+			::close(f);
+		}
+	}
+
+	return FS_OK;
+#endif
+}
+
 int FileSystem::fstat(FileHandle file, Stat* stat)
 {
 	CHECK_MOUNTED()
@@ -497,7 +598,7 @@ int FileSystem::setxattr(const char* path, AttributeTag tag, const void* data, s
 {
 	CHECK_MOUNTED()
 
-	String fullpath = resolvePath(path);
+	GET_FULLPATH(path, fullpath)
 
 	if(tag == AttributeTag::ModifiedTime) {
 		TimeStamp mtime;
@@ -535,10 +636,15 @@ int FileSystem::getxattr(const char* path, AttributeTag tag, void* buffer, size_
 }
 
 FileHandle FileSystem::open(const char* path, OpenFlags flags)
+{
+	return open(PathView(path), flags);
+}
+
+FileHandle FileSystem::open(PathView path, OpenFlags flags)
 {
 	CHECK_MOUNTED()
 
-	String fullpath = resolvePath(path);
+	GET_FULLPATH(path, fullpath)
 
 #ifdef __WIN32
 	uint32_t dwCreationDisposition{0};
@@ -587,6 +693,19 @@ FileHandle FileSystem::open(const char* path, OpenFlags flags)
 	return (res >= 0) ? res : syserr();
 }
 
+FileHandle FileSystem::openat(DirHandle dir, const char* name, OpenFlags flags)
+{
+	GET_FILEDIR()
+
+#ifdef __WIN32
+	(void)d;
+	return Error::NotImplemented;
+#else
+	int res = ::openat(dirfd(d->d), name, mapFlags(flags), 0644);
+	return (res >= 0) ? res : syserr();
+#endif
+}
+
 int FileSystem::close(FileHandle file)
 {
 	CHECK_MOUNTED()
@@ -688,8 +807,8 @@ int FileSystem::rename(const char* oldpath, const char* newpath)
 {
 	CHECK_MOUNTED()
 
-	String fulloldpath = resolvePath(oldpath);
-	String fullnewpath = resolvePath(newpath);
+	GET_FULLPATH(oldpath, fulloldpath)
+	GET_FULLPATH(newpath, fullnewpath)
 
 	int res = ::rename(fulloldpath.c_str(), fullnewpath.c_str());
 	return (res >= 0) ? res : syserr();
@@ -699,7 +818,7 @@ int FileSystem::remove(const char* path)
 {
 	CHECK_MOUNTED()
 
-	String fullpath = resolvePath(path);
+	GET_FULLPATH(path, fullpath)
 
 	int res = ::remove(fullpath.c_str());
 	return (res >= 0) ? res : syserr();
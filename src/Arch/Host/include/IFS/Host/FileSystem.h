@@ -46,11 +46,16 @@ public:
 	int getinfo(Info& info) override;
 	String getErrorString(int err) override;
 	int opendir(const char* path, DirHandle& dir) override;
+	int opendir(PathView path, DirHandle& dir) override;
 	int rewinddir(DirHandle dir) override;
+	int telldir(DirHandle dir, DirCookie& cookie) override;
+	int seekdir(DirHandle dir, DirCookie cookie) override;
 	int readdir(DirHandle dir, Stat& stat) override;
 	int closedir(DirHandle dir) override;
 	int mkdir(const char* path) override;
 	int stat(const char* path, Stat* stat) override;
+	int stat(PathView path, Stat* stat) override;
+	int statat(DirHandle dir, const char* name, Stat* stat) override;
 	int fstat(FileHandle file, Stat* stat) override;
 	int fsetxattr(FileHandle file, AttributeTag tag, const void* data, size_t size) override;
 	int fgetxattr(FileHandle file, AttributeTag tag, void* buffer, size_t size) override;
@@ -58,6 +63,8 @@ public:
 	int setxattr(const char* path, AttributeTag tag, const void* data, size_t size) override;
 	int getxattr(const char* path, AttributeTag tag, void* buffer, size_t size) override;
 	FileHandle open(const char* path, OpenFlags flags) override;
+	FileHandle open(PathView path, OpenFlags flags) override;
+	FileHandle openat(DirHandle dir, const char* name, OpenFlags flags) override;
 	int close(FileHandle file) override;
 	int read(FileHandle file, void* data, size_t size) override;
 	int write(FileHandle file, const void* data, size_t size) override;
@@ -82,7 +89,7 @@ public:
 	}
 
 private:
-	String resolvePath(const char* path);
+	int resolvePath(PathView path, NameBuffer& fullpath);
 	void fillStat(const os_stat_t& s, Stat& stat);
 	String rootpath;
 	bool mounted;
@@ -49,6 +49,24 @@ size_t getAttributeSize(AttributeTag tag)
 	}
 }
 
+size_t getAttributeName(AttributeTag tag, char* buffer, size_t bufSize)
+{
+	if(tag >= AttributeTag::User) {
+		uint8_t tagIndex = unsigned(tag) - unsigned(AttributeTag::User);
+		int len = m_snprintf(buffer, bufSize, _F("user%02x"), tagIndex);
+		return (len > 0 && size_t(len) < bufSize) ? len : 0;
+	}
+
+	auto& str = strings[unsigned(tag)];
+	auto len = str.length();
+	if(len == 0 || len >= bufSize) {
+		return 0;
+	}
+	str.read(0, buffer, len);
+	buffer[len] = '\0';
+	return len;
+}
+
 } // namespace IFS
 
 String toString(IFS::AttributeTag tag)
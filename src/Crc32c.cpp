@@ -0,0 +1,132 @@
+/****
+ * Crc32c.cpp
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "include/IFS/Crc32c.h"
+#include <FakePgmSpace.h>
+#include <cstring>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+namespace IFS
+{
+namespace
+{
+#if !defined(__SSE4_2__)
+
+// Reversed Castagnoli polynomial
+constexpr uint32_t polynomial{0x82f63b78};
+
+/*
+ * Tables for slice-by-8 algorithm, processing 8 bytes per iteration.
+ * Table 0 is the conventional byte-at-a-time table.
+ */
+struct Tables {
+	uint32_t entries[8][256];
+
+	constexpr Tables() : entries{}
+	{
+		for(unsigned i = 0; i < 256; ++i) {
+			uint32_t crc = i;
+			for(unsigned j = 0; j < 8; ++j) {
+				crc = (crc >> 1) ^ ((crc & 1) ? polynomial : 0);
+			}
+			entries[0][i] = crc;
+		}
+		for(unsigned i = 0; i < 256; ++i) {
+			for(unsigned k = 1; k < 8; ++k) {
+				auto prev = entries[k - 1][i];
+				entries[k][i] = (prev >> 8) ^ entries[0][prev & 0xff];
+			}
+		}
+	}
+};
+
+// 8KB, keep out of RAM
+constexpr Tables tables PROGMEM;
+
+uint32_t update(uint32_t crc, const uint8_t* p, size_t length)
+{
+	auto& t = tables.entries;
+
+	// Process bytes individually until aligned
+	while(length != 0 && (uintptr_t(p) & 3) != 0) {
+		crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		--length;
+	}
+
+	while(length >= 8) {
+		uint32_t lo;
+		uint32_t hi;
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo ^= crc;
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+			  t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+		p += 8;
+		length -= 8;
+	}
+
+	while(length-- != 0) {
+		crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+
+	return crc;
+}
+
+#else
+
+// Use CRC32 instruction
+uint32_t update(uint32_t crc, const uint8_t* p, size_t length)
+{
+	while(length != 0 && (uintptr_t(p) & 7) != 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+		--length;
+	}
+
+#if defined(__x86_64__)
+	uint64_t crc64{crc};
+	while(length >= 8) {
+		uint64_t value;
+		memcpy(&value, p, 8);
+		crc64 = _mm_crc32_u64(crc64, value);
+		p += 8;
+		length -= 8;
+	}
+	crc = crc64;
+#endif
+
+	while(length-- != 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+	}
+
+	return crc;
+}
+
+#endif
+
+} // namespace
+
+uint32_t crc32c(const void* data, size_t length, uint32_t crc)
+{
+	return ~update(~crc, static_cast<const uint8_t*>(data), length);
+}
+
+} // namespace IFS
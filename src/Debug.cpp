@@ -35,23 +35,33 @@ void printFsInfo(Print& out, FileSystem& fs)
 	}
 }
 
-void printAttrInfo(Print& out, FileSystem& fs, const String& filename)
+namespace
+{
+void printAttrs(Print& out, FileSystem& fs, FileHandle file)
 {
-	File f(&fs);
-	if(!f.open(filename)) {
-		return;
-	}
 	auto callback = [&](AttributeEnum& e) -> bool {
 		out << _F("  attr 0x") << String(unsigned(e.tag), HEX) << ' ' << e.tag << ' ' << e.attrsize << endl;
 		m_printHex(_F("  ATTR"), e.buffer, e.size);
 		return true;
 	};
 	char buffer[64];
-	int res = f.enumAttributes(callback, buffer, sizeof(buffer));
+	int res = fs.fenumxattr(file, callback, buffer, sizeof(buffer));
 	(void)res;
 	debug_d("enumAttributes: %d", res);
 }
 
+} // namespace
+
+void printAttrInfo(Print& out, FileSystem& fs, const String& filename)
+{
+	auto file = fs.open(filename, OpenFlag::Read);
+	if(file < 0) {
+		return;
+	}
+	printAttrs(out, fs, file);
+	fs.close(file);
+}
+
 int listDirectory(Print& out, FileSystem& fs, const String& path, Options options)
 {
 	out << _F("$ ls \"") << path << '\"' << endl;
@@ -75,11 +85,12 @@ int listDirectory(Print& out, FileSystem& fs, const String& path, Options option
 
 	while(dir.next()) {
 		out.println(dir.stat());
-		String filename = path;
-		filename += '/';
-		filename += dir.stat().name.c_str();
 		if(options[Option::attributes]) {
-			printAttrInfo(out, fs, filename);
+			auto file = dir.openat(dir.stat().name.c_str());
+			if(file >= 0) {
+				printAttrs(out, fs, file);
+				fs.close(file);
+			}
 		}
 	}
 
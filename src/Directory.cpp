@@ -61,6 +61,27 @@ bool Directory::rewind()
 	return err == FS_OK;
 }
 
+bool Directory::tell(DirCookie& cookie)
+{
+	GET_FS(false)
+
+	return check(fs->telldir(dir, cookie));
+}
+
+bool Directory::seek(DirCookie cookie)
+{
+	GET_FS(false)
+
+	int err = fs->seekdir(dir, cookie);
+	if(!check(err)) {
+		return false;
+	}
+	currentIndex = -1;
+	maxIndex = -1;
+	totalSize = 0;
+	return true;
+}
+
 String Directory::getPath() const
 {
 	String path('/');
@@ -105,4 +126,33 @@ bool Directory::next()
 	return false;
 }
 
+FileHandle Directory::openat(const char* name, OpenFlags flags)
+{
+	GET_FS(Error::NoFileSystem)
+
+	FileHandle file = fs->openat(dir, name, flags);
+	if(file == Error::NotImplemented) {
+		FileNameBuffer path;
+		path.copy(PathView(this->name));
+		path.join(name);
+		file = path.overflow() ? Error::NameTooLong : fs->open(PathView(path.c_str(), path.length), flags);
+	}
+	check(file);
+	return file;
+}
+
+bool Directory::statat(const char* name, Stat& stat)
+{
+	GET_FS(false)
+
+	int err = fs->statat(dir, name, &stat);
+	if(err == Error::NotImplemented) {
+		FileNameBuffer path;
+		path.copy(PathView(this->name));
+		path.join(name);
+		err = path.overflow() ? Error::NameTooLong : fs->stat(PathView(path.c_str(), path.length), &stat);
+	}
+	return check(err);
+}
+
 } // namespace IFS
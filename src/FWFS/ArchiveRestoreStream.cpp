@@ -0,0 +1,613 @@
+/****
+ * ArchiveRestoreStream.cpp
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include <IFS/FWFS/ArchiveRestoreStream.h>
+#include <IFS/Crc32c.h>
+
+namespace IFS::FWFS
+{
+ArchiveRestoreStream::ArchiveRestoreStream(FileSystem* fileSystem, const String& rootPath)
+	: FsBase(fileSystem), rootPath(rootPath)
+{
+	if(rootPath.length() != 0) {
+		stagePath = rootPath;
+		stagePath += '/';
+	}
+	stagePath += FWFS_RESTORE_STAGE_DIR;
+}
+
+ArchiveRestoreStream::~ArchiveRestoreStream()
+{
+	GET_FS()
+
+	if(dataFile >= 0) {
+		fs->close(dataFile);
+	}
+}
+
+int ArchiveRestoreStream::fail(int err)
+{
+	debug_e("[FWFS] Restore failed at #0x%08x: %s", objectOffset, getErrorString(err).c_str());
+	lastError = err;
+	state = State::error;
+	if(dataFile >= 0) {
+		getFileSystem()->close(dataFile);
+		dataFile = -1;
+	}
+	return err;
+}
+
+size_t ArchiveRestoreStream::write(const uint8_t* data, size_t size)
+{
+	size_t offset{0};
+	while(offset < size && state < State::done) {
+		auto len = consume(&data[offset], size - offset);
+		// Image checksum covers everything preceding the End object
+		if(!endFound) {
+			checksum = crc32c(&data[offset], len, checksum);
+		}
+		offset += len;
+	}
+
+	// Anything following the image, such as partition padding, is ignored
+	return (state == State::error) ? 0 : size;
+}
+
+size_t ArchiveRestoreStream::consume(const uint8_t* data, size_t size)
+{
+	auto hdr = reinterpret_cast<uint8_t*>(&header);
+
+	switch(state) {
+	case State::startMarker:
+	case State::endMarker: {
+		auto len = std::min(size, sizeof(uint32_t) - headerSize);
+		memcpy(&hdr[headerSize], data, len);
+		headerSize += len;
+		if(headerSize < sizeof(uint32_t)) {
+			return len;
+		}
+		uint32_t marker;
+		memcpy(&marker, hdr, sizeof(marker));
+		header = {};
+		headerSize = 0;
+		if(state == State::endMarker) {
+			if(marker != FWFILESYS_END_MARKER) {
+				fail(Error::BadFileSystem);
+			} else {
+				debug_d("[FWFS] Restored %u files, %u directories", fileCount, dirCount);
+				state = State::done;
+			}
+		} else if(marker != FWFILESYS_START_MARKER) {
+			fail(Error::BadFileSystem);
+		} else {
+			int err = createStageDirectory();
+			if(err < 0) {
+				fail(err);
+			} else {
+				objectOffset = FWFS_BASE_OFFSET;
+				state = State::header;
+			}
+		}
+		return len;
+	}
+
+	case State::header: {
+		// First byte determines size of header
+		if(headerSize == 0) {
+			header.typeData = *data;
+			endFound = (header.type() == Object::Type::End);
+		}
+		auto len = std::min(size, header.contentOffset() - headerSize);
+		memcpy(&hdr[headerSize], data, len);
+		headerSize += len;
+		if(headerSize == header.contentOffset()) {
+			int err = startObject();
+			if(err < 0) {
+				fail(err);
+			}
+		}
+		return len;
+	}
+
+	case State::content: {
+		auto len = std::min(size, size_t(header.contentSize() - contentPos));
+		int err{FS_OK};
+		if(content) {
+			memcpy(&content[contentPos], data, len);
+		} else {
+			auto& info = pendingData[pendingData.count() - 1];
+			info.crc = crc32c(data, len, info.crc);
+			err = writeData(data, len);
+		}
+		contentPos += len;
+		if(err >= 0 && contentPos == header.contentSize()) {
+			err = finishObject();
+		}
+		if(err < 0) {
+			fail(err);
+		}
+		return len;
+	}
+
+	case State::done:
+	case State::error:
+	default:
+		return size;
+	}
+}
+
+int ArchiveRestoreStream::createStageDirectory()
+{
+	GET_FS(Error::NoFileSystem)
+
+	// Creates any parent directories
+	fs->makedirs(stagePath);
+	int err = fs->mkdir(stagePath.c_str());
+	return (err == Error::Exists) ? FS_OK : err;
+}
+
+int ArchiveRestoreStream::startObject()
+{
+	if(header.isRef()) {
+		return Error::BadObject;
+	}
+
+	contentPos = 0;
+	auto size = header.contentSize();
+	if(header.isData()) {
+		// Content goes straight to the staged file, whose name isn't yet known
+		if(dataFile < 0) {
+			int err = createStagedFile(objectOffset);
+			if(err < 0) {
+				return err;
+			}
+		}
+		pendingData.add({objectOffset, 0});
+	} else if(size != 0) {
+		content.reset(new(std::nothrow) uint8_t[size]);
+		if(!content) {
+			return Error::NoMem;
+		}
+	}
+
+	state = State::content;
+	return (size == 0) ? finishObject() : FS_OK;
+}
+
+int ArchiveRestoreStream::finishObject()
+{
+	// Complete header from object content so named object fields are available
+	auto hdr = reinterpret_cast<uint8_t*>(&header);
+	auto size = header.contentSize();
+	if(content) {
+		memcpy(&hdr[headerSize], content.get(), std::min(size_t(size), sizeof(header) - headerSize));
+	}
+
+	int err{FS_OK};
+	auto type = header.type();
+	if(header.isNamed() && (size < sizeof(header.data16.named) || header.data16.named.childTableOffset() > size)) {
+		err = Error::BadObject;
+	} else if(type == Object::Type::File) {
+		err = restoreFile();
+	} else if(type == Object::Type::Directory) {
+		err = restoreDirectory();
+	} else if(type == Object::Type::Volume) {
+		err = restoreVolume();
+	} else if(type == Object::Type::End) {
+		if(!volumeRestored) {
+			err = Error::BadFileSystem;
+		} else if(header.data8.end.checksum != 0 && header.data8.end.checksum != checksum) {
+			debug_e("[FWFS] Checksum mismatch: found 0x%08x, expected 0x%08x", checksum, header.data8.end.checksum);
+			err = Error::BadChecksum;
+		}
+	}
+	// Data objects have already been written, anything else such as mountpoints is ignored
+
+	content.reset();
+	objectOffset += header.size();
+	header = {};
+	headerSize = 0;
+	state = (type == Object::Type::End) ? State::endMarker : State::header;
+	return err;
+}
+
+int ArchiveRestoreStream::writeData(const void* data, size_t size)
+{
+	GET_FS(Error::NoFileSystem)
+
+	int res = fs->write(dataFile, data, size);
+	if(res < 0) {
+		return res;
+	}
+	return (size_t(res) == size) ? FS_OK : Error::WriteFailure;
+}
+
+int ArchiveRestoreStream::createStagedFile(Object::ID id)
+{
+	GET_FS(Error::NoFileSystem)
+
+	auto file = fs->open(getStagePath(id).c_str(), OpenFlag::Create | OpenFlag::Truncate | OpenFlag::Write);
+	if(file < 0) {
+		return file;
+	}
+	dataFile = file;
+	stageId = id;
+	return FS_OK;
+}
+
+String ArchiveRestoreStream::getStagePath(Object::ID id) const
+{
+	String path = stagePath;
+	path += '/';
+	path += String(id, HEX);
+	return path;
+}
+
+int ArchiveRestoreStream::forEachChild(ChildCallback callback)
+{
+	auto size = header.contentSize();
+	for(unsigned offset = header.data16.named.childTableOffset(); offset < size;) {
+		Object child{};
+		memcpy(&child, &content[offset], std::min(sizeof(child), size_t(size - offset)));
+		auto childSize = child.size();
+		if(offset + childSize > size) {
+			return Error::BadObject;
+		}
+		int err = callback(child, &content[offset + child.contentOffset()]);
+		if(err < 0) {
+			return err;
+		}
+		offset += childSize;
+	}
+	return FS_OK;
+}
+
+int ArchiveRestoreStream::setAttributes(AttributeCallback callback)
+{
+	int err = forEachChild([&](const Object& child, const uint8_t* data) -> int {
+		switch(child.type()) {
+		case Object::Type::ObjAttr: {
+			auto attr = getFileAttributes(child.data8.objectAttributes.attr);
+			return callback(AttributeTag::FileAttributes, &attr, sizeof(attr));
+		}
+		case Object::Type::Compression:
+			return callback(AttributeTag::Compression, &child.data8.compression, sizeof(Compression));
+		case Object::Type::ReadACE:
+			return callback(AttributeTag::ReadAce, &child.data8.ace.role, sizeof(UserRole));
+		case Object::Type::WriteACE:
+			return callback(AttributeTag::WriteAce, &child.data8.ace.role, sizeof(UserRole));
+		case Object::Type::Md5Hash:
+			return callback(AttributeTag::Md5Hash, data, child.contentSize());
+		case Object::Type::Comment:
+			return callback(AttributeTag::Comment, data, child.contentSize());
+		case Object::Type::UserAttribute:
+			if(child.contentSize() == 0) {
+				return Error::BadObject;
+			}
+			return callback(getUserAttributeTag(child.data8.userAttribute.tagValue), &data[1],
+							child.contentSize() - 1);
+		default:
+			return FS_OK;
+		}
+	});
+	if(err < 0) {
+		return err;
+	}
+
+	// Set last as changing other attributes may update it
+	return callback(AttributeTag::ModifiedTime, &header.data16.named.mtime, sizeof(TimeStamp));
+}
+
+int ArchiveRestoreStream::restoreFile()
+{
+	GET_FS(Error::NoFileSystem)
+
+	unsigned dataIndex{0};
+	uint32_t crc{0};
+	bool crcValid{false};
+	bool copied{false};
+	int err = forEachChild([&](const Object& child, const uint8_t* data) -> int {
+		if(child.isData() && !child.isRef()) {
+			// Inline data
+			if(dataFile < 0) {
+				int err = createStagedFile(objectOffset);
+				if(err < 0) {
+					return err;
+				}
+			}
+			crc = crc32c(data, child.contentSize());
+			crcValid = true;
+			return writeData(data, child.contentSize());
+		}
+
+		if(child.isData()) {
+			auto id = child.getRef();
+			if(dataIndex < pendingData.count() && pendingData[dataIndex].id == id) {
+				crc = pendingData[dataIndex++].crc;
+				crcValid = true;
+				return FS_OK;
+			}
+			// Content shared with an earlier file has been copied in its entirety
+			crcValid = false;
+			if(copied) {
+				return FS_OK;
+			}
+			if(dataFile < 0) {
+				int err = createStagedFile(objectOffset);
+				if(err < 0) {
+					return err;
+				}
+			}
+			copied = true;
+			return copyContent(id);
+		}
+
+		switch(child.type()) {
+		case Object::Type::DataChecksum:
+			if(crcValid && child.data8.dataChecksum.crc != crc) {
+				debug_e("[FWFS] Data checksum mismatch: found 0x%08x, expected 0x%08x", crc,
+						child.data8.dataChecksum.crc);
+				return Error::BadChecksum;
+			}
+			return FS_OK;
+		case Object::Type::BaseData:
+			debug_e("[FWFS] Cannot restore differential archive");
+			return Error::NotSupported;
+		default:
+			return FS_OK;
+		}
+	});
+	if(err >= 0 && dataIndex != pendingData.count()) {
+		debug_e("[FWFS] File doesn't reference preceding data");
+		err = Error::BadObject;
+	}
+	if(err >= 0 && dataFile < 0) {
+		// Empty file
+		err = createStagedFile(objectOffset);
+	}
+	if(err < 0) {
+		return err;
+	}
+
+	err = setAttributes([&](AttributeTag tag, const void* data, size_t size) -> int {
+		return fs->fsetxattr(dataFile, tag, data, size);
+	});
+	fs->close(dataFile);
+	dataFile = -1;
+	if(err < 0) {
+		return err;
+	}
+
+	/*
+	 * Remember location of content in case a later file refers to it.
+	 * ArchiveStream only deduplicates content stored as a single data object, so other files
+	 * (e.g. compressed in blocks) are not recorded as they would displace usable entries.
+	 */
+	if(pendingData.count() == 1) {
+		auto& entry = contentEntries[contentNext];
+		entry.dataId = pendingData[0].id;
+		entry.path = String(stageId, HEX);
+		contentNext = (contentNext + 1) % FWFS_RESTORE_CONTENT_ENTRIES;
+	}
+	pendingData.clear();
+
+	addEntry(stageId);
+	++fileCount;
+	return FS_OK;
+}
+
+int ArchiveRestoreStream::copyContent(Object::ID dataId)
+{
+	GET_FS(Error::NoFileSystem)
+
+	for(auto& entry : contentEntries) {
+		if(entry.dataId != dataId || entry.path.length() == 0) {
+			continue;
+		}
+		String path = stagePath;
+		path += '/';
+		path += entry.path;
+		auto file = fs->open(path.c_str(), OpenFlag::Read);
+		if(file < 0) {
+			return file;
+		}
+		uint8_t buffer[512];
+		int res;
+		while((res = fs->read(file, buffer, sizeof(buffer))) > 0) {
+			res = writeData(buffer, res);
+			if(res < 0) {
+				break;
+			}
+		}
+		fs->close(file);
+		return res;
+	}
+
+	debug_e("[FWFS] Content #0x%08x is not available", dataId);
+	return Error::NotFound;
+}
+
+int ArchiveRestoreStream::restoreDirectory()
+{
+	GET_FS(Error::NoFileSystem)
+
+	auto path = getStagePath(objectOffset);
+	int err = fs->mkdir(path.c_str());
+	if(err < 0) {
+		return err;
+	}
+
+	// Move children into place
+	String dirName(objectOffset, HEX);
+	err = forEachChild([&](const Object& child, const uint8_t*) -> int {
+		if(!child.isRef() || !child.isNamed()) {
+			return FS_OK;
+		}
+		int i = findEntry(child.getRef());
+		if(i < 0) {
+			// Mountpoint, not restored
+			return FS_OK;
+		}
+		auto& entry = entries[i];
+		String oldName(entry.stageId, HEX);
+		String newName = dirName;
+		newName += '/';
+		newName += entry.name.c_str();
+		int err = fs->rename(getStagePath(entry.stageId).c_str(), (stagePath + '/' + newName).c_str());
+		if(err < 0) {
+			return err;
+		}
+		moveContentEntries(oldName, newName);
+		entries.remove(i);
+		return FS_OK;
+	});
+	if(err < 0) {
+		return err;
+	}
+
+	// Not all filesystems support directory attributes
+	setAttributes([&](AttributeTag tag, const void* data, size_t size) -> int {
+		int err = fs->setxattr(path.c_str(), tag, data, size);
+		if(err < 0) {
+			debug_w("[FWFS] setxattr('%s', %s): %s", path.c_str(), toString(tag).c_str(),
+					fs->getErrorString(err).c_str());
+		}
+		return FS_OK;
+	});
+
+	addEntry(objectOffset);
+	++dirCount;
+	return FS_OK;
+}
+
+int ArchiveRestoreStream::restoreVolume()
+{
+	GET_FS(Error::NoFileSystem)
+
+	// Root directory is the last one received
+	Object::ID rootId{0};
+	forEachChild([&](const Object& child, const uint8_t*) -> int {
+		if(child.isRef() && child.isDir()) {
+			rootId = child.getRef();
+		}
+		return FS_OK;
+	});
+	int i = findEntry(rootId);
+	if(i < 0) {
+		debug_e("[FWFS] Root directory missing");
+		return Error::BadFileSystem;
+	}
+	auto rootStagePath = getStagePath(entries[i].stageId);
+	--dirCount;
+
+	// Restore path may already exist so move content rather than the directory itself
+	for(;;) {
+		DirHandle dir;
+		int err = fs->opendir(rootStagePath.c_str(), dir);
+		if(err < 0) {
+			return err;
+		}
+		// Directory changes as we go so start again each time
+		NameStat stat;
+		err = fs->readdir(dir, stat);
+		fs->closedir(dir);
+		if(err == Error::NoMoreFiles) {
+			break;
+		}
+		if(err < 0) {
+			return err;
+		}
+		String oldPath = rootStagePath;
+		oldPath += '/';
+		oldPath += stat.name.c_str();
+		String newPath = rootPath;
+		if(newPath.length() != 0) {
+			newPath += '/';
+		}
+		newPath += stat.name.c_str();
+		err = fs->rename(oldPath.c_str(), newPath.c_str());
+		if(err < 0) {
+			return err;
+		}
+	}
+
+	auto file = fs->open(rootStagePath.c_str());
+	if(file >= 0) {
+		auto callback = [&](AttributeEnum& e) -> bool {
+			int err = fs->setxattr(rootPath.c_str(), e.tag, e.buffer, e.size);
+			if(err < 0) {
+				debug_w("[FWFS] setxattr('%s', %s): %s", rootPath.c_str(), toString(e.tag).c_str(),
+						fs->getErrorString(err).c_str());
+			}
+			return true;
+		};
+		char buffer[256];
+		fs->fenumxattr(file, callback, buffer, sizeof(buffer));
+		fs->close(file);
+	}
+
+	fs->remove(rootStagePath.c_str());
+	int err = fs->remove(stagePath.c_str());
+	if(err < 0) {
+		debug_w("[FWFS] Stage directory '%s' not removed: %s", stagePath.c_str(), fs->getErrorString(err).c_str());
+	}
+
+	entries.clear();
+	for(auto& entry : contentEntries) {
+		entry.path = nullptr;
+	}
+	volumeRestored = true;
+	return FS_OK;
+}
+
+void ArchiveRestoreStream::addEntry(Object::ID stageId)
+{
+	Entry entry{objectOffset, stageId, nullptr};
+	entry.name.assign(reinterpret_cast<const char*>(&content[header.data16.named.nameOffset()]),
+					  header.data16.named.namelen);
+	entries.add(entry);
+}
+
+int ArchiveRestoreStream::findEntry(Object::ID id)
+{
+	// Most recent entries are most likely
+	for(int i = entries.count() - 1; i >= 0; --i) {
+		if(entries[i].id == id) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+void ArchiveRestoreStream::moveContentEntries(const String& oldPath, const String& newPath)
+{
+	for(auto& entry : contentEntries) {
+		auto& path = entry.path;
+		if(!path.startsWith(oldPath)) {
+			continue;
+		}
+		if(path.length() == oldPath.length()) {
+			path = newPath;
+		} else if(path[oldPath.length()] == '/') {
+			path = newPath + path.substring(oldPath.length());
+		}
+	}
+}
+
+} // namespace IFS::FWFS
@@ -18,11 +18,96 @@
  */
 
 #include <IFS/FWFS/ArchiveStream.h>
+#include <IFS/FWFS/ReadAheadStream.h>
+#include <IFS/FWFS/Lz4Encoder.h>
 #include <Data/Stream/IFS/FileStream.h>
 
 namespace IFS::FWFS
 {
+namespace
+{
 constexpr size_t maxInlineSize{255};
+constexpr uint32_t fnvOffsetBasis{2166136261U};
+
+uint32_t fnv1a(const void* data, size_t length, uint32_t hash)
+{
+	auto p = static_cast<const uint8_t*>(data);
+	while(length-- != 0) {
+		hash ^= *p++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/*
+ * Checkpoint data starts with this header, followed by:
+ *
+ * 	Current path
+ * 	CheckpointLevel for each open directory, followed by its child table
+ * 	Deduplication table entries
+ */
+struct CheckpointHeader {
+	uint32_t streamOffset;
+	uint32_t queuedSize;
+	uint32_t checksum;
+	uint32_t checksumOffset;
+	uint32_t dedupCount;
+	uint32_t dedupSize;
+	uint32_t baseCount;
+	uint32_t baseSize;
+	TimeStamp creationTime;
+	uint16_t dedupUsed;
+	uint16_t dedupNext;
+	uint16_t pathLength;
+	uint8_t level;
+	uint8_t state;
+};
+
+struct CheckpointLevel {
+	DirCookie cookie; ///< Position of next directory entry
+	uint16_t contentSize;
+	uint8_t type;
+	uint8_t namelen;
+};
+
+template <typename T> void append(String& data, const T& value)
+{
+	data.concat(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+class CheckpointReader
+{
+public:
+	CheckpointReader(const String& data) : ptr(data.c_str()), end(ptr + data.length())
+	{
+	}
+
+	const char* get(size_t length)
+	{
+		if(length > size_t(end - ptr)) {
+			return nullptr;
+		}
+		auto res = ptr;
+		ptr += length;
+		return res;
+	}
+
+	template <typename T> bool read(T& value)
+	{
+		auto p = get(sizeof(value));
+		if(p == nullptr) {
+			return false;
+		}
+		memcpy(&value, p, sizeof(value));
+		return true;
+	}
+
+private:
+	const char* ptr;
+	const char* end;
+};
+
+} // namespace
 
 int ArchiveStream::FileInfo::setAttribute(AttributeTag tag, const void* data, size_t size)
 {
@@ -38,7 +123,139 @@ uint16_t ArchiveStream::readMemoryBlock(char* data, int bufSize)
 	}
 
 	assert(source != nullptr);
-	return source->readMemoryBlock(data, bufSize);
+	auto len = source->readMemoryBlock(data, bufSize);
+	updateChecksum(data, len);
+	return len;
+}
+
+int ArchiveStream::writeTo(Print& out, size_t bufferSize)
+{
+	return pump(
+		[&](const void* data, size_t size) -> int {
+			return out.write(static_cast<const uint8_t*>(data), size) == size ? FS_OK : Error::WriteFailure;
+		},
+		bufferSize);
+}
+
+int ArchiveStream::writeTo(IFileSystem& fileSystem, FileHandle file, size_t bufferSize)
+{
+	return pump(
+		[&](const void* data, size_t size) -> int {
+			int res = fileSystem.write(file, data, size);
+			if(res < 0) {
+				return res;
+			}
+			return size_t(res) == size ? FS_OK : Error::WriteFailure;
+		},
+		bufferSize);
+}
+
+/*
+ * Fill buffer from each queued stream in turn, writing it out when full
+ */
+int ArchiveStream::pump(WriteCallback callback, size_t bufferSize)
+{
+	GET_FS(Error::NoFileSystem)
+
+	if(bufferSize == 0) {
+		return Error::BadParam;
+	}
+	std::unique_ptr<char[]> block(new(std::nothrow) char[bufferSize]);
+	if(!block) {
+		debug_e("[FWFS] No memory for %u byte output buffer", bufferSize);
+		return Error::NoMem;
+	}
+
+	size_t used{0};
+	int total{0};
+	auto flush = [&]() -> int {
+		int err = callback(block.get(), used);
+		if(err < 0) {
+			debug_e("[FWFS] Output failed: %s", fs->getErrorString(err).c_str());
+			return err;
+		}
+		total += used;
+		used = 0;
+		return FS_OK;
+	};
+
+	for(;;) {
+		if(source == nullptr || source->isFinished()) {
+			if(!fillBuffers()) {
+				break;
+			}
+		}
+
+		if(used == bufferSize) {
+			int err = flush();
+			if(err < 0) {
+				return err;
+			}
+		}
+
+		auto ptr = block.get() + used;
+		size_t space = bufferSize - used;
+		uint32_t pos = getStreamPosition();
+		int len;
+		if(state == State::dataContent && dataFile >= 0) {
+			// Bypass FileStream, then update its position to match
+			len = fs->read(dataFile, ptr, std::min(space, size_t(source->available())));
+			if(len > 0) {
+				source->seekFrom(pos - streamOffset + len, SeekOrigin::Start);
+			}
+		} else {
+			len = source->readMemoryBlock(ptr, std::min(space, size_t(UINT16_MAX)));
+			source->seek(len);
+		}
+		if(len <= 0) {
+			debug_e("[FWFS] Read failed @ 0x%08x", pos);
+			state = State::error;
+			break;
+		}
+		updateChecksum(pos, ptr, len);
+		used += len;
+	}
+
+	if(used != 0) {
+		int err = flush();
+		if(err < 0) {
+			return err;
+		}
+	}
+
+	return isSuccess() ? total : Error::ReadFailure;
+}
+
+/*
+ * Data is checksummed as it is read, so the value is available when the End object is written.
+ * Callers are expected to read each block before seeking past it: any skipped data is detected
+ * and the checksum omitted.
+ */
+void ArchiveStream::updateChecksum(uint32_t pos, const char* data, size_t length)
+{
+	if(pos > checksumOffset) {
+		checksumOffset = UINT32_MAX;
+		debug_w("[FWFS] Data skipped, archive checksum omitted");
+		return;
+	}
+	if(pos + length <= checksumOffset) {
+		return;
+	}
+	auto skip = checksumOffset - pos;
+	data += skip;
+	length -= skip;
+	checksum = crc32c(data, length, checksum);
+	checksumOffset = pos + length;
+	if(state != State::dataContent) {
+		return;
+	}
+	if(flags[Flag::DataChecksums]) {
+		dataChecksum = crc32c(data, length, dataChecksum);
+	}
+	if(dedupStreaming) {
+		dedupPending.crc = flags[Flag::DataChecksums] ? dataChecksum : crc32c(data, length, dedupPending.crc);
+		dedupPending.hash = fnv1a(data, length, dedupPending.hash);
+	}
 }
 
 bool ArchiveStream::fillBuffers()
@@ -48,6 +265,10 @@ bool ArchiveStream::fillBuffers()
 		queueStream(buffer, State::end);
 	};
 
+	if(flags[Flag::Checkpoints] && (state == State::fileHeader || state == State::dirHeader)) {
+		saveCheckpoint();
+	}
+
 	switch(state) {
 	case State::idle:
 		if(volumeInfo.creationTime == 0) {
@@ -58,7 +279,7 @@ bool ArchiveStream::fillBuffers()
 		break;
 
 	case State::start:
-		if(!openRootDirectory()) {
+		if(!openRootDirectory() && state != State::error) {
 			gotoEnd();
 		}
 		break;
@@ -100,7 +321,12 @@ bool ArchiveStream::fillBuffers()
 		return false;
 	}
 
-	return true;
+	return state != State::error;
+}
+
+uint32_t ArchiveStream::getStreamPosition()
+{
+	return streamOffset + queuedSize - (source ? source->available() : 0);
 }
 
 int ArchiveStream::seekFrom(int offset, SeekOrigin origin)
@@ -108,14 +334,57 @@ int ArchiveStream::seekFrom(int offset, SeekOrigin origin)
 	if(origin == SeekOrigin::Current) {
 		return source ? source->seekFrom(offset, origin) : -1;
 	}
-	if(origin == SeekOrigin::Start && offset == 0) {
-		reset();
+	if(origin != SeekOrigin::Start || offset < 0) {
+		return -1;
+	}
+	if(offset == 0) {
+		release();
 		return 0;
 	}
-	return -1;
+
+	// Go back if we must, or forward if there's a checkpoint closer than current position
+	auto pos = getStreamPosition();
+	auto checkpoint = getCheckpoint(offset);
+	if(uint32_t(offset) < pos || (checkpoint != nullptr && checkpoint->offset > pos)) {
+		if(checkpoint == nullptr) {
+			release();
+		} else if(!resume(*checkpoint)) {
+			return -1;
+		}
+	}
+
+	return skipTo(offset) ? offset : -1;
+}
+
+/*
+ * Read and discard output up to the given position, so checksums remain valid
+ */
+bool ArchiveStream::skipTo(uint32_t offset)
+{
+	char buf[256];
+	uint32_t pos;
+	while((pos = getStreamPosition()) < offset) {
+		auto len = readMemoryBlock(buf, std::min(offset - pos, uint32_t(sizeof(buf))));
+		if(len == 0) {
+			return false;
+		}
+		seekFrom(len, SeekOrigin::Current);
+	}
+	return pos == offset;
 }
 
 void ArchiveStream::reset()
+{
+	checkpoints.reset();
+	checkpointOffset = 0;
+	checkpointNext = 0;
+	release();
+}
+
+/*
+ * Return to initial state, but keep checkpoints
+ */
+void ArchiveStream::release()
 {
 	if(state == State::idle) {
 		return;
@@ -125,20 +394,221 @@ void ArchiveStream::reset()
 
 	source = nullptr;
 	encoder.reset();
+	dataFile = -1;
 	buffer.clear();
-	for(unsigned i = 0; i <= level; ++i) {
+	for(unsigned i = 0; i < maxLevels && i <= level; ++i) {
 		auto& dir = directories[i];
 		fs->closedir(dir.handle);
 		dir.handle = nullptr;
+		if(dir.scratchFile >= 0) {
+			scratchFs->close(dir.scratchFile);
+			dir.scratchFile = -1;
+		}
 		dir.reset();
 	}
+	// Scratch files must be closed before removal
+	for(unsigned i = 0; i < maxLevels; ++i) {
+		directories[i].scratchStream.reset();
+	}
+	for(unsigned i = 0; i < scratchLevels; ++i) {
+		scratchFs->remove(getScratchPath(i));
+	}
+	scratchLevels = 0;
+	directories.reset();
+	maxLevels = 0;
 	level = 0;
+	peakMemoryUsage = 0;
 	streamOffset = queuedSize = 0;
+	checksum = checksumOffset = dataChecksum = 0;
+	dedupTable.reset();
+	dedupPending = {};
+	dedupStreaming = false;
+	dedupUsed = dedupNext = 0;
+	dedupCount = dedupSize = 0;
+	baseCount = baseSize = 0;
+	currentPath.setLength(rootPathLength);
 	state = State::idle;
 }
 
+const ArchiveStream::Checkpoint* ArchiveStream::getCheckpoint(uint32_t offset) const
+{
+	if(!checkpoints) {
+		return nullptr;
+	}
+	const Checkpoint* best{nullptr};
+	for(unsigned i = 0; i < FWFS_CHECKPOINT_COUNT; ++i) {
+		auto& cp = checkpoints[i];
+		if(cp && cp.offset <= offset && (best == nullptr || cp.offset > best->offset)) {
+			best = &cp;
+		}
+	}
+	return best;
+}
+
+/*
+ * Called at file and directory boundaries: no file is open and every open directory has
+ * a complete child table for the entries read so far.
+ */
+void ArchiveStream::saveCheckpoint()
+{
+	uint32_t offset = streamOffset + queuedSize;
+	if(offset < checkpointOffset + FWFS_CHECKPOINT_INTERVAL) {
+		return;
+	}
+	for(unsigned i = 0; i < level; ++i) {
+		if(directories[i].scratchFile >= 0) {
+			return;
+		}
+	}
+	checkpointOffset = offset;
+
+	GET_FS()
+
+	if(!checkpoints) {
+		checkpoints.reset(new(std::nothrow) Checkpoint[FWFS_CHECKPOINT_COUNT]);
+		if(!checkpoints) {
+			debug_w("[FWFS] No memory for checkpoints");
+			return;
+		}
+	}
+
+	CheckpointHeader hdr{};
+	hdr.streamOffset = streamOffset;
+	hdr.queuedSize = queuedSize;
+	hdr.checksum = checksum;
+	hdr.checksumOffset = checksumOffset;
+	hdr.dedupCount = dedupCount;
+	hdr.dedupSize = dedupSize;
+	hdr.baseCount = baseCount;
+	hdr.baseSize = baseSize;
+	hdr.creationTime = volumeInfo.creationTime;
+	hdr.dedupUsed = dedupUsed;
+	hdr.dedupNext = dedupNext;
+	hdr.pathLength = currentPath.length();
+	hdr.level = level;
+	hdr.state = uint8_t(state);
+	String data;
+	append(data, hdr);
+	data.concat(currentPath);
+	for(unsigned i = 0; i < level; ++i) {
+		auto& dir = directories[i];
+		CheckpointLevel lvl{};
+		int err = fs->telldir(dir.handle, lvl.cookie);
+		if(err < 0) {
+			debug_w("[FWFS] Checkpoint failed, telldir: %s", fs->getErrorString(err).c_str());
+			return;
+		}
+		lvl.contentSize = dir.content->getSize();
+		lvl.type = uint8_t(dir.type);
+		lvl.namelen = dir.namelen;
+		append(data, lvl);
+		data.concat(dir.content->getData(), lvl.contentSize);
+	}
+	if(dedupUsed != 0) {
+		data.concat(reinterpret_cast<const char*>(dedupTable.get()), dedupUsed * sizeof(DedupEntry));
+	}
+
+	auto& cp = checkpoints[checkpointNext];
+	cp.offset = offset;
+	cp.data = std::move(data);
+	checkpointNext = (checkpointNext + 1) % FWFS_CHECKPOINT_COUNT;
+	debug_d("[FWFS] Checkpoint @ 0x%08x, %u bytes", offset, cp.data.length());
+}
+
+bool ArchiveStream::resume(const Checkpoint& checkpoint)
+{
+	GET_FS(false)
+
+	release();
+
+	auto fail = [&]() {
+		debug_e("[FWFS] Cannot resume from checkpoint @ 0x%08x", checkpoint.offset);
+		// Ensure any open directories get closed
+		state = State::error;
+		release();
+		state = State::error;
+		return false;
+	};
+
+	CheckpointReader reader(checkpoint.data);
+	CheckpointHeader hdr;
+	if(!reader.read(hdr) || hdr.dedupUsed > FWFS_DEDUP_ENTRIES ||
+	   hdr.streamOffset + hdr.queuedSize != checkpoint.offset ||
+	   (State(hdr.state) != State::fileHeader && State(hdr.state) != State::dirHeader)) {
+		return fail();
+	}
+	if(!reserveLevels(hdr.level + 1)) {
+		return fail();
+	}
+	auto path = reader.get(hdr.pathLength);
+	if(path == nullptr) {
+		return fail();
+	}
+	currentPath = String(path, hdr.pathLength);
+
+	// Re-open directory stack and restore child tables
+	state = State(hdr.state);
+	size_t pathLength = rootPathLength;
+	for(unsigned i = 0; i < hdr.level; ++i) {
+		auto& dir = directories[i];
+		CheckpointLevel lvl;
+		const char* content;
+		if(!reader.read(lvl) || (content = reader.get(lvl.contentSize)) == nullptr) {
+			return fail();
+		}
+		level = i;
+		dir.type = Object::Type(lvl.type);
+		dir.namelen = lvl.namelen;
+		dir.createContent(bufferSize);
+		dir.content->write(content, lvl.contentSize);
+		pathLength += dir.namelen;
+		if(pathLength > currentPath.length()) {
+			return fail();
+		}
+		int err = fs->opendir(currentPath.substring(0, pathLength), dir.handle);
+		if(err >= 0) {
+			err = fs->seekdir(dir.handle, lvl.cookie);
+		}
+		if(err < 0) {
+			debug_w("[FWFS] Resume directory '%s': %s", currentPath.c_str(), fs->getErrorString(err).c_str());
+			return fail();
+		}
+	}
+	level = hdr.level;
+	if(pathLength != currentPath.length()) {
+		return fail();
+	}
+
+	if(hdr.dedupUsed != 0) {
+		auto entries = reader.get(hdr.dedupUsed * sizeof(DedupEntry));
+		if(entries == nullptr) {
+			return fail();
+		}
+		dedupTable.reset(new(std::nothrow) DedupEntry[FWFS_DEDUP_ENTRIES]);
+		if(!dedupTable) {
+			return fail();
+		}
+		memcpy(dedupTable.get(), entries, hdr.dedupUsed * sizeof(DedupEntry));
+	}
+	dedupUsed = hdr.dedupUsed;
+	dedupNext = hdr.dedupNext;
+	dedupCount = hdr.dedupCount;
+	dedupSize = hdr.dedupSize;
+	baseCount = hdr.baseCount;
+	baseSize = hdr.baseSize;
+	streamOffset = hdr.streamOffset;
+	queuedSize = hdr.queuedSize;
+	checksum = hdr.checksum;
+	checksumOffset = hdr.checksumOffset;
+	volumeInfo.creationTime = hdr.creationTime;
+
+	debug_d("[FWFS] Resumed @ 0x%08x, '%s'", checkpoint.offset, currentPath.c_str());
+	return true;
+}
+
 void ArchiveStream::queueStream(IDataSourceStream* stream, State newState)
 {
+	updatePeakMemoryUsage();
 	streamOffset += queuedSize;
 	assert(stream != nullptr);
 	int len = stream->available();
@@ -148,11 +618,54 @@ void ArchiveStream::queueStream(IDataSourceStream* stream, State newState)
 	queuedSize = len;
 }
 
-void ArchiveStream::openDirectory(const Stat& stat)
+void ArchiveStream::updatePeakMemoryUsage()
 {
-	GET_FS()
+	size_t size = maxLevels * sizeof(DirInfo) + currentPath.length() + buffer.getCapacity();
+	for(unsigned i = 0; i < maxLevels; ++i) {
+		auto& content = directories[i].content;
+		if(content) {
+			size += sizeof(ObjectBuffer) + content->getCapacity();
+		}
+	}
+	peakMemoryUsage = std::max(peakMemoryUsage, size);
+}
+
+/*
+ * Ensure the directory stack has at least the given number of entries.
+ * There is no fixed limit on nesting, only available RAM.
+ */
+bool ArchiveStream::reserveLevels(unsigned count)
+{
+	if(count <= maxLevels) {
+		return true;
+	}
+
+	unsigned newCount = std::max(count, maxLevels + 4);
+	auto dirs = new(std::nothrow) DirInfo[newCount];
+	if(dirs == nullptr) {
+		debug_e("[FWFS] No memory for %u directory levels", newCount);
+		return false;
+	}
+	for(unsigned i = 0; i < maxLevels; ++i) {
+		dirs[i] = std::move(directories[i]);
+	}
+	directories.reset(dirs);
+	maxLevels = newCount;
+	return true;
+}
+
+bool ArchiveStream::openDirectory(const Stat& stat)
+{
+	GET_FS(false)
+
+	// Need an entry for this directory plus one for its current file
+	if(!reserveLevels(level + 2)) {
+		state = State::error;
+		return false;
+	}
 
 	auto& dir = directories[level];
+	dir.reset();
 	if(level > 0) {
 		dir.namelen = 0;
 		if(currentPath.length() > 0) {
@@ -166,10 +679,17 @@ void ArchiveStream::openDirectory(const Stat& stat)
 
 	// Directory header
 	dir.type = stat.attr[FileAttribute::MountPoint] ? Object::Type::MountPoint : Object::Type::Directory;
-	dir.createContent();
+	dir.createContent(bufferSize);
 	dir.content->writeNamed(dir.type, stat.name.c_str(), stat.name.length, stat.mtime);
 
-	auto file = fs->open(currentPath, OpenFlag::Read | OpenFlag::NoFollow);
+	OpenFlags openFlags = OpenFlag::Read | OpenFlag::NoFollow;
+	FileHandle file{Error::NotImplemented};
+	if(level > 0) {
+		file = fs->openat(directories[level - 1].handle, stat.name.c_str(), openFlags);
+	}
+	if(file == Error::NotImplemented) {
+		file = fs->open(currentPath, openFlags);
+	}
 	if(file < 0) {
 		debug_w("[FWFS] Failed to open handle to directory '%s': %s", currentPath.c_str(),
 				fs->getErrorString(file).c_str());
@@ -183,19 +703,20 @@ void ArchiveStream::openDirectory(const Stat& stat)
 	// By default, don't enumerate mountpoints
 	if(stat.attr[FileAttribute::MountPoint] && !flags[Flag::IncludeMountPoints]) {
 		closeDirectory();
-		return;
+		return true;
 	}
 
 	int err = fs->opendir(currentPath, dir.handle);
 	if(err < 0) {
 		debug_w("[FWFS] opendir('%s'): %s", currentPath.c_str(), fs->getErrorString(err).c_str());
 		closeDirectory();
-		return;
+		return true;
 	}
 
 	if(!readDirectory()) {
 		closeDirectory();
 	}
+	return true;
 }
 
 bool ArchiveStream::openRootDirectory()
@@ -224,8 +745,7 @@ bool ArchiveStream::openRootDirectory()
 	}
 
 	stat.name = currentPath;
-	openDirectory(stat);
-	return true;
+	return openDirectory(stat);
 }
 
 bool ArchiveStream::readDirectory()
@@ -265,35 +785,57 @@ bool ArchiveStream::readDirectory()
 	return true;
 }
 
+FileHandle ArchiveStream::openEntry(const char* name, OpenFlags flags)
+{
+	GET_FS(Error::NoFileSystem)
+
+	// Entries are always in the directory being read, so avoid path lookup where possible
+	assert(level > 0);
+	auto file = fs->openat(directories[level - 1].handle, name, flags);
+	if(file != Error::NotImplemented) {
+		return file;
+	}
+
+	FileNameBuffer path;
+	path.copy(PathView(currentPath));
+	path.join(name);
+	if(path.overflow()) {
+		return Error::NameTooLong;
+	}
+	return fs->open(PathView(path.c_str(), path.length), flags);
+}
+
 bool ArchiveStream::readFileEntry(const Stat& stat)
 {
 	GET_FS(false)
 
 	auto& entry = directories[level];
-	entry.content.reset();
-	String path = currentPath;
-	if(path.length() > 0) {
-		path += '/';
-	}
-	path.concat(stat.name.c_str(), stat.name.length);
-
-	auto file = fs->open(path, OpenFlag::Read);
+	entry.reset();
+	auto file = openEntry(stat.name.c_str(), OpenFlag::Read);
 	if(file < 0) {
-		debug_e("[FWFS] Error opening '%s': %s", path.c_str(), fs->getErrorString(file).c_str());
+		debug_e("[FWFS] Error opening '%s': %s", stat.name.c_str(), fs->getErrorString(file).c_str());
 		return false;
 	}
 
 	// fileHeader
 	entry.type = Object::Type::File;
-	entry.createContent();
+	entry.createContent(bufferSize);
 	entry.content->writeNamed(entry.type, stat.name.c_str(), stat.name.length, stat.mtime);
 
 	FileInfo info{*this, entry, file, stat};
 	encoder.reset(createEncoder(info));
+	if(!encoder && flags[Flag::Compress]) {
+		encoder.reset(Lz4Encoder::create(info));
+	}
 
 	bool inlineData = !encoder && stat.size < maxInlineSize;
 
 	getAttributes(file, entry);
+	if(!encoder && base != nullptr && stat.size > sizeof(BaseDataInfo) && findBaseFile(stat)) {
+		fs->close(file);
+		sendFileHeader();
+		return true;
+	}
 	if(inlineData) {
 		// Put data inline for small files
 		entry.content->writeDataHeader(stat.size);
@@ -301,13 +843,26 @@ bool ArchiveStream::readFileEntry(const Stat& stat)
 		fs->read(file, buffer, stat.size);
 		fs->close(file);
 		entry.content->write(buffer, stat.size);
+		if(flags[Flag::DataChecksums]) {
+			entry.content->writeDataChecksum(crc32c(buffer, stat.size));
+		}
 		sendFileHeader();
 	} else {
 		if(!encoder) {
+			if(flags[Flag::Deduplicate] && findDuplicate(stat)) {
+				fs->close(file);
+				sendFileHeader();
+				return true;
+			}
 			// Default behaviour
 			auto stream = new FileStream(fs);
 			stream->attach(file, stat.size);
-			encoder = std::make_unique<BasicEncoder>(stream);
+			if(flags[Flag::ReadAhead] && stat.size > FWFS_READAHEAD_SIZE) {
+				encoder = std::make_unique<BasicEncoder>(new ReadAheadStream(stream, FWFS_READAHEAD_SIZE));
+			} else {
+				encoder = std::make_unique<BasicEncoder>(stream);
+				dataFile = file;
+			}
 		}
 		sendDataHeader();
 	}
@@ -317,6 +872,20 @@ bool ArchiveStream::readFileEntry(const Stat& stat)
 
 void ArchiveStream::sendDataHeader()
 {
+	auto& entry = directories[level];
+
+	if(state == State::dataContent && checksumOffset != UINT32_MAX) {
+		// Checksum follows reference to the data object it applies to
+		if(flags[Flag::DataChecksums]) {
+			entry.content->writeDataChecksum(dataChecksum);
+		}
+		// Content has been hashed as it was output so later files can now match it
+		if(dedupStreaming) {
+			addDedupEntry();
+		}
+	}
+	dataChecksum = 0;
+
 	dataBlock = encoder->getNextStream();
 	if(dataBlock == nullptr) {
 		sendFileHeader();
@@ -335,8 +904,127 @@ void ArchiveStream::sendDataHeader()
 	queueStream(buffer, State::dataHeader);
 
 	// Add reference to file header
-	auto& entry = directories[level];
 	entry.content->writeRef(type, streamOffset);
+
+	if(dedupPending.size != 0) {
+		dedupPending.dataId = streamOffset;
+		if(!dedupStreaming) {
+			addDedupEntry();
+		}
+	}
+}
+
+/*
+ * Look for file at same location in base archive. If unchanged, the file header references it.
+ */
+bool ArchiveStream::findBaseFile(const Stat& stat)
+{
+	// Paths in base are relative to our root
+	const char* dir = currentPath.c_str() + rootPathLength;
+	if(*dir == '/') {
+		++dir;
+	}
+	FileNameBuffer path;
+	path.copy(dir);
+	path.join(stat.name);
+	if(path.overflow()) {
+		return false;
+	}
+
+	Stat baseStat;
+	int err = base->stat(path.c_str(), &baseStat);
+	if(err < 0 || baseStat.isDir() || baseStat.size != stat.size || baseStat.mtime != stat.mtime) {
+		return false;
+	}
+
+	debug_d("[FWFS] '%s' unchanged from base #%08x", path.c_str(), baseStat.id);
+	directories[level].content->writeBaseData(baseStat.id, stat.size, stat.mtime);
+	++baseCount;
+	baseSize += stat.size;
+	return true;
+}
+
+/*
+ * Look for an identical copy of file content already in the archive.
+ * If found, the file header references the existing data object.
+ *
+ * Content is only read in advance if an entry of the same size exists.
+ * Otherwise it gets hashed as it's archived, see `updateChecksum()`.
+ */
+bool ArchiveStream::findDuplicate(const Stat& stat)
+{
+	GET_FS(false)
+
+	dedupPending = {};
+	dedupStreaming = false;
+
+	if(!dedupTable) {
+		dedupTable.reset(new(std::nothrow) DedupEntry[FWFS_DEDUP_ENTRIES]);
+		if(!dedupTable) {
+			debug_w("[FWFS] No memory for deduplication");
+			return false;
+		}
+	}
+
+	bool sizeMatch{false};
+	for(unsigned i = 0; i < dedupUsed && !sizeMatch; ++i) {
+		sizeMatch = (dedupTable[i].size == stat.size);
+	}
+	if(!sizeMatch) {
+		dedupPending = {uint32_t(stat.size), 0, fnvOffsetBasis, 0};
+		dedupStreaming = true;
+		return false;
+	}
+
+	// Use separate handle so the original remains at start of file
+	auto file = openEntry(stat.name.c_str(), OpenFlag::Read);
+	if(file < 0) {
+		return false;
+	}
+	DedupEntry ent{0, 0, fnvOffsetBasis};
+	uint8_t buffer[256];
+	int len;
+	while((len = fs->read(file, buffer, sizeof(buffer))) > 0) {
+		ent.size += len;
+		ent.crc = crc32c(buffer, len, ent.crc);
+		ent.hash = fnv1a(buffer, len, ent.hash);
+	}
+	fs->close(file);
+	if(len < 0 || ent.size != stat.size) {
+		return false;
+	}
+
+	for(unsigned i = 0; i < dedupUsed; ++i) {
+		auto& e = dedupTable[i];
+		if(e.size != ent.size || e.crc != ent.crc || e.hash != ent.hash) {
+			continue;
+		}
+		debug_d("[FWFS] '%s' duplicates #%08x", stat.name.c_str(), e.dataId);
+		auto& entry = directories[level];
+		entry.content->writeRef(ObjectBuffer::getDataType(ent.size), e.dataId);
+		if(flags[Flag::DataChecksums] && checksumOffset != UINT32_MAX) {
+			entry.content->writeDataChecksum(ent.crc);
+		}
+		++dedupCount;
+		dedupSize += ent.size;
+		return true;
+	}
+
+	dedupPending = ent;
+	return false;
+}
+
+void ArchiveStream::addDedupEntry()
+{
+	if(dedupUsed < FWFS_DEDUP_ENTRIES) {
+		dedupTable[dedupUsed++] = dedupPending;
+	} else {
+		// Table full, replace oldest entry
+		dedupTable[dedupNext] = dedupPending;
+		dedupNext = (dedupNext + 1) % FWFS_DEDUP_ENTRIES;
+	}
+	dedupPending = {};
+	dedupStreaming = false;
 }
 
 void ArchiveStream::sendDataContent()
@@ -353,13 +1041,18 @@ void ArchiveStream::sendDataContent()
 void ArchiveStream::sendFileHeader()
 {
 	encoder.reset();
+	dataFile = -1;
+	dedupPending = {};
+	dedupStreaming = false;
 	auto& entry = directories[level];
-	entry.content->fixupSize();
+	if(!entry.content->fixupSize()) {
+		state = State::error;
+		return;
+	}
 	queueStream(*entry.content, State::fileHeader);
 
 	// Add reference to parent directory
-	auto& parent = directories[level - 1];
-	parent.content->writeRef(entry.type, streamOffset);
+	addChild(level - 1, entry.type, streamOffset);
 }
 
 int ArchiveStream::DirInfo::addAttribute(AttributeTag tag, const void* data, size_t size)
@@ -434,7 +1127,9 @@ void ArchiveStream::closeDirectory()
 	GET_FS()
 
 	assert(level > 0);
+	// Buffers are only retained for levels on the current path
 	directories[level].reset();
+	directories[level].content.reset();
 	--level;
 	auto& dir = directories[level];
 	fs->closedir(dir.handle);
@@ -442,16 +1137,103 @@ void ArchiveStream::closeDirectory()
 	assert(currentPath.length() >= dir.namelen);
 	currentPath.setLength(currentPath.length() - dir.namelen);
 
-	dir.content->fixupSize();
-	queueStream(*dir.content, State::dirHeader);
+	if(dir.scratchFile >= 0) {
+		if(!closeScratch(level)) {
+			state = State::error;
+			return;
+		}
+		queueStream(dir.scratchStream.get(), State::dirHeader);
+	} else {
+		if(!dir.content->fixupSize()) {
+			state = State::error;
+			return;
+		}
+		queueStream(*dir.content, State::dirHeader);
+	}
 
 	// Add entry for this directory to parent
 	if(level > 0) {
-		auto& parent = directories[level - 1];
-		parent.content->writeRef(dir.type, streamOffset);
+		addChild(level - 1, dir.type, streamOffset);
+	}
+}
+
+void ArchiveStream::addChild(unsigned parentLevel, Object::Type type, Object::ID objId)
+{
+	auto& dir = directories[parentLevel];
+	dir.content->writeRef(type, objId);
+	if(scratchFs != nullptr && dir.content->getSize() > FWFS_SCRATCH_THRESHOLD && !writeScratch(parentLevel)) {
+		state = State::error;
 	}
 }
 
+/*
+ * Move directory content out of RAM, appending it to the scratch file for this level
+ */
+bool ArchiveStream::writeScratch(unsigned dirLevel)
+{
+	auto& dir = directories[dirLevel];
+	if(dir.scratchFile < 0) {
+		auto path = getScratchPath(dirLevel);
+		dir.scratchFile = scratchFs->open(path, OpenFlag::Create | OpenFlag::Truncate | OpenFlag::Read | OpenFlag::Write);
+		if(dir.scratchFile < 0) {
+			debug_e("[FWFS] Scratch file '%s': %s", path.c_str(), scratchFs->getErrorString(dir.scratchFile).c_str());
+			return false;
+		}
+		scratchLevels = std::max(scratchLevels, dirLevel + 1);
+		debug_d("[FWFS] Directory '%s' using scratch file", currentPath.c_str());
+	}
+
+	size_t size = dir.content->getSize();
+	int res = scratchFs->write(dir.scratchFile, dir.content->getData(), size);
+	if(res != int(size)) {
+		debug_e("[FWFS] Scratch write failed: %s", scratchFs->getErrorString(res).c_str());
+		return false;
+	}
+	dir.scratchSize += size;
+	dir.content->clear();
+	return true;
+}
+
+/*
+ * Write any remaining content to scratch file and update object header with final size,
+ * then prepare to stream it back
+ */
+bool ArchiveStream::closeScratch(unsigned dirLevel)
+{
+	auto& dir = directories[dirLevel];
+	if(dir.content->getSize() != 0 && !writeScratch(dirLevel)) {
+		return false;
+	}
+
+	auto file = dir.scratchFile;
+	Object hdr;
+	bool ok = scratchFs->lseek(file, 0, SeekOrigin::Start) == 0 && scratchFs->read(file, &hdr, 4) == 4;
+	if(ok) {
+		auto size = dir.scratchSize - hdr.contentOffset();
+		if(size > hdr.maxContentSize()) {
+			debug_e("[FWFS] Directory too large (%u bytes, maximum %u)", size, hdr.maxContentSize());
+			scratchFs->close(file);
+			dir.scratchFile = -1;
+			return false;
+		}
+		hdr.setContentSize(size);
+		ok = scratchFs->lseek(file, 0, SeekOrigin::Start) == 0 && scratchFs->write(file, &hdr, 4) == 4 &&
+			 scratchFs->lseek(file, 0, SeekOrigin::Start) == 0;
+	}
+	if(!ok) {
+		debug_e("[FWFS] Scratch file update failed");
+		scratchFs->close(file);
+		dir.scratchFile = -1;
+		return false;
+	}
+
+	auto stream = new FileStream(scratchFs);
+	stream->attach(file, dir.scratchSize);
+	dir.scratchStream.reset(stream);
+	dir.scratchFile = -1;
+	return true;
+}
+
 void ArchiveStream::getVolume()
 {
 	buffer.writeNamed(Object::Type::Volume, volumeInfo.name.c_str(), volumeInfo.name.length(), volumeInfo.creationTime);
@@ -465,11 +1247,22 @@ void ArchiveStream::getVolume()
 
 	// Last object written was root directory
 	buffer.writeRef(Object::Type::Directory, streamOffset);
-	buffer.fixupSize();
+	if(!buffer.fixupSize()) {
+		state = State::error;
+		return;
+	}
+
+	// Checksum covers everything preceding the End object
+	if(checksumOffset == streamOffset + queuedSize) {
+		checksum = buffer.checksum(checksum);
+	} else {
+		checksum = 0;
+	}
+	checksumOffset = UINT32_MAX;
 
 	// End
 	hdr.setType(Object::Type::End);
-	hdr.data8.end.checksum = 0; // not currently used
+	hdr.data8.end.checksum = checksum;
 	hdr.data8.setContentSize(sizeof(uint32_t));
 	buffer.write(hdr, sizeof(uint32_t), 0);
 
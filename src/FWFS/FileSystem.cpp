@@ -22,6 +22,7 @@
 #include <IFS/FWFS/FileSystem.h>
 #include <IFS/FWFS/Object.h>
 #include <IFS/Util.h>
+#include <IFS/Crc32c.h>
 
 #ifdef DEBUG_FWFS
 #include <Platform/Timers.h>
@@ -150,6 +151,16 @@ int FileSystem::fillStat(Stat& stat, const FWObjDesc& entry)
 			stat.acl.writeAccess = child.obj.data8.ace.role;
 			break;
 
+		case Object::Type::BaseData: {
+			BaseDataInfo info;
+			int res = readBaseInfo(entry, child, info);
+			if(res < 0) {
+				return res;
+			}
+			stat.size += info.size;
+			break;
+		}
+
 		default:; // Not interested
 		}
 		child.next();
@@ -198,6 +209,9 @@ int FileSystem::fgetextents(FileHandle file, Storage::Partition* part, Extent* l
 				list[extIndex] = ext;
 			}
 			++extIndex;
+		} else if(child.obj.type() == Object::Type::BaseData) {
+			// Content is in another filesystem
+			return Error::NotSupported;
 		}
 
 		child.next();
@@ -235,19 +249,34 @@ int FileSystem::read(FileHandle file, void* data, size_t size)
 	FWObjDesc child;
 	int res;
 	while((res = readChildObjectHeader(fd.odFile, child)) >= 0) {
-		if(child.obj.isData()) {
+		bool isBase = child.obj.type() == Object::Type::BaseData;
+		if(child.obj.isData() || isBase) {
 			FWObjDesc odData;
-			res = getChildObject(fd.odFile, child, odData);
+			BaseDataInfo baseInfo;
+			if(isBase) {
+				res = readBaseInfo(fd.odFile, child, baseInfo);
+				ext.length = baseInfo.size;
+			} else {
+				res = getChildObject(fd.odFile, child, odData);
+				ext.length = odData.obj.contentSize();
+			}
 			if(res < 0) {
 				return res;
 			}
 
-			ext.length = odData.obj.contentSize();
 			// Do we need data from this object ?
-			if(fd.cursor >= ext.start) {
+			if(fd.cursor >= ext.start && fd.cursor < ext.start + ext.length) {
 				auto offset = fd.cursor - ext.start;
 				auto readlen = std::min(ext.length - offset, size - readTotal);
-				res = readObjectContent(odData, fd.cursor - ext.start, readlen, at_offset<void*>(data, readTotal));
+				auto buffer = at_offset<void*>(data, readTotal);
+				if(isBase) {
+					res = readBaseData(fd, baseInfo, offset, readlen, buffer);
+				} else {
+					res = verifyData(fd, child, odData);
+					if(res >= 0) {
+						res = readObjectContent(odData, offset, readlen, buffer);
+					}
+				}
 				if(res >= 0) {
 					fd.cursor += readlen;
 					readTotal += readlen;
@@ -268,6 +297,125 @@ int FileSystem::read(FileHandle file, void* data, size_t size)
 	return (res == FS_OK) || (res == Error::EndOfObjects) ? readTotal : res;
 }
 
+int FileSystem::verifyData(FWFileDesc& fd, const FWObjDesc& child, const FWObjDesc& odData)
+{
+	auto size = odData.obj.contentSize();
+	// Large objects can't share a granule, so one bit per granule is unambiguous
+	bool remember = size >= FWFS_VERIFY_GRANULE && odData.id < endObject;
+	auto index = odData.id / FWFS_VERIFY_GRANULE;
+	uint8_t mask = 1U << (index % 8);
+	index /= 8;
+	if(remember && verified && (verified[index] & mask)) {
+		return FS_OK;
+	}
+	if(!remember && fd.verifiedData == odData.id) {
+		return FS_OK;
+	}
+
+	FWObjDesc odCrc = child;
+	odCrc.next();
+	int res = readChildObjectHeader(fd.odFile, odCrc);
+	if(res == Error::EndOfObjects || (res >= 0 && odCrc.obj.type() != Object::Type::DataChecksum)) {
+		// No checksum for this object
+		return FS_OK;
+	}
+	if(res < 0) {
+		return res;
+	}
+
+	uint32_t crc{0};
+	uint8_t buffer[256];
+	for(uint32_t offset = 0; offset < size;) {
+		auto len = std::min(size - offset, unsigned(sizeof(buffer)));
+		res = readObjectContent(odData, offset, len, buffer);
+		if(res < 0) {
+			return res;
+		}
+		crc = crc32c(buffer, len, crc);
+		offset += len;
+	}
+
+	if(crc != odCrc.obj.data8.dataChecksum.crc) {
+		debug_e("[FWFS] Data object #0x%08x checksum mismatch: found 0x%08x, expected 0x%08x", odData.id, crc,
+				odCrc.obj.data8.dataChecksum.crc);
+		return Error::BadChecksum;
+	}
+
+	if(remember) {
+		if(!verified) {
+			// If there's no memory for the bitmap objects just get verified every time
+			auto bitmapSize = (endObject / FWFS_VERIFY_GRANULE + 8) / 8;
+			verified.reset(new(std::nothrow) uint8_t[bitmapSize]{});
+		}
+		if(verified) {
+			verified[index] |= mask;
+		}
+	} else {
+		fd.verifiedData = odData.id;
+	}
+
+	return FS_OK;
+}
+
+int FileSystem::readBaseInfo(const FWObjDesc& parent, const FWObjDesc& child, BaseDataInfo& info)
+{
+	if(child.obj.contentSize() != sizeof(info)) {
+		return Error::BadObject;
+	}
+	FWObjDesc od;
+	int res = getChildObject(parent, child, od);
+	if(res < 0) {
+		return res;
+	}
+	return readObjectContent(od, 0, sizeof(info), &info);
+}
+
+int FileSystem::readBaseData(FWFileDesc& fd, const BaseDataInfo& info, uint32_t offset, uint32_t size,
+							 void* buffer)
+{
+	if(base == nullptr) {
+		debug_e("[FWFS] Differential image requires base filesystem");
+		return Error::NoFileSystem;
+	}
+
+	if(fd.baseFile < 0 || fd.baseFileId != info.fileId) {
+		if(fd.baseFile >= 0) {
+			base->close(fd.baseFile);
+			fd.baseFile = -1;
+		}
+
+		auto file = base->openById(info.fileId, OpenFlag::Read);
+		if(file < 0) {
+			return file;
+		}
+
+		// Make sure it's the same content we were archived against
+		Stat stat;
+		int res = base->fstat(file, &stat);
+		if(res >= 0 && (stat.size != info.size || stat.mtime != info.mtime)) {
+			debug_e("[FWFS] Base file #0x%08x size %u, mtime %u: expected %u, %u", info.fileId, stat.size,
+					uint32_t(stat.mtime), info.size, uint32_t(info.mtime));
+			res = Error::BadObject;
+		}
+		if(res < 0) {
+			base->close(file);
+			return res;
+		}
+
+		fd.baseFile = file;
+		fd.baseFileId = info.fileId;
+	}
+
+	int res = base->lseek(fd.baseFile, offset, SeekOrigin::Start);
+	if(res >= 0) {
+		res = base->read(fd.baseFile, buffer, size);
+		if(res >= 0 && unsigned(res) != size) {
+			res = Error::ReadFailure;
+		}
+	}
+	return res < 0 ? res : FS_OK;
+}
+
 int FileSystem::write(FileHandle file, const void* data, size_t size)
 {
 	GET_FD();
@@ -349,6 +497,8 @@ int FileSystem::mount()
 		return Error::BadFileSystem;
 	}
 
+	verified.reset();
+
 	[[maybe_unused]] unsigned objectCount = 0;
 	FWObjDesc odVolume{};
 	FWObjDesc od{FWFS_BASE_OFFSET};
@@ -362,8 +512,8 @@ int FileSystem::mount()
 		} else if(od.obj.type() == Object::Type::Directory) {
 			odRoot = od;
 		} else if(od.obj.type() == Object::Type::End) {
-			// @todo verify checksum
-			// od.obj.end.checksum
+			// Verified by check()
+			checksum = od.obj.data8.end.checksum;
 			break;
 		}
 
@@ -371,6 +521,7 @@ int FileSystem::mount()
 	}
 
 	volume = odVolume.id;
+	endObject = od.id;
 	debug_d("Ended @ 0x%08X, %u objects, volume @ 0x%08X", od.id, objectCount, volume);
 
 	if(res < 0) {
@@ -409,6 +560,38 @@ int FileSystem::mount()
 	return FS_OK;
 }
 
+int FileSystem::check()
+{
+	CHECK_MOUNTED()
+
+	if(checksum == 0) {
+		return Error::NotSupported;
+	}
+
+	// Large aligned reads are most efficient
+	std::unique_ptr<uint32_t[]> buffer(new(std::nothrow) uint32_t[FWFS_CHECK_BUFFER_SIZE / sizeof(uint32_t)]);
+	if(!buffer) {
+		return Error::NoMem;
+	}
+
+	uint32_t crc{0};
+	for(uint32_t offset = 0; offset < endObject;) {
+		auto len = std::min(endObject - offset, uint32_t(FWFS_CHECK_BUFFER_SIZE));
+		if(!partition.read(offset, buffer.get(), len)) {
+			return Error::ReadFailure;
+		}
+		crc = crc32c(buffer.get(), len, crc);
+		offset += len;
+	}
+
+	if(crc != checksum) {
+		debug_e("[FWFS] Checksum mismatch: found 0x%08x, expected 0x%08x", crc, checksum);
+		return Error::BadChecksum;
+	}
+
+	return FS_OK;
+}
+
 int FileSystem::getinfo(Info& info)
 {
 	int res{FS_OK};
@@ -479,6 +662,34 @@ int FileSystem::findObject(Object::ID id, FWObjDesc& od)
 	return FS_OK;
 }
 
+int FileSystem::findNamedObject(FileID id, FWObjDesc& od)
+{
+	if(id < FWFS_BASE_OFFSET || id >= endObject) {
+		return Error::NotFound;
+	}
+
+	int res = findObject(id, od);
+	if(res < 0) {
+		return res;
+	}
+
+	// Anything else can't have been obtained from Stat::id
+	switch(od.obj.type()) {
+	case Object::Type::File:
+	case Object::Type::Directory:
+	case Object::Type::MountPoint:
+		break;
+	default:
+		return Error::BadObject;
+	}
+
+	if(od.nextOffset() > endObject) {
+		return Error::BadObject;
+	}
+
+	return FS_OK;
+}
+
 int FileSystem::readChildObjectHeader(const FWObjDesc& parent, FWObjDesc& child)
 {
 	assert(parent.obj.isNamed());
@@ -626,9 +837,12 @@ int FileSystem::readObjectName(const FWObjDesc& od, NameBuffer& name)
 
 int FileSystem::opendir(const char* path, DirHandle& dir)
 {
-	CHECK_MOUNTED();
+	return opendir(PathView(path), dir);
+}
 
-	FS_CHECK_PATH(path)
+int FileSystem::opendir(PathView path, DirHandle& dir)
+{
+	CHECK_MOUNTED();
 
 	FWObjDesc od;
 	int res = findObjectByPath(path, od);
@@ -708,6 +922,50 @@ int FileSystem::rewinddir(DirHandle dir)
 	return 0;
 }
 
+int FileSystem::telldir(DirHandle dir, DirCookie& cookie)
+{
+	GET_FILEDIR()
+	auto& fd = *d;
+
+	if(fd.isMountPoint()) {
+		return fd.fileSystem->telldir(fd.dir, cookie);
+	}
+
+	// Offset of next child object within directory
+	cookie = fd.cursor;
+	return FS_OK;
+}
+
+int FileSystem::seekdir(DirHandle dir, DirCookie cookie)
+{
+	GET_FILEDIR()
+	auto& fd = *d;
+
+	if(fd.isMountPoint()) {
+		return fd.fileSystem->seekdir(fd.dir, cookie);
+	}
+
+	if(cookie > fd.odFile.obj.childTableSize()) {
+		return Error::BadParam;
+	}
+
+	// Cookie must be on a child object boundary
+	FWObjDesc od{};
+	while(od.offset() < cookie) {
+		int res = readChildObjectHeader(fd.odFile, od);
+		if(res < 0) {
+			return (res == Error::EndOfObjects) ? Error::BadParam : res;
+		}
+		od.next();
+	}
+	if(od.offset() != cookie) {
+		return Error::BadParam;
+	}
+
+	fd.cursor = cookie;
+	return FS_OK;
+}
+
 int FileSystem::closedir(DirHandle dir)
 {
 	GET_FILEDIR()
@@ -742,41 +1000,42 @@ int FileSystem::mkdir(const char* path)
  *  Called by open, opendir and stat methods.
  *  @todo track ACEs during path traversal and store resultant ACL in file descriptor.
  */
-int FileSystem::findObjectByPath(const char*& path, FWObjDesc& od)
+int FileSystem::findObjectByPath(PathView& path, FWObjDesc& od)
 {
 	// Start with the root directory object
 	od = odRoot;
 
 	// Empty paths indicate root directory
-	const char* tail = path;
-	FS_CHECK_PATH(tail);
-	if(tail == nullptr) {
+	if(isRootPath(path)) {
 		return FS_OK;
 	}
 
+	return findRelativeObject(path, od);
+}
+
+int FileSystem::findRelativeObject(PathView& path, FWObjDesc& od)
+{
 	int res{FS_OK};
-	const char* sep;
 	do {
-		sep = strchr(tail, '/');
-		size_t namelen;
-		if(sep == nullptr) {
-			namelen = strlen(tail);
-		} else {
-			namelen = sep - tail;
-			++path;
-		}
-		path += namelen;
-
+		auto namelen = path.elementLength();
 		FWObjDesc parent = od;
-		res = findChildObject(parent, od, tail, namelen);
-
+		res = findChildObject(parent, od, path.text, namelen);
+		// Consume name and separator
+		path.skip(namelen + 1);
 		if(res < 0) {
 			break;
 		}
+	} while(path.length != 0 && !od.obj.isMountPoint());
 
-		tail = path;
-	} while(sep != nullptr && !od.obj.isMountPoint());
+	return res;
+}
 
+int FileSystem::findObjectByPath(const char*& path, FWObjDesc& od)
+{
+	// Remaining path is a suffix of the original so is still nul-terminated
+	PathView view(path);
+	int res = findObjectByPath(view, od);
+	path = view.text;
 	return res;
 }
 
@@ -793,6 +1052,14 @@ int FileSystem::getObjectDataSize(FWObjDesc& od, uint32_t& dataSize)
 			}
 
 			dataSize += odData.obj.contentSize();
+		} else if(child.obj.type() == Object::Type::BaseData) {
+			BaseDataInfo info;
+			int res = readBaseInfo(od, child, info);
+			if(res < 0) {
+				return res;
+			}
+
+			dataSize += info.size;
 		}
 
 		child.next();
@@ -802,15 +1069,18 @@ int FileSystem::getObjectDataSize(FWObjDesc& od, uint32_t& dataSize)
 }
 
 FileHandle FileSystem::open(const char* path, OpenFlags flags)
+{
+	return open(PathView(path), flags);
+}
+
+FileHandle FileSystem::open(PathView path, OpenFlags flags)
 {
 	CHECK_MOUNTED();
 
 #if FWFS_DEBUG
-	debug_d("open('%s', %s)", path, toString(flags).c_str());
+	debug_d("open('%.*s', %s)", path.length, path.text, toString(flags).c_str());
 #endif
 
-	FS_CHECK_PATH(path)
-
 	FWObjDesc od;
 	int res = findObjectByPath(path, od);
 	if(res < 0) {
@@ -818,9 +1088,62 @@ FileHandle FileSystem::open(const char* path, OpenFlags flags)
 	}
 
 #if FWFS_DEBUG
-	debug_d("Found '%s' @ 0x%08x", path, od.ref);
+	debug_d("Found '%.*s' @ 0x%08x", path.length, path.text, od.id);
 #endif
 
+	return openObject(od, path, flags);
+}
+
+FileHandle FileSystem::openById(FileID id, OpenFlags flags)
+{
+	CHECK_MOUNTED();
+
+	FWObjDesc od;
+	int res = findNamedObject(id, od);
+	if(res < 0) {
+		return res;
+	}
+
+	// Identifier refers to this object, so don't follow mountpoints
+	return openObject(od, nullptr, flags + OpenFlag::NoFollow);
+}
+
+FileHandle FileSystem::openat(DirHandle dir, const char* name, OpenFlags flags)
+{
+	GET_FILEDIR()
+	auto& fdDir = *d;
+
+	if(fdDir.isMountPoint()) {
+		// Wrap handle obtained from mounted filesystem
+		int descriptorIndex = findUnusedDescriptor();
+		if(descriptorIndex < 0) {
+			return descriptorIndex;
+		}
+		FileHandle file = fdDir.fileSystem->openat(fdDir.dir, name, flags);
+		if(file < 0) {
+			return file;
+		}
+		auto& fd = fileDescriptors[descriptorIndex];
+		fd = FWFileDesc{fdDir.odFile};
+		fd.fileSystem = fdDir.fileSystem;
+		fd.file = file;
+		return FWFS_HANDLE_MIN + descriptorIndex;
+	}
+
+	PathView path(name);
+	FWObjDesc od = fdDir.odFile;
+	if(path.length != 0) {
+		int res = findRelativeObject(path, od);
+		if(res < 0) {
+			return res;
+		}
+	}
+
+	return openObject(od, path, flags);
+}
+
+FileHandle FileSystem::openObject(const FWObjDesc& od, PathView path, OpenFlags flags)
+{
 	int descriptorIndex = findUnusedDescriptor();
 	if(descriptorIndex < 0) {
 		return descriptorIndex;
@@ -831,13 +1154,14 @@ FileHandle FileSystem::open(const char* path, OpenFlags flags)
 
 	bool openMountPoint = od.obj.isMountPoint();
 	if(openMountPoint && flags[OpenFlag::NoFollow]) {
-		if(path == nullptr || *path == '\0') {
+		if(path.length == 0) {
 			openMountPoint = false;
 			// Change to regular directory...
 			fd.odFile.obj.typeData = unsigned(Object::Type::Directory);
 		}
 	}
 
+	int res;
 	if(openMountPoint) {
 		res = resolveMountPoint(od, fd.fileSystem);
 		if(res == FS_OK) {
@@ -873,12 +1197,20 @@ int FileSystem::close(FileHandle file)
 	if(fd.isMountPoint()) {
 		res = fd.fileSystem->close(fd.file);
 	}
+	if(fd.baseFile >= 0) {
+		base->close(fd.baseFile);
+	}
 
 	fd.reset();
 	return res;
 }
 
 int FileSystem::stat(const char* path, Stat* stat)
+{
+	return this->stat(PathView(path), stat);
+}
+
+int FileSystem::stat(PathView path, Stat* stat)
 {
 	CHECK_MOUNTED();
 
@@ -902,6 +1234,46 @@ int FileSystem::stat(const char* path, Stat* stat)
 	return res;
 }
 
+int FileSystem::statById(FileID id, Stat* stat)
+{
+	CHECK_MOUNTED();
+
+	FWObjDesc od;
+	int res = findNamedObject(id, od);
+	if(res < 0 || stat == nullptr) {
+		return res;
+	}
+
+	return fillStat(*stat, od);
+}
+
+int FileSystem::statat(DirHandle dir, const char* name, Stat* stat)
+{
+	GET_FILEDIR()
+	auto& fd = *d;
+
+	if(fd.isMountPoint()) {
+		return fd.fileSystem->statat(fd.dir, name, stat);
+	}
+
+	PathView path(name);
+	FWObjDesc od = fd.odFile;
+	if(path.length != 0) {
+		int res = findRelativeObject(path, od);
+		if(res < 0) {
+			return res;
+		}
+	}
+
+	if(od.obj.isMountPoint() && path.length != 0) {
+		IFileSystem* fs;
+		int res = resolveMountPoint(od, fs);
+		return (res < 0) ? res : fs->stat(path, stat);
+	}
+
+	return stat ? fillStat(*stat, od) : FS_OK;
+}
+
 int FileSystem::fstat(FileHandle file, Stat* stat)
 {
 	GET_FD();
@@ -1113,6 +1485,8 @@ int FileSystem::fenumxattr(FileHandle file, AttributeEnumCallback callback, void
 		case Object::Type::Data8:
 		case Object::Type::Data16:
 		case Object::Type::Data24:
+		case Object::Type::DataChecksum:
+		case Object::Type::BaseData:
 			break; // ignore
 
 		case Object::Type::Comment:
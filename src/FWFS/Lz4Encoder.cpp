@@ -0,0 +1,343 @@
+/****
+ * Lz4Encoder.cpp
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "../include/IFS/FWFS/Lz4Encoder.h"
+#include <Data/WebConstants.h>
+
+namespace IFS::FWFS
+{
+namespace LZ4
+{
+namespace
+{
+constexpr unsigned minMatch{4};
+constexpr unsigned lastLiterals{5}; ///< Block always ends with at least this many literals
+constexpr unsigned mfLimit{12};		///< Last match must start at least this far from end of block
+
+uint32_t read32(const uint8_t* ptr)
+{
+	uint32_t value;
+	memcpy(&value, ptr, sizeof(value));
+	return value;
+}
+
+unsigned hash(uint32_t value)
+{
+	return (value * 2654435761U) >> (32 - FWFS_LZ4_HASH_BITS);
+}
+
+uint8_t* writeLength(uint8_t* op, unsigned length)
+{
+	while(length >= 255) {
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = length;
+	return op;
+}
+
+} // namespace
+
+int compress(const void* src, size_t srcSize, void* dst, size_t dstSize, uint16_t* hashTable)
+{
+	auto base = static_cast<const uint8_t*>(src);
+	auto srcEnd = base + srcSize;
+	auto ip = base;
+	auto anchor = base;
+	auto op = static_cast<uint8_t*>(dst);
+	auto opEnd = op + dstSize;
+
+	// Write literals from anchor to ip, followed by match (if matchLength is non-zero)
+	auto writeSequence = [&](const uint8_t* match, unsigned matchLength) -> bool {
+		unsigned literalLength = ip - anchor;
+		size_t maxSize = 1 + literalLength / 255 + 1 + literalLength + 2 + matchLength / 255 + 1;
+		if(maxSize > size_t(opEnd - op)) {
+			return false;
+		}
+		auto token = op++;
+		*token = std::min(literalLength, 15U) << 4;
+		if(literalLength >= 15) {
+			op = writeLength(op, literalLength - 15);
+		}
+		memcpy(op, anchor, literalLength);
+		op += literalLength;
+		if(matchLength == 0) {
+			return true;
+		}
+		uint16_t offset = ip - match;
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+		matchLength -= minMatch;
+		*token |= std::min(matchLength, 15U);
+		if(matchLength >= 15) {
+			op = writeLength(op, matchLength - 15);
+		}
+		return true;
+	};
+
+	if(srcSize > mfLimit) {
+		memset(hashTable, 0, sizeof(uint16_t) << FWFS_LZ4_HASH_BITS);
+		auto matchLimit = srcEnd - lastLiterals;
+		auto searchLimit = srcEnd - mfLimit;
+		while(ip < searchLimit) {
+			auto sequence = read32(ip);
+			auto& entry = hashTable[hash(sequence)];
+			auto match = base + entry;
+			entry = ip - base;
+			if(match >= ip || read32(match) != sequence) {
+				// Step faster through data which isn't compressing
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			while(ip > anchor && match > base && ip[-1] == match[-1]) {
+				--ip;
+				--match;
+			}
+			unsigned matchLength = minMatch;
+			while(ip + matchLength < matchLimit && ip[matchLength] == match[matchLength]) {
+				++matchLength;
+			}
+			if(!writeSequence(match, matchLength)) {
+				return Error::BufferTooSmall;
+			}
+			ip += matchLength;
+			anchor = ip;
+		}
+	}
+
+	ip = srcEnd;
+	if(!writeSequence(nullptr, 0)) {
+		return Error::BufferTooSmall;
+	}
+
+	return op - static_cast<uint8_t*>(dst);
+}
+
+int decompress(const void* src, size_t srcSize, void* dst, size_t dstSize)
+{
+	auto ip = static_cast<const uint8_t*>(src);
+	auto srcEnd = ip + srcSize;
+	auto op = static_cast<uint8_t*>(dst);
+	auto dstStart = op;
+	auto dstEnd = op + dstSize;
+
+	auto readLength = [&](unsigned& length) -> bool {
+		if(length != 15) {
+			return true;
+		}
+		uint8_t c;
+		do {
+			if(ip >= srcEnd) {
+				return false;
+			}
+			c = *ip++;
+			length += c;
+		} while(c == 255);
+		return true;
+	};
+
+	while(ip < srcEnd) {
+		auto token = *ip++;
+		unsigned length = token >> 4;
+		if(!readLength(length) || length > size_t(srcEnd - ip) || length > size_t(dstEnd - op)) {
+			return Error::BadObject;
+		}
+		memcpy(op, ip, length);
+		ip += length;
+		op += length;
+
+		// Final sequence has no match
+		if(ip == srcEnd) {
+			break;
+		}
+
+		if(srcEnd - ip < 2) {
+			return Error::BadObject;
+		}
+		unsigned offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		length = token & 0x0f;
+		if(offset == 0 || offset > size_t(op - dstStart) || !readLength(length)) {
+			return Error::BadObject;
+		}
+		length += minMatch;
+		if(length > size_t(dstEnd - op)) {
+			return Error::BadObject;
+		}
+		// Match may overlap output so copy bytewise
+		auto match = op - offset;
+		while(length-- != 0) {
+			*op++ = *match++;
+		}
+	}
+
+	return op - dstStart;
+}
+
+} // namespace LZ4
+
+IBlockEncoder* Lz4Encoder::create(ArchiveStream::FileInfo& file)
+{
+	auto& stat = file.stat;
+	if(stat.size < FWFS_LZ4_MIN_SIZE || stat.compression.type != Compression::Type::None) {
+		return nullptr;
+	}
+
+	switch(ContentType::fromFullFileName(stat.name.c_str(), MIME_UNKNOWN)) {
+	case MIME_JPEG:
+	case MIME_GIF:
+	case MIME_PNG:
+	case MIME_GZIP:
+	case MIME_ZIP:
+		return nullptr;
+	default:;
+	}
+
+	auto buffer = new(std::nothrow) uint8_t[bufferSize];
+	if(buffer == nullptr) {
+		debug_w("[LZ4] No memory to compress '%s'", stat.name.c_str());
+		return nullptr;
+	}
+
+	return new Lz4Encoder(file, buffer);
+}
+
+Lz4Encoder::Lz4Encoder(ArchiveStream::FileInfo& file, uint8_t* buffer)
+	: fileSystem(file.getFileSystem()), file(file.handle), buffer(buffer)
+{
+	Compression cmp{Compression::Type::LZ4, uint32_t(file.stat.size)};
+	file.setAttribute(AttributeTag::Compression, &cmp, sizeof(cmp));
+}
+
+Lz4Encoder::~Lz4Encoder()
+{
+	fileSystem->close(file);
+}
+
+IDataSourceStream* Lz4Encoder::getNextStream()
+{
+	// Hash table goes first to ensure alignment
+	auto hashTable = reinterpret_cast<uint16_t*>(buffer.get());
+	auto input = buffer.get() + hashTableSize * sizeof(uint16_t);
+	auto output = input + FWFS_LZ4_BLOCK_SIZE;
+
+	int len = fileSystem->read(file, input, FWFS_LZ4_BLOCK_SIZE);
+	if(len <= 0) {
+		return nullptr;
+	}
+
+	// Only use compressed data if it's smaller
+	LZ4::BlockHeader hdr{uint16_t(len), uint16_t(len)};
+	auto data = output + sizeof(hdr);
+	int res = LZ4::compress(input, len, data, len - 1, hashTable);
+	if(res > 0) {
+		hdr.compressedSize = res;
+	} else {
+		memcpy(data, input, len);
+	}
+	memcpy(output, &hdr, sizeof(hdr));
+
+	size_t size = sizeof(hdr) + hdr.compressedSize;
+	stream = std::make_unique<LimitedMemoryStream>(output, size, size, false);
+	return stream.get();
+}
+
+bool Lz4Decoder::readSource(void* buffer, size_t size)
+{
+	auto ptr = static_cast<char*>(buffer);
+	while(size != 0) {
+		auto len = source->readMemoryBlock(ptr, size);
+		if(len == 0) {
+			return false;
+		}
+		source->seek(len);
+		ptr += len;
+		size -= len;
+	}
+	return true;
+}
+
+bool Lz4Decoder::decodeBlock()
+{
+	LZ4::BlockHeader hdr;
+	bool ok = readSource(&hdr, sizeof(hdr)) && hdr.originalSize != 0 && hdr.compressedSize <= hdr.originalSize;
+	if(ok && hdr.originalSize > blockSize) {
+		blockSize = hdr.originalSize;
+		buffer.reset(new(std::nothrow) uint8_t[2 * blockSize]);
+		if(!buffer) {
+			debug_e("[LZ4] No memory for %u byte block", blockSize);
+			blockSize = 0;
+			ok = false;
+		}
+	}
+	if(ok) {
+		auto output = buffer.get() + blockSize;
+		if(hdr.compressedSize == hdr.originalSize) {
+			ok = readSource(output, hdr.originalSize);
+		} else {
+			ok = readSource(buffer.get(), hdr.compressedSize) &&
+				 LZ4::decompress(buffer.get(), hdr.compressedSize, output, hdr.originalSize) == hdr.originalSize;
+		}
+	}
+	if(!ok) {
+		debug_e("[LZ4] Bad block at offset %u", consumed);
+		failed = true;
+		return false;
+	}
+
+	blockLength = hdr.originalSize;
+	blockPos = 0;
+	return true;
+}
+
+uint16_t Lz4Decoder::readMemoryBlock(char* data, int bufSize)
+{
+	if(bufSize <= 0 || isFinished()) {
+		return 0;
+	}
+	if(blockPos == blockLength && !decodeBlock()) {
+		return 0;
+	}
+
+	auto len = std::min(bufSize, blockLength - blockPos);
+	memcpy(data, buffer.get() + blockSize + blockPos, len);
+	return len;
+}
+
+int Lz4Decoder::seekFrom(int offset, SeekOrigin origin)
+{
+	if(origin != SeekOrigin::Current || offset < 0) {
+		return -1;
+	}
+
+	while(offset > 0) {
+		if(blockPos == blockLength && (isFinished() || !decodeBlock())) {
+			return -1;
+		}
+		auto len = std::min(offset, blockLength - blockPos);
+		blockPos += len;
+		consumed += len;
+		offset -= len;
+	}
+
+	return consumed;
+}
+
+} // namespace IFS::FWFS
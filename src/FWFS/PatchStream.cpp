@@ -0,0 +1,259 @@
+/****
+ * PatchStream.cpp
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "../include/IFS/FWFS/PatchStream.h"
+#include "../include/IFS/Crc32c.h"
+#include <algorithm>
+
+namespace IFS::FWFS
+{
+namespace
+{
+// Stack buffer used when reading from source partition
+constexpr size_t copyBufferSize{256};
+
+struct CopyArgs {
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct InsertArgs {
+	uint32_t length;
+};
+
+/*
+ * Calculate CRC32C of data read back from a partition
+ */
+int getChecksum(Storage::Partition& part, uint32_t size, uint32_t& crc)
+{
+	crc = 0;
+	uint8_t buf[copyBufferSize];
+	for(uint32_t offset = 0; offset < size;) {
+		auto len = std::min(size - offset, uint32_t(sizeof(buf)));
+		if(!part.read(offset, buf, len)) {
+			return Error::ReadFailure;
+		}
+		crc = crc32c(buf, len, crc);
+		offset += len;
+	}
+	return FS_OK;
+}
+
+} // namespace
+
+size_t PatchStream::write(const uint8_t* data, size_t size)
+{
+	size_t pos{0};
+	while(pos < size && !isFinished()) {
+		int res{FS_OK};
+		switch(state) {
+		case State::header:
+			pos += fill(&data[pos], size - pos, sizeof(Header));
+			if(bufferLength == sizeof(Header)) {
+				bufferLength = 0;
+				memcpy(&header, buffer, sizeof(Header));
+				res = begin();
+				state = State::op;
+			}
+			break;
+
+		case State::op:
+			op = Op(data[pos++]);
+			if(op != Op::copy && op != Op::insert) {
+				res = Error::BadObject;
+			}
+			state = State::args;
+			break;
+
+		case State::args: {
+			unsigned required = (op == Op::copy) ? sizeof(CopyArgs) : sizeof(InsertArgs);
+			pos += fill(&data[pos], size - pos, required);
+			if(bufferLength == required) {
+				bufferLength = 0;
+				state = State::op;
+				res = execute();
+			}
+			break;
+		}
+
+		case State::insert: {
+			auto len = std::min(size_t(insertRemaining), size - pos);
+			res = insert(&data[pos], len);
+			pos += len;
+			insertRemaining -= len;
+			if(insertRemaining == 0) {
+				state = State::op;
+			}
+			break;
+		}
+
+		case State::done:
+		case State::failed:
+			break;
+		}
+
+		if(res < 0) {
+			setError(res);
+		} else if(state == State::op && targetOffset == header.targetSize) {
+			finish();
+		}
+	}
+
+	return pos;
+}
+
+/*
+ * Accumulate incoming data until the required number of bytes is available
+ */
+size_t PatchStream::fill(const uint8_t* data, size_t size, unsigned required)
+{
+	auto len = std::min(size, size_t(required - bufferLength));
+	memcpy(&buffer[bufferLength], data, len);
+	bufferLength += len;
+	return len;
+}
+
+/*
+ * Header received: check source image and prepare target partition
+ */
+int PatchStream::begin()
+{
+	if(!source || !target) {
+		return Error::NoPartition;
+	}
+	if(source == target) {
+		return Error::BadParam;
+	}
+	if(header.magic != magic) {
+		return Error::BadObject;
+	}
+	if(header.sourceSize > source.size()) {
+		return Error::BadPartition;
+	}
+	if(header.targetSize == 0) {
+		return Error::BadObject;
+	}
+	if(header.targetSize > target.size()) {
+		return Error::NoSpace;
+	}
+
+	uint32_t crc;
+	int res = getChecksum(source, header.sourceSize, crc);
+	if(res < 0) {
+		return res;
+	}
+	if(crc != header.sourceChecksum) {
+		debug_w("[PATCH] Source checksum mismatch");
+		return Error::BadChecksum;
+	}
+
+	storage_size_t eraseSize = header.targetSize;
+	auto blockSize = target.getBlockSize();
+	if(blockSize > 1) {
+		eraseSize = std::min(storage_size_t((eraseSize + blockSize - 1) / blockSize * blockSize), target.size());
+	}
+	if(!target.erase_range(0, eraseSize)) {
+		return Error::EraseFailure;
+	}
+
+	debug_i("[PATCH] Applying, %u -> %u bytes", header.sourceSize, header.targetSize);
+	return FS_OK;
+}
+
+int PatchStream::execute()
+{
+	if(op == Op::copy) {
+		CopyArgs args;
+		memcpy(&args, buffer, sizeof(args));
+		return copy(args.offset, args.length);
+	}
+
+	InsertArgs args;
+	memcpy(&args, buffer, sizeof(args));
+	if(args.length > header.targetSize - targetOffset) {
+		return Error::BadObject;
+	}
+	insertRemaining = args.length;
+	if(insertRemaining != 0) {
+		state = State::insert;
+	}
+	return FS_OK;
+}
+
+int PatchStream::copy(uint32_t offset, uint32_t length)
+{
+	if(offset > header.sourceSize || length > header.sourceSize - offset ||
+	   length > header.targetSize - targetOffset) {
+		return Error::BadObject;
+	}
+
+	uint8_t buf[copyBufferSize];
+	while(length != 0) {
+		auto len = std::min(length, uint32_t(sizeof(buf)));
+		if(!source.read(offset, buf, len)) {
+			return Error::ReadFailure;
+		}
+		int res = insert(buf, len);
+		if(res < 0) {
+			return res;
+		}
+		offset += len;
+		length -= len;
+	}
+
+	return FS_OK;
+}
+
+int PatchStream::insert(const void* data, size_t length)
+{
+	if(!target.write(targetOffset, data, length)) {
+		return Error::WriteFailure;
+	}
+	targetOffset += length;
+	return FS_OK;
+}
+
+/*
+ * Verify what actually reached flash, not just the data passed to write()
+ */
+void PatchStream::finish()
+{
+	uint32_t crc;
+	int res = getChecksum(target, header.targetSize, crc);
+	if(res < 0) {
+		setError(res);
+		return;
+	}
+	if(crc != header.targetChecksum) {
+		setError(Error::BadChecksum);
+		return;
+	}
+
+	debug_i("[PATCH] Complete, %u bytes verified", targetOffset);
+	state = State::done;
+}
+
+void PatchStream::setError(int err)
+{
+	debug_w("[PATCH] Failed at offset %u: %s", targetOffset, Error::toString(err).c_str());
+	lastError = err;
+	state = State::failed;
+}
+
+} // namespace IFS::FWFS
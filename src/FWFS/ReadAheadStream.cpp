@@ -0,0 +1,208 @@
+/****
+ * ReadAheadStream.cpp
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "../include/IFS/FWFS/ReadAheadStream.h"
+#include <algorithm>
+
+namespace IFS::FWFS
+{
+ReadAheadStream::ReadAheadStream(IDataSourceStream* source, uint16_t bufferSize)
+	: source(source), size(std::max(source->available(), 0)), bufferSize(bufferSize)
+{
+	storage.reset(new(std::nothrow) uint8_t[2 * bufferSize]);
+	if(!storage) {
+		debug_w("[FWFS] No memory for read-ahead buffers");
+		return;
+	}
+	buffers[0].data = storage.get();
+	buffers[1].data = storage.get() + bufferSize;
+
+#ifdef ARCH_HOST
+	worker = std::thread(&ReadAheadStream::run, this);
+#endif
+}
+
+ReadAheadStream::~ReadAheadStream()
+{
+#ifdef ARCH_HOST
+	if(worker.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		cond.notify_all();
+		worker.join();
+	}
+#endif
+}
+
+/*
+ * Read from source until buffer is full or there's no more data
+ */
+uint16_t ReadAheadStream::fill(uint8_t* data)
+{
+	uint16_t length{0};
+	while(length < bufferSize && !source->isFinished()) {
+		auto len = source->readMemoryBlock(reinterpret_cast<char*>(&data[length]), bufferSize - length);
+		if(len == 0) {
+			break;
+		}
+		source->seek(len);
+		length += len;
+	}
+	return length;
+}
+
+#ifdef ARCH_HOST
+
+/*
+ * Worker thread fills each empty buffer in turn, a buffer is owned by the consumer once it contains data
+ */
+void ReadAheadStream::run()
+{
+	uint8_t back{0};
+	for(;;) {
+		auto& buf = buffers[back];
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cond.wait(lock, [&]() { return stop || buf.length == 0; });
+			if(stop) {
+				return;
+			}
+		}
+
+		auto length = fill(buf.data);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		buf.length = length;
+		if(length == 0 || source->isFinished()) {
+			sourceDone = true;
+		}
+		cond.notify_all();
+		if(sourceDone) {
+			return;
+		}
+		back ^= 1;
+	}
+}
+
+ReadAheadStream::Buffer* ReadAheadStream::getFront()
+{
+	auto& buf = buffers[front];
+	std::unique_lock<std::mutex> lock(mutex);
+	cond.wait(lock, [&]() { return buf.length != 0 || sourceDone; });
+	return (buf.length == 0) ? nullptr : &buf;
+}
+
+void ReadAheadStream::releaseFront()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		buffers[front].length = 0;
+	}
+	cond.notify_all();
+	front ^= 1;
+	frontPos = 0;
+}
+
+#else
+
+ReadAheadStream::Buffer* ReadAheadStream::getFront()
+{
+	auto& buf = buffers[front];
+	if(buf.length == 0 && !sourceDone) {
+		buf.length = fill(buf.data);
+		sourceDone = (buf.length == 0) || source->isFinished();
+	}
+	return (buf.length == 0) ? nullptr : &buf;
+}
+
+void ReadAheadStream::releaseFront()
+{
+	buffers[front].length = 0;
+	front ^= 1;
+	frontPos = 0;
+}
+
+#endif
+
+uint16_t ReadAheadStream::readMemoryBlock(char* data, int bufSize)
+{
+	if(!storage) {
+		return source->readMemoryBlock(data, bufSize);
+	}
+
+	auto buf = getFront();
+	if(buf == nullptr || bufSize <= 0) {
+		return 0;
+	}
+
+	auto len = std::min(uint16_t(buf->length - frontPos), uint16_t(std::min(bufSize, int(UINT16_MAX))));
+	memcpy(data, &buf->data[frontPos], len);
+	return len;
+}
+
+int ReadAheadStream::seekFrom(int offset, SeekOrigin origin)
+{
+	if(!storage) {
+		return source->seekFrom(offset, origin);
+	}
+
+	if(origin != SeekOrigin::Current) {
+		return -1;
+	}
+
+	// Can only go back within current buffer
+	if(offset < 0) {
+		if(unsigned(-offset) > frontPos) {
+			return -1;
+		}
+		frontPos += offset;
+		consumed += offset;
+		return consumed;
+	}
+
+	while(offset > 0) {
+		auto buf = getFront();
+		if(buf == nullptr) {
+			return -1;
+		}
+		auto len = std::min(unsigned(offset), unsigned(buf->length - frontPos));
+		frontPos += len;
+		consumed += len;
+		offset -= len;
+		if(frontPos == buf->length) {
+			// Hand buffer back for refilling as soon as possible
+			releaseFront();
+		}
+	}
+
+	return consumed;
+}
+
+bool ReadAheadStream::isFinished()
+{
+	if(!storage) {
+		return source->isFinished();
+	}
+
+	return consumed >= size || getFront() == nullptr;
+}
+
+} // namespace IFS::FWFS
@@ -0,0 +1,66 @@
+/****
+ * StaticObject.cpp
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include <IFS/FWFS/StaticObject.h>
+
+namespace IFS::FWFS
+{
+bool StaticImage::isValid(IFileSystem& fileSystem)
+{
+	if(checkedFileSystem == &fileSystem) {
+		return valid;
+	}
+
+	IFileSystem::Info info;
+	int err = fileSystem.getinfo(info);
+	valid = (err >= 0) && (info.type == IFileSystem::Type::FWFS) && (info.volumeID == volumeID) &&
+			(info.creationTime == creationTime);
+	checkedFileSystem = &fileSystem;
+	if(!valid) {
+		debug_w("[FWFS] Volume 0x%08x created %u does not match image 0x%08x created %u, using path lookup",
+				info.volumeID, uint32_t(info.creationTime), volumeID, creationTime);
+	}
+	return valid;
+}
+
+FileHandle StaticImage::open(IFileSystem& fileSystem, const StaticObject& obj, OpenFlags flags)
+{
+	if(isValid(fileSystem)) {
+		FileHandle file = fileSystem.openById(obj.id, flags);
+		if(file != Error::NotSupported) {
+			return file;
+		}
+	}
+
+	return fileSystem.open(obj.path, flags);
+}
+
+int StaticImage::stat(IFileSystem& fileSystem, const StaticObject& obj, Stat* stat)
+{
+	if(isValid(fileSystem)) {
+		int err = fileSystem.statById(obj.id, stat);
+		if(err != Error::NotSupported) {
+			return err;
+		}
+	}
+
+	return fileSystem.stat(obj.path, stat);
+}
+
+} // namespace IFS::FWFS
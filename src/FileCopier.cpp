@@ -22,20 +22,6 @@
 #include "include/IFS/FileCopier.h"
 #include "include/IFS/Directory.h"
 
-namespace
-{
-String abspath(const String& path, const char* name)
-{
-	String s;
-	if(path.length() != 0) {
-		s += path;
-		s += '/';
-	}
-	return s + name;
-}
-
-} // namespace
-
 String toString(IFS::FileCopier::Operation operation)
 {
 	using Operation = IFS::FileCopier::Operation;
@@ -69,13 +55,18 @@ bool FileCopier::handleError(const ErrorInfo& info)
 	return false;
 }
 
-bool FileCopier::copyFile(const String& srcFileName, const String& dstFileName)
+bool FileCopier::copyFile(const char* srcFileName, const char* dstFileName)
 {
-	debug_d("copyFile('%s', '%s')", srcFileName.c_str(), dstFileName.c_str());
+	debug_d("copyFile('%s', '%s')", srcFileName, dstFileName);
 	File srcFile(&srcfs);
 	if(!srcFile.open(srcFileName)) {
 		return handleError({srcFile, Operation::open, srcFileName});
 	}
+	return copyFile(srcFile, srcFileName, dstFileName);
+}
+
+bool FileCopier::copyFile(File& srcFile, const char* srcFileName, const char* dstFileName)
+{
 	File dstFile(&dstfs);
 	if(!dstFile.open(dstFileName, File::CreateNewAlways | File::WriteOnly)) {
 		return handleError({dstFile, Operation::create, dstFileName});
@@ -93,9 +84,9 @@ bool FileCopier::copyFile(const String& srcFileName, const String& dstFileName)
 	return copyAttributes(srcFile, dstFile, srcFileName, dstFileName);
 }
 
-bool FileCopier::copyAttributes(const String& srcPath, const String& dstPath)
+bool FileCopier::copyAttributes(const char* srcPath, const char* dstPath)
 {
-	debug_d("copyAttributes('%s', '%s')", srcPath.c_str(), dstPath.c_str());
+	debug_d("copyAttributes('%s', '%s')", srcPath, dstPath);
 	File src(&srcfs);
 	if(!src.open(srcPath)) {
 		return handleError({src, Operation::open, srcPath});
@@ -108,7 +99,7 @@ bool FileCopier::copyAttributes(const String& srcPath, const String& dstPath)
 	return copyAttributes(src, dst, srcPath, dstPath);
 }
 
-bool FileCopier::copyAttributes(File& src, File& dst, const String& srcPath, const String& dstPath)
+bool FileCopier::copyAttributes(File& src, File& dst, const char* srcPath, const char* dstPath)
 {
 	auto callback = [&](AttributeEnum& e) -> bool {
 		debug_d("setAttribute(%u, %s)", unsigned(e.tag), toString(e.tag).c_str());
@@ -124,14 +115,33 @@ bool FileCopier::copyAttributes(File& src, File& dst, const String& srcPath, con
 	return true;
 }
 
-bool FileCopier::copyDir(const String& srcPath, const String& dstPath)
+bool FileCopier::copyDir(const char* srcPath, const char* dstPath)
 {
-	if(!copyAttributes(srcPath, dstPath)) {
+	FileNameBuffer srcBuffer;
+	FileNameBuffer dstBuffer;
+	srcBuffer.copy(PathView(srcPath));
+	dstBuffer.copy(PathView(dstPath));
+	if(srcBuffer.overflow()) {
+		return handleError({srcfs, Operation::open, srcPath, Error::NameTooLong});
+	}
+	if(dstBuffer.overflow()) {
+		return handleError({dstfs, Operation::open, dstPath, Error::NameTooLong});
+	}
+	return copyDir(srcBuffer, dstBuffer);
+}
+
+/*
+ * Paths are built in buffers shared by all levels of recursion, avoiding String temporaries and
+ * keeping stack usage low when copying deep trees. Each name is appended then removed again.
+ */
+bool FileCopier::copyDir(NameBuffer& srcPath, NameBuffer& dstPath)
+{
+	if(!copyAttributes(srcPath.c_str(), dstPath.c_str())) {
 		return false;
 	}
 
 	Directory srcDir(&srcfs);
-	if(!srcDir.open(srcPath)) {
+	if(!srcDir.open(srcPath.c_str())) {
 		return false;
 	}
 
@@ -141,6 +151,15 @@ bool FileCopier::copyDir(const String& srcPath, const String& dstPath)
 	};
 	Vector<Dir> directories;
 
+	auto srcPathLength = srcPath.length;
+	auto dstPathLength = dstPath.length;
+	auto restorePaths = [&]() {
+		srcPath.length = srcPathLength;
+		srcPath.terminate();
+		dstPath.length = dstPathLength;
+		dstPath.terminate();
+	};
+
 	while(srcDir.next()) {
 		auto& stat = srcDir.stat();
 		if(stat.isDir()) {
@@ -151,24 +170,39 @@ bool FileCopier::copyDir(const String& srcPath, const String& dstPath)
 			continue;
 		}
 
-		String srcFileName = abspath(srcPath, stat.name.c_str());
-		String dstFileName = abspath(dstPath, stat.name.c_str());
+		srcPath.join(stat.name);
+		dstPath.join(stat.name);
 
 		// If target filesystem doesn't support metadata then add suitable extension to compressed files
 		if(dstAttr[FileSystem::Attribute::NoMeta]) {
 			switch(stat.compression.type) {
 			case Compression::Type::GZip:
-				dstFileName += ".gz";
+				dstPath.append(".gz");
 				break;
 			case Compression::Type::None:
 				break;
 			default:
-				dstFileName += '.';
-				dstFileName += toString(stat.compression.type);
+				dstPath.append(".");
+				dstPath.append(toString(stat.compression.type));
 			}
 		}
 
-		if(!copyFile(srcFileName, dstFileName)) {
+		bool ok;
+		if(srcPath.overflow()) {
+			ok = handleError({srcfs, Operation::open, stat.name.c_str(), Error::NameTooLong});
+		} else if(dstPath.overflow()) {
+			ok = handleError({dstfs, Operation::create, stat.name.c_str(), Error::NameTooLong});
+		} else {
+			// Open source relative to directory to avoid full path lookup
+			File srcFile(&srcfs);
+			if(srcFile.attach(srcDir.openat(stat.name.c_str()))) {
+				ok = copyFile(srcFile, srcPath.c_str(), dstPath.c_str());
+			} else {
+				ok = handleError({srcFile, Operation::open, srcPath.c_str()});
+			}
+		}
+		restorePaths();
+		if(!ok) {
 			return false;
 		}
 	}
@@ -178,16 +212,24 @@ bool FileCopier::copyDir(const String& srcPath, const String& dstPath)
 	auto time = fsGetTimeUTC();
 
 	for(auto& dir : directories) {
-		String dstDirPath = abspath(dstPath, dir.name.c_str());
-		int err = dstfs.mkdir(dstDirPath);
-		if(err < 0 && !handleError({dstfs, Operation::mkdir, dstDirPath, err})) {
-			return false;
-		}
-		if(dir.mtime != time) {
-			dstfs.settime(dstDirPath, dir.mtime);
+		srcPath.join(dir.name.c_str());
+		dstPath.join(dir.name.c_str());
+		bool ok;
+		if(srcPath.overflow() || dstPath.overflow()) {
+			ok = handleError({dstfs, Operation::mkdir, dir.name.c_str(), Error::NameTooLong});
+		} else {
+			int err = dstfs.mkdir(dstPath.c_str());
+			if(err < 0 && !handleError({dstfs, Operation::mkdir, dstPath.c_str(), err})) {
+				ok = false;
+			} else {
+				if(dir.mtime != time) {
+					dstfs.settime(dstPath.c_str(), dir.mtime);
+				}
+				ok = copyDir(srcPath, dstPath);
+			}
 		}
-		String srcDirPath = abspath(srcPath, dir.name.c_str());
-		if(!copyDir(srcDirPath, dstDirPath)) {
+		restorePaths();
+		if(!ok) {
 			return false;
 		}
 	}
@@ -0,0 +1,92 @@
+/****
+ * FileIDSet.cpp
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "include/IFS/FileIDSet.h"
+
+namespace IFS
+{
+bool FileIDSet::add(FileID id)
+{
+	if(id == 0) {
+		return false;
+	}
+
+	// Keep load factor below 75%
+	if((itemCount + 1) * 4 > capacity * 3) {
+		if(!resize(capacity ? capacity * 2 : minCapacity)) {
+			return false;
+		}
+	}
+
+	auto i = findSlot(id);
+	if(table[i] == 0) {
+		table[i] = id;
+		++itemCount;
+	}
+	return true;
+}
+
+bool FileIDSet::remove(FileID id)
+{
+	if(!contains(id)) {
+		return false;
+	}
+
+	auto mask = capacity - 1;
+	auto i = findSlot(id);
+	table[i] = 0;
+	--itemCount;
+
+	// Move back any following entries which would no longer be reachable
+	for(auto j = (i + 1) & mask; table[j] != 0; j = (j + 1) & mask) {
+		auto h = home(table[j]);
+		// Entry at j can fill hole at i if its home slot isn't within (i, j]
+		bool canMove = (i <= j) ? (h <= i || h > j) : (h <= i && h > j);
+		if(canMove) {
+			table[i] = table[j];
+			table[j] = 0;
+			i = j;
+		}
+	}
+
+	return true;
+}
+
+bool FileIDSet::resize(unsigned newCapacity)
+{
+	std::unique_ptr<FileID[]> newTable(new (std::nothrow) FileID[newCapacity]{});
+	if(!newTable) {
+		return false;
+	}
+
+	auto oldTable = std::move(table);
+	auto oldCapacity = capacity;
+	table = std::move(newTable);
+	capacity = newCapacity;
+	for(unsigned i = 0; i < oldCapacity; ++i) {
+		auto id = oldTable[i];
+		if(id != 0) {
+			table[findSlot(id)] = id;
+		}
+	}
+
+	return true;
+}
+
+} // namespace IFS
@@ -169,15 +169,25 @@ file_offset_t FileSystem::readContent(const String& filename, const ReadContentC
 
 int FileSystem::makedirs(const char* path)
 {
-	String s(path);
-	int i = 0;
-	while((i = s.indexOf('/', i)) > 0) {
+	// Use a stack buffer so we can terminate each intermediate path in-place
+	FileNameBuffer buf;
+	if(buf.copy(PathView(path)) < 0 || buf.overflow()) {
+		return Error::NameTooLong;
+	}
+	auto s = buf.begin();
+	for(unsigned i = 0; i < buf.length; ++i) {
+		if(s[i] != '/') {
+			continue;
+		}
+		if(i == 0) {
+			break;
+		}
 		s[i] = '\0';
-		int err = mkdir(s.c_str());
+		int err = mkdir(buf.c_str());
 		if(err < 0) {
 			return err;
 		}
-		s[i++] = '/';
+		s[i] = '/';
 	}
 
 	return FS_OK;
@@ -0,0 +1,558 @@
+/****
+ * CowFile.cpp
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "../include/IFS/HYFS/CowFile.h"
+#include "../include/IFS/NameBuffer.h"
+
+/*
+ * Block numbers are 16-bit in the map
+ */
+#define MAX_SLOTS 0xfffe
+
+namespace IFS::HYFS
+{
+int CowFile::getSidecarPath(NameBuffer& buffer, const char* path)
+{
+	buffer.copy(path ?: "");
+	buffer.append(HYFS_COW_SUFFIX, strlen(HYFS_COW_SUFFIX));
+	return buffer.overflow() ? Error::NameTooLong : FS_OK;
+}
+
+void CowFile::stripSuffix(NameBuffer& name)
+{
+	if(!name.overflow() && isSidecar(name)) {
+		name.length -= strlen(HYFS_COW_SUFFIX);
+		name.terminate();
+	}
+}
+
+int CowFile::readHeader(IFileSystem& ffs, FileHandle file, Header& header)
+{
+	int res = ffs.read(file, &header, sizeof(header));
+	if(res < 0) {
+		return res;
+	}
+	if(res != sizeof(header) || header.magic != magic || header.blockSize != blockSize ||
+	   header.fwLimit > header.size) {
+		return Error::BadObject;
+	}
+	return FS_OK;
+}
+
+int CowFile::readHeader(IFileSystem& fwfs, IFileSystem& ffs, const char* path, Header& header)
+{
+	FileNameBuffer sidecarPath;
+	int res = getSidecarPath(sidecarPath, path);
+	if(res < 0) {
+		return res;
+	}
+	auto file = ffs.open(sidecarPath.c_str(), OpenFlag::Read);
+	if(file < 0) {
+		return file;
+	}
+	res = readHeader(ffs, file, header);
+	ffs.close(file);
+	if(res < 0) {
+		return res;
+	}
+	return bindBase(fwfs, path, header);
+}
+
+/*
+ * Base file is identified by object ID, which is only meaningful for the image the sidecar was created from.
+ * When the image is updated, unchanged files can be found again by path.
+ */
+int CowFile::bindBase(IFileSystem& fwfs, const char* path, Header& header)
+{
+	IFileSystem::Info fwinfo;
+	int res = fwfs.getinfo(fwinfo);
+	if(res < 0) {
+		return res;
+	}
+	if(header.fwVolumeID == fwinfo.volumeID && header.fwCreationTime == fwinfo.creationTime) {
+		return FS_OK;
+	}
+
+	Stat stat;
+	res = fwfs.stat(path, &stat);
+	if(res == Error::NotFound ||
+	   (res >= 0 && (stat.isDir() || stat.size != header.fwSize || stat.mtime != header.fwMtime))) {
+		debug_e("[HYFS] Base file for '%s' has changed", path);
+		return Error::BadObject;
+	}
+	if(res < 0) {
+		return res;
+	}
+
+	header.fwid = stat.id;
+	header.fwVolumeID = fwinfo.volumeID;
+	header.fwCreationTime = fwinfo.creationTime;
+	return FS_OK;
+}
+
+int CowFile::create(const char* path, FileHandle fwfile, OpenFlags flags)
+{
+	this->flags = flags;
+
+	Stat stat;
+	int res = fwfs.fstat(fwfile, &stat);
+	if(res < 0) {
+		return res;
+	}
+
+	IFileSystem::Info fwinfo;
+	res = fwfs.getinfo(fwinfo);
+	if(res < 0) {
+		return res;
+	}
+
+	FileNameBuffer sidecarPath;
+	res = getSidecarPath(sidecarPath, path);
+	if(res < 0) {
+		return res;
+	}
+
+	sidecar = ffs.open(sidecarPath.c_str(), OpenFlag::Create | OpenFlag::Truncate | OpenFlag::Read | OpenFlag::Write);
+	if(sidecar < 0) {
+		res = sidecar;
+		sidecar = -1;
+		return res;
+	}
+
+	header = Header{magic, blockSize, 0, stat.id, uint32_t(stat.size), uint32_t(stat.size)};
+	header.fwVolumeID = fwinfo.volumeID;
+	header.fwCreationTime = fwinfo.creationTime;
+	header.fwSize = stat.size;
+	header.fwMtime = stat.mtime;
+	res = writeHeader();
+	if(res < 0) {
+		ffs.fremove(sidecar);
+		close();
+		return res;
+	}
+
+	this->fwfile = fwfile;
+	if(flags[OpenFlag::Append]) {
+		cursor = header.size;
+	}
+	return FS_OK;
+}
+
+int CowFile::open(const char* path, OpenFlags flags)
+{
+	this->flags = flags;
+
+	FileNameBuffer sidecarPath;
+	int res = getSidecarPath(sidecarPath, path);
+	if(res < 0) {
+		return res;
+	}
+
+	auto sidecarFlags = flags[OpenFlag::Write] ? (OpenFlag::Read | OpenFlag::Write) : OpenFlags(OpenFlag::Read);
+	sidecar = ffs.open(sidecarPath.c_str(), sidecarFlags);
+	if(sidecar < 0) {
+		res = sidecar;
+		sidecar = -1;
+		return res;
+	}
+
+	res = readHeader(ffs, sidecar, header);
+	if(res >= 0) {
+		auto volumeID = header.fwVolumeID;
+		auto creationTime = header.fwCreationTime;
+		res = bindBase(fwfs, path, header);
+		// Record new image so the base file isn't looked up again
+		if(res >= 0 && flags[OpenFlag::Write] &&
+		   (header.fwVolumeID != volumeID || header.fwCreationTime != creationTime)) {
+			dirty = true;
+		}
+	}
+	if(res >= 0) {
+		fwfile = fwfs.openById(header.fwid, OpenFlag::Read);
+		res = fwfile;
+	}
+	if(res >= 0) {
+		res = loadBlockMap();
+	}
+	if(res >= 0 && flags[OpenFlag::Truncate]) {
+		res = ftruncate(0);
+	}
+	if(res < 0) {
+		close();
+		return res;
+	}
+
+	if(flags[OpenFlag::Append]) {
+		cursor = header.size;
+	}
+	return FS_OK;
+}
+
+int CowFile::loadBlockMap()
+{
+	auto sidecarSize = ffs.lseek(sidecar, 0, SeekOrigin::End);
+	if(sidecarSize < 0) {
+		return sidecarSize;
+	}
+	if(uint32_t(sidecarSize) < sizeof(Header)) {
+		return Error::BadObject;
+	}
+	auto count = (uint32_t(sidecarSize) - sizeof(Header)) / recordSize;
+	if(count > MAX_SLOTS) {
+		return Error::BadObject;
+	}
+	slotCount = count;
+
+	for(unsigned slot = 0; slot < slotCount; ++slot) {
+		uint32_t block;
+		auto res = ffs.lseek(sidecar, slotOffset(slot), SeekOrigin::Start);
+		if(res >= 0) {
+			res = ffs.read(sidecar, &block, sizeof(block));
+		}
+		if(res < 0) {
+			return res;
+		}
+		if(res != sizeof(block)) {
+			return Error::BadObject;
+		}
+		// Later records for the same block are never written, so no need to check for duplicates
+		if(block == freeBlock || block >= (header.size + blockSize - 1) / blockSize) {
+			freeSlots.add(slot);
+			continue;
+		}
+		res = setSlot(block, slot);
+		if(res < 0) {
+			return res;
+		}
+	}
+
+	return FS_OK;
+}
+
+int CowFile::setSlot(uint32_t block, int slot)
+{
+	if(block >= mapSize) {
+		if(slot < 0) {
+			return FS_OK;
+		}
+		// Grow in units of 16 blocks
+		auto newSize = (block + 16) & ~15U;
+		auto newMap = new(std::nothrow) uint16_t[newSize]{};
+		if(newMap == nullptr) {
+			return Error::NoMem;
+		}
+		if(map) {
+			memcpy(newMap, map.get(), mapSize * sizeof(uint16_t));
+		}
+		map.reset(newMap);
+		mapSize = newSize;
+	}
+	map[block] = slot + 1;
+	return FS_OK;
+}
+
+int CowFile::allocateSlot(uint32_t block)
+{
+	int slot;
+	if(freeSlots.isEmpty()) {
+		if(slotCount >= MAX_SLOTS) {
+			return Error::NoSpace;
+		}
+		slot = slotCount;
+	} else {
+		slot = freeSlots[freeSlots.count() - 1];
+	}
+
+	int res = setSlot(block, slot);
+	if(res < 0) {
+		return res;
+	}
+
+	if(freeSlots.isEmpty()) {
+		++slotCount;
+	} else {
+		freeSlots.remove(freeSlots.count() - 1);
+	}
+	return slot;
+}
+
+int CowFile::readBase(uint32_t offset, uint8_t* buffer, size_t size)
+{
+	size_t count{0};
+	if(offset < header.fwLimit) {
+		count = std::min(size, size_t(header.fwLimit - offset));
+		auto res = fwfs.lseek(fwfile, offset, SeekOrigin::Start);
+		if(res >= 0) {
+			res = fwfs.read(fwfile, buffer, count);
+		}
+		if(res < 0) {
+			return res;
+		}
+		if(size_t(res) != count) {
+			return Error::ReadFailure;
+		}
+	}
+	memset(&buffer[count], 0, size - count);
+	return FS_OK;
+}
+
+int CowFile::writeRecord(int slot, uint32_t block, const uint8_t* data)
+{
+	auto res = ffs.lseek(sidecar, slotOffset(slot), SeekOrigin::Start);
+	if(res >= 0) {
+		res = ffs.write(sidecar, &block, sizeof(block));
+	}
+	if(res >= 0 && data != nullptr) {
+		res = ffs.write(sidecar, data, blockSize);
+	}
+	return (res < 0) ? res : FS_OK;
+}
+
+int CowFile::writeHeader()
+{
+	auto res = ffs.lseek(sidecar, 0, SeekOrigin::Start);
+	if(res >= 0) {
+		res = ffs.write(sidecar, &header, sizeof(header));
+	}
+	if(res < 0) {
+		return res;
+	}
+	dirty = false;
+	return FS_OK;
+}
+
+int CowFile::close()
+{
+	int res = FS_OK;
+	if(sidecar >= 0) {
+		if(dirty) {
+			res = writeHeader();
+		}
+		int err = ffs.close(sidecar);
+		if(res >= 0) {
+			res = err;
+		}
+		sidecar = -1;
+	}
+	if(fwfile >= 0) {
+		fwfs.close(fwfile);
+		fwfile = -1;
+	}
+	map.reset();
+	mapSize = 0;
+	slotCount = 0;
+	freeSlots.clear();
+	cursor = 0;
+	return res;
+}
+
+int CowFile::read(void* data, size_t size)
+{
+	if(cursor >= header.size) {
+		return 0;
+	}
+	size = std::min(size, size_t(header.size - cursor));
+
+	auto bufptr = static_cast<uint8_t*>(data);
+	size_t total{0};
+	while(total < size) {
+		auto block = cursor / blockSize;
+		auto offset = cursor % blockSize;
+		size_t count = std::min(size - total, size_t(blockSize - offset));
+		int slot = findSlot(block);
+		int res;
+		if(slot < 0) {
+			res = readBase(cursor, bufptr, count);
+		} else {
+			res = ffs.lseek(sidecar, slotOffset(slot) + sizeof(uint32_t) + offset, SeekOrigin::Start);
+			if(res >= 0) {
+				res = ffs.read(sidecar, bufptr, count);
+				if(res >= 0 && size_t(res) != count) {
+					res = Error::ReadFailure;
+				}
+			}
+		}
+		if(res < 0) {
+			return res;
+		}
+		bufptr += count;
+		cursor += count;
+		total += count;
+	}
+
+	return total;
+}
+
+int CowFile::write(const void* data, size_t size)
+{
+	if(!flags[OpenFlag::Write]) {
+		return Error::ReadOnly;
+	}
+
+	if(flags[OpenFlag::Append]) {
+		cursor = header.size;
+	}
+
+	auto bufptr = static_cast<const uint8_t*>(data);
+	size_t total{0};
+	while(total < size) {
+		auto block = cursor / blockSize;
+		auto offset = cursor % blockSize;
+		size_t count = std::min(size - total, size_t(blockSize - offset));
+		int slot = findSlot(block);
+		int res;
+		if(slot >= 0) {
+			res = ffs.lseek(sidecar, slotOffset(slot) + sizeof(uint32_t) + offset, SeekOrigin::Start);
+			if(res >= 0) {
+				res = ffs.write(sidecar, bufptr, count);
+			}
+		} else {
+			// First modification of this block, so merge with original content
+			uint8_t buffer[blockSize];
+			res = readBase(block * blockSize, buffer, blockSize);
+			if(res >= 0) {
+				memcpy(&buffer[offset], bufptr, count);
+				res = slot = allocateSlot(block);
+			}
+			if(res >= 0) {
+				res = writeRecord(slot, block, buffer);
+			}
+		}
+		if(res < 0) {
+			return res;
+		}
+		bufptr += count;
+		cursor += count;
+		total += count;
+		if(cursor > header.size) {
+			header.size = cursor;
+			dirty = true;
+		}
+	}
+
+	return total;
+}
+
+file_offset_t CowFile::lseek(file_offset_t offset, SeekOrigin origin)
+{
+	file_offset_t newOffset;
+	switch(origin) {
+	case SeekOrigin::Start:
+		newOffset = offset;
+		break;
+	case SeekOrigin::Current:
+		newOffset = cursor + offset;
+		break;
+	case SeekOrigin::End:
+		newOffset = header.size + offset;
+		break;
+	default:
+		return Error::BadParam;
+	}
+
+	if(newOffset < 0 || newOffset > file_offset_t(header.size)) {
+		return Error::SeekBounds;
+	}
+
+	cursor = newOffset;
+	return cursor;
+}
+
+int CowFile::eof()
+{
+	return (cursor >= header.size) ? 1 : 0;
+}
+
+int CowFile::ftruncate(file_size_t new_size)
+{
+	if(!flags[OpenFlag::Write]) {
+		return Error::ReadOnly;
+	}
+
+	if(new_size > UINT32_MAX) {
+		return Error::TooBig;
+	}
+
+	if(new_size < header.size) {
+		if(new_size < header.fwLimit) {
+			header.fwLimit = new_size;
+		}
+
+		// Release blocks beyond end of file
+		for(uint32_t block = (new_size + blockSize - 1) / blockSize; block < mapSize; ++block) {
+			int slot = findSlot(block);
+			if(slot < 0) {
+				continue;
+			}
+			int res = writeRecord(slot, freeBlock, nullptr);
+			if(res < 0) {
+				return res;
+			}
+			freeSlots.add(slot);
+			setSlot(block, -1);
+		}
+
+		// Clear trailing content in final block so it reads as zeroes if file is extended
+		auto offset = new_size % blockSize;
+		int slot = findSlot(new_size / blockSize);
+		if(offset != 0 && slot >= 0) {
+			auto res = ffs.lseek(sidecar, slotOffset(slot) + sizeof(uint32_t) + offset, SeekOrigin::Start);
+			uint8_t zeroes[32]{};
+			while(res >= 0 && offset < blockSize) {
+				auto count = std::min(size_t(blockSize - offset), sizeof(zeroes));
+				res = ffs.write(sidecar, zeroes, count);
+				offset += count;
+			}
+			if(res < 0) {
+				return res;
+			}
+		}
+	}
+
+	header.size = new_size;
+	dirty = true;
+	return FS_OK;
+}
+
+int CowFile::flush()
+{
+	if(dirty) {
+		int res = writeHeader();
+		if(res < 0) {
+			return res;
+		}
+	}
+	return ffs.flush(sidecar);
+}
+
+int CowFile::fstat(Stat* stat)
+{
+	if(stat == nullptr) {
+		return FS_OK;
+	}
+	int res = ffs.fstat(sidecar, stat);
+	if(res < 0) {
+		return res;
+	}
+	stripSuffix(stat->name);
+	stat->size = header.size;
+	return FS_OK;
+}
+
+} // namespace IFS::HYFS
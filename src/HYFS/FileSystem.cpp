@@ -51,7 +51,8 @@
  *     zero-length files.
  *
  * A delete operation therefore removes the file from FFS (if it
- * exists) and reveals the original FW file (if any).
+ * exists) and reveals the original FW file (if any). Deleting a file
+ * which only exists on FW records a 'whiteout' so it's no longer visible.
  *
  * Enumeration always starts with FFS, followed by FW. When
  * enumerating FW we need to know which files to 'hide' to avoid
@@ -78,12 +79,25 @@
  * The less efficient way to do this would be to directly search FFS for
  * every iteration of FW.
  *
+ * With HYFS_HIDE_FLAGS=0 no state is kept between listings. Instead, names
+ * are collected as FFS entries are enumerated then sorted so FW entries can
+ * be checked with a binary search. FFS is only queried directly if there
+ * isn't enough memory to build the list.
+ *
+ * Whiteouts, and overridden FW entries with HYFS_HIDE_FLAGS=1, are recorded
+ * in a journal file on FFS which is loaded at mount time. The set of hidden
+ * files is then complete so FFS entries don't need to be checked against FW
+ * during enumeration. If the journal doesn't exist, or belongs to a different
+ * FW image, FFS is scanned once to rebuild it.
+ *
  */
 
 #include "../include/IFS/HYFS/FileSystem.h"
 #include "../include/IFS/FWFS/FileSystem.h"
 #include "../include/IFS/FileSystem.h"
 #include "../include/IFS/Util.h"
+#include <algorithm>
+#include <memory>
 
 #define CHECK_MOUNTED()                                                                                                \
 	if(!mounted) {                                                                                                     \
@@ -96,14 +110,117 @@
 		return handle;                                                                                                 \
 	}                                                                                                                  \
 	IFileSystem* fs;                                                                                                   \
-	if(handle >= FWFS_HANDLE_MIN && handle < FWFS_HANDLE_MAX) {                                                        \
+	[[maybe_unused]] FileDesc* fd{nullptr};                                                                            \
+	[[maybe_unused]] CowFile* cow{nullptr};                                                                            \
+	if(handle >= FWFS_HANDLE_MIN && handle <= FWFS_HANDLE_MAX) {                                                       \
 		fs = fwfs;                                                                                                     \
+	} else if(handle >= HYFS_HANDLE_MIN && handle <= HYFS_HANDLE_MAX) {                                                \
+		fd = &fileDescs[handle - HYFS_HANDLE_MIN];                                                                     \
+		if(!fd->isOpen()) {                                                                                            \
+			return Error::FileNotOpen;                                                                                 \
+		}                                                                                                              \
+		/* Operations not handled by CowFile are passed to the sidecar */                                              \
+		cow = fd->cow.get();                                                                                           \
+		fs = fd->pending ? fwfs : ffs;                                                                                 \
+		handle = cow ? cow->getSidecar() : fd->file;                                                                   \
 	} else {                                                                                                           \
 		fs = ffs;                                                                                                      \
 	}
 
+// Operations which modify a file must first copy it to FFS
+#define COPY_UP(handle)                                                                                                \
+	if(fd != nullptr && fd->pending) {                                                                                 \
+		int err = copyUp(*fd, fd->path.c_str());                                                                       \
+		if(err < 0) {                                                                                                  \
+			return err;                                                                                                \
+		}                                                                                                              \
+		fs = ffs;                                                                                                      \
+		cow = fd->cow.get();                                                                                           \
+		handle = cow ? cow->getSidecar() : fd->file;                                                                   \
+	}
+
 namespace IFS::HYFS
 {
+#if HYFS_HIDE_FLAGS == 0
+/*
+ * Names of FFS entries for one directory, used to filter FW entries without
+ * querying FFS for each one.
+ *
+ * Names are packed into a single nul-separated buffer as they're read. Once
+ * complete, an index of offsets is sorted so lookups can use a binary search.
+ */
+class NameSet
+{
+public:
+	void add(const char* name)
+	{
+		index.reset();
+		if(names.concat(name, strlen(name) + 1)) {
+			++count;
+		} else {
+			overflow = true;
+		}
+	}
+
+	void clear()
+	{
+		names = nullptr;
+		index.reset();
+		count = 0;
+		overflow = false;
+	}
+
+	/**
+	 * @brief Build sorted index after all names have been added
+	 */
+	void sort()
+	{
+		if(overflow || count == 0) {
+			return;
+		}
+		index.reset(new(std::nothrow) uint32_t[count]);
+		if(!index) {
+			return;
+		}
+		auto text = names.c_str();
+		uint32_t offset{0};
+		for(unsigned i = 0; i < count; ++i) {
+			index[i] = offset;
+			offset += strlen(&text[offset]) + 1;
+		}
+		std::sort(&index[0], &index[count],
+				  [text](uint32_t a, uint32_t b) { return strcmp(&text[a], &text[b]) < 0; });
+	}
+
+	/**
+	 * @brief Determine if set is usable
+	 * @retval bool false if memory was exhausted, so names must be checked directly
+	 */
+	bool isValid() const
+	{
+		return !overflow && (count == 0 || index);
+	}
+
+	bool contains(const char* name) const
+	{
+		if(count == 0) {
+			return false;
+		}
+		auto text = names.c_str();
+		auto end = &index[count];
+		auto it = std::lower_bound(&index[0], end, name,
+								   [text](uint32_t a, const char* b) { return strcmp(&text[a], b) < 0; });
+		return it != end && strcmp(&text[*it], name) == 0;
+	}
+
+private:
+	String names;
+	std::unique_ptr<uint32_t[]> index;
+	unsigned count{0};
+	bool overflow{false};
+};
+#endif
+
 // opendir() uses this structure to track file listing
 struct FileDir {
 	CString path;
@@ -112,8 +229,27 @@ struct FileDir {
 	DirHandle fw;
 	// The directory object being enumerated
 	IFileSystem* fs;
+	// FW entries hidden by FFS have all been recorded
+	bool ffsHidden;
+	// FFS enumeration was started from a seek position
+	bool ffsSeek;
+	// FW directory doesn't exist
+	bool fwMissing;
+	// Number of FFS entries read, used for cookies if FFS doesn't support telldir()
+	uint32_t ffsIndex;
+#if HYFS_HIDE_FLAGS == 0
+	// Names of all FFS entries in this directory
+	NameSet ffsNames;
+#endif
 };
 
+/*
+ * Directory cookies identify the layer using the top bit.
+ * The next bit indicates an FFS entry number, for filesystems without telldir() support.
+ */
+constexpr DirCookie fwCookieFlag{1ULL << 63};
+constexpr DirCookie ffsIndexFlag{1ULL << 62};
+
 int FileSystem::mount()
 {
 	if(mounted) {
@@ -159,6 +295,9 @@ int FileSystem::mount()
 	checkAce(AttributeTag::ReadAce, rootAcl.readAccess, stat.acl.readAccess);
 	checkAce(AttributeTag::WriteAce, rootAcl.writeAccess, stat.acl.writeAccess);
 
+	openJournal();
+	negativeCache.clear();
+
 	mounted = true;
 
 	return res;
@@ -213,24 +352,218 @@ int FileSystem::hideFWFile(const char* path, bool hide)
 	Stat stat;
 	res = fwfs->stat(path, &stat);
 	if(res >= 0) {
-		if(hide) {
-			if(!hiddenFwFiles.contains(stat.id)) {
-				hiddenFwFiles.add(stat.id);
-			}
-		} else {
-			hiddenFwFiles.removeElement(stat.id);
+		hideFWFile(stat.id, hide);
+	}
+#endif
+	return res;
+}
+
+void FileSystem::hideFWFile([[maybe_unused]] FileID id, [[maybe_unused]] bool hide)
+{
+#if HYFS_HIDE_FLAGS == 1
+	// Journal is only updated when state changes
+	int res{FS_OK};
+	if(hide) {
+		if(!hiddenFwFiles.contains(id) && hiddenFwFiles.add(id)) {
+			res = journal.add(id, Journal::Type::override);
 		}
+	} else if(hiddenFwFiles.remove(id)) {
+		res = journal.add(id, Journal::Type::clear);
+	}
+	if(res < 0) {
+		// Journal is incomplete so fall back to finding overrides during enumeration
+		journal.close();
 	}
 #endif
+}
+
+int FileSystem::whiteoutFWFile(FileID id)
+{
+	if(whiteouts.contains(id)) {
+		return FS_OK;
+	}
+	if(!whiteouts.add(id)) {
+		return Error::NoMem;
+	}
+	// Deletion must persist
+	int res = journal.add(id, Journal::Type::whiteout);
+	if(res < 0) {
+		whiteouts.remove(id);
+		journal.close();
+		return res;
+	}
+	return FS_OK;
+}
+
+/*
+ * Get FW entry, excluding deleted files
+ */
+int FileSystem::statFW(const char* path, Stat* stat)
+{
+	if(whiteouts.count() == 0) {
+		return fwfs->stat(path, stat);
+	}
+
+	Stat s;
+	if(stat == nullptr) {
+		stat = &s;
+	}
+	int res = fwfs->stat(path, stat);
+	if(res >= 0 && whiteouts.contains(stat->id)) {
+		return Error::NotFound;
+	}
 	return res;
 }
 
-bool FileSystem::isFWFileHidden(const Stat& fwstat)
+/*
+ * Open FW file for reading, excluding deleted files
+ */
+FileHandle FileSystem::openFW(const char* path)
+{
+	FileHandle file = fwfs->open(path, OpenFlag::Read);
+	if(file < 0 || whiteouts.count() == 0) {
+		return file;
+	}
+
+	Stat stat;
+	int res = fwfs->fstat(file, &stat);
+	if(res >= 0 && whiteouts.contains(stat.id)) {
+		res = Error::NotFound;
+	}
+	if(res < 0) {
+		fwfs->close(file);
+		return res;
+	}
+	return file;
+}
+
+/*
+ * Create parent directories on FFS, which override any corresponding FW directories
+ */
+void FileSystem::makeParentDirs(const char* path)
+{
+	IFS::FileSystem::cast(ffs)->makedirs(path);
+
+	FileNameBuffer buf;
+	if(buf.copy(path) < 0) {
+		return;
+	}
+	auto s = buf.begin();
+	for(unsigned i = 1; i < buf.length; ++i) {
+		if(s[i] != '/') {
+			continue;
+		}
+		s[i] = '\0';
+		negativeCache.invalidate(buf.c_str());
+#if HYFS_HIDE_FLAGS == 1
+		// Otherwise these get picked up during enumeration
+		Stat stat;
+		if(overridesKnown() && fwfs->stat(buf.c_str(), &stat) >= 0) {
+			hideFWFile(stat.id, true);
+		}
+#endif
+		s[i] = '/';
+	}
+}
+
+/*
+ * Load persistent state from journal, creating it if necessary.
+ * Failure isn't fatal: FW files can't be deleted, and overridden FW entries get found during enumeration.
+ */
+void FileSystem::openJournal()
+{
+	Info fwinfo;
+	fwfs->getinfo(fwinfo);
+
+#if HYFS_HIDE_FLAGS == 1
+	FileIDSet* overrides = &hiddenFwFiles;
+#else
+	FileIDSet* overrides{nullptr};
+#endif
+
+	int res = journal.load(*ffs, fwinfo, overrides, whiteouts);
+	if(res >= 0) {
+		debug_i("[HYFS] Journal loaded, %u overrides, %u whiteouts", overrides ? overrides->count() : 0,
+				whiteouts.count());
+		return;
+	}
+	if(res != Error::NotFound) {
+		debug_w("[HYFS] Journal discarded: %s", ffs->getErrorString(res).c_str());
+	}
+
+	whiteouts.clear();
+#if HYFS_HIDE_FLAGS == 1
+	// Journal must be complete, so find any existing overrides
+	hiddenFwFiles.clear();
+	FileNameBuffer path;
+	scanOverrides(path);
+#endif
+
+	res = journal.create(*ffs, fwinfo, overrides, whiteouts);
+	if(res < 0) {
+		debug_w("[HYFS] Journal unavailable: %s", ffs->getErrorString(res).c_str());
+	}
+}
+
+/*
+ * Recursively find FW entries which have a corresponding FFS entry
+ */
+void FileSystem::scanOverrides([[maybe_unused]] NameBuffer& path)
 {
+#if HYFS_HIDE_FLAGS == 1
+	DirHandle dir;
+	if(ffs->opendir(path.length ? path.c_str() : nullptr, dir) < 0) {
+		return;
+	}
+
+	auto pathLength = path.length;
+	NameStat stat;
+	while(ffs->readdir(dir, stat) >= 0) {
+		if(pathLength == 0 && Journal::isJournal(stat.name)) {
+			continue;
+		}
+		bool isDir = stat.isDir();
+		if(flags[Flag::copyOnWrite] && CowFile::isSidecar(stat.name)) {
+			CowFile::stripSuffix(stat.name);
+		}
+		path.join(stat.name);
+		if(!path.overflow()) {
+			Stat fwstat;
+			if(fwfs->stat(path.c_str(), &fwstat) >= 0) {
+				hiddenFwFiles.add(fwstat.id);
+			}
+			if(isDir) {
+				scanOverrides(path);
+			}
+		}
+		path.length = pathLength;
+		path.terminate();
+	}
+
+	ffs->closedir(dir);
+#endif
+}
+
+bool FileSystem::isFWFileHidden([[maybe_unused]] const FileDir& dir, const Stat& fwstat)
+{
+	if(whiteouts.contains(fwstat.id)) {
+		return true;
+	}
 #if HYFS_HIDE_FLAGS == 1
 	return hiddenFwFiles.contains(fwstat.id);
 #else
-	return ffs->stat(fwstat.name, nullptr) >= 0;
+	if(dir.ffs == nullptr) {
+		return false;
+	}
+	if(dir.ffsHidden && dir.ffsNames.isValid()) {
+		return dir.ffsNames.contains(fwstat.name.c_str());
+	}
+
+	// Fallback if there wasn't enough memory to build the name index
+	FileNameBuffer path;
+	path.join(dir.path.c_str());
+	path.join(fwstat.name);
+	return ffs->stat(path.c_str(), nullptr) >= 0;
 #endif
 }
 
@@ -278,28 +611,52 @@ int FileSystem::readdir(DirHandle dir, Stat& stat)
 	if(d->fs == ffs) {
 		// Use a temporary stat in case it's not provided
 		NameStat s;
-		res = ffs->readdir(d->ffs, s);
+		do {
+			res = ffs->readdir(d->ffs, s);
+			if(res >= 0) {
+				++d->ffsIndex;
+			}
+		} while(res >= 0 && d->path.length() == 0 && Journal::isJournal(s.name));
 		if(res >= 0) {
-			stat = s;
-			auto pathlen = d->path.length();
-			auto newpathlen = pathlen + s.name.length;
-			if(pathlen != 0) {
-				++newpathlen; // Separator
+			// Report sidecar files using name and size of the file they represent
+			int err{FS_OK};
+			if(flags[Flag::copyOnWrite] && CowFile::isSidecar(s.name)) {
+				CowFile::stripSuffix(s.name);
+				err = getCowSize(d->path.c_str(), s.name, s.size);
 			}
-			if(newpathlen >= s.name.size) {
-				return Error::NameTooLong;
+			stat = s;
+#if HYFS_HIDE_FLAGS == 0
+			if(!d->ffsHidden && !d->ffsSeek) {
+				d->ffsNames.add(s.name.c_str());
 			}
-			char* path = s.name.buffer;
-			if(pathlen != 0) {
-				memmove(path + pathlen + 1, s.name.buffer, s.name.length + 1);
-				path[pathlen] = '/';
-				memcpy(path, d->path.c_str(), pathlen);
+#else
+			// Look up matching FW entry relative to its directory, unless already known from journal
+			if(!overridesKnown()) {
+				if(d->fw == nullptr && !d->fwMissing) {
+					d->fwMissing = fwfs->opendir(d->path.c_str(), d->fw) < 0;
+				}
+				if(d->fw != nullptr) {
+					Stat fwstat;
+					if(fwfs->statat(d->fw, s.name.c_str(), &fwstat) >= 0) {
+						hideFWFile(fwstat.id, true);
+					}
+				}
 			}
-			hideFWFile(path, true);
-			return res;
+#endif
+			// Report unusable sidecar in the same way as open(): entry is consumed so listing may continue
+			return (err < 0) ? err : res;
 		}
 
 		// End of FFS files
+		if(!d->ffsSeek && !d->ffsHidden) {
+#if HYFS_HIDE_FLAGS == 0
+			d->ffsNames.sort();
+#endif
+			d->ffsHidden = true;
+		}
+		if(d->fwMissing) {
+			return Error::NoMoreFiles;
+		}
 		if(d->fw == nullptr) {
 			res = fwfs->opendir(d->path.c_str(), d->fw);
 			if(res == Error::NotFound) {
@@ -319,7 +676,7 @@ int FileSystem::readdir(DirHandle dir, Stat& stat)
 		if(res < 0) {
 			break;
 		}
-	} while(isFWFileHidden(stat));
+	} while(isFWFileHidden(*d, stat));
 
 	return res;
 }
@@ -341,9 +698,98 @@ int FileSystem::rewinddir(DirHandle dir)
 	}
 
 	d->fs = ffs;
+	d->ffsSeek = false;
+	d->ffsIndex = 0;
+#if HYFS_HIDE_FLAGS == 0
+	if(!d->ffsHidden) {
+		// Partial list, will be rebuilt
+		d->ffsNames.clear();
+	}
+#endif
 	return ffs->rewinddir(d->ffs);
 }
 
+int FileSystem::telldir(DirHandle dir, DirCookie& cookie)
+{
+	GET_FILEDIR()
+
+	if(d->fs == ffs) {
+		int res = ffs->telldir(d->ffs, cookie);
+		if(res == Error::NotImplemented || res == Error::NotSupported) {
+			cookie = ffsIndexFlag | d->ffsIndex;
+			return FS_OK;
+		}
+		return res;
+	}
+
+	int res = fwfs->telldir(d->fw, cookie);
+	if(res < 0) {
+		return res;
+	}
+	cookie |= fwCookieFlag;
+	return FS_OK;
+}
+
+int FileSystem::seekdir(DirHandle dir, DirCookie cookie)
+{
+	GET_FILEDIR()
+
+	if((cookie & fwCookieFlag) == 0) {
+		if(d->ffs == nullptr) {
+			return Error::BadParam;
+		}
+		if(d->fw != nullptr) {
+			int res = fwfs->rewinddir(d->fw);
+			if(res < 0) {
+				return res;
+			}
+		}
+		d->fs = ffs;
+		d->ffsSeek = !d->ffsHidden;
+		if((cookie & ffsIndexFlag) == 0) {
+			return ffs->seekdir(d->ffs, cookie);
+		}
+
+		// Entry number: rewind and skip entries
+		int res = ffs->rewinddir(d->ffs);
+		d->ffsIndex = 0;
+		auto index = cookie & ~ffsIndexFlag;
+		NameStat stat;
+		while(res >= 0 && d->ffsIndex < index) {
+			res = ffs->readdir(d->ffs, stat);
+			if(res >= 0) {
+				++d->ffsIndex;
+			}
+		}
+		return (res == Error::NoMoreFiles) ? FS_OK : res;
+	}
+
+	/*
+	 * FW files are hidden as FFS entries are read, unless already known from the journal.
+	 * If this hasn't been completed for this directory then read through FFS entries first.
+	 */
+	if(d->ffs != nullptr && !d->ffsHidden && !overridesKnown()) {
+		int res = rewinddir(dir);
+		if(res < 0) {
+			return res;
+		}
+		NameStat stat;
+		while(!d->ffsHidden) {
+			// Errors for individual entries, such as unusable sidecars, don't stop the scan
+			readdir(dir, stat);
+		}
+	}
+
+	if(d->fw == nullptr) {
+		int res = fwfs->opendir(d->path.c_str(), d->fw);
+		if(res < 0) {
+			return res;
+		}
+	}
+	d->fs = fwfs;
+	return fwfs->seekdir(d->fw, cookie & ~fwCookieFlag);
+}
+
 int FileSystem::closedir(DirHandle dir)
 {
 	GET_FILEDIR()
@@ -384,68 +830,114 @@ FileHandle FileSystem::open(const char* path, OpenFlags flags)
 {
 	CHECK_MOUNTED()
 
-	// If file exists on FFS then open it and return
-	int res = ffs->stat(path, nullptr);
-	if(res >= 0) {
-		return ffs->open(path, flags);
+	// Skip FFS lookup if path is known not to exist there
+	int res{FS_OK};
+	if(!negativeCache.contains(path)) {
+		// If file exists on FFS then open it and return
+		res = ffs->stat(path, nullptr);
+		if(res >= 0) {
+			return ffs->open(path, flags);
+		}
+
+		// File may have been partially modified
+		if(this->flags[Flag::copyOnWrite]) {
+			auto file = openSidecar(path, flags);
+			if(file >= 0 || (file != Error::NotFound && file != Error::NameTooLong)) {
+				return file;
+			}
+		}
+
+		if(res == Error::NotFound) {
+			negativeCache.add(path);
+		}
 	}
 
 	// OK, so no FFS file exists. Get the FW file.
-	FileHandle fwfile = fwfs->open(path, OpenFlag::Read);
+	FileHandle fwfile = openFW(path);
 
 	// If we're only reading the file then return FW file directly
 	if(flags == OpenFlag::Read) {
 		return fwfile;
 	}
 
-	// If we have a FW file, check the ReadOnly flag
-	if(fwfile >= 0) {
-		Stat stat;
-		int err = fwfs->fstat(fwfile, &stat);
-		if(err >= 0 && stat.attr[FileAttribute::ReadOnly]) {
-			err = Error::ReadOnly;
+	// If there's no FW file, nothing further to do so return FFS result (success or failure)
+	if(fwfile < 0) {
+		negativeCache.invalidate(path);
+		makeParentDirs(path);
+		return ffs->open(path, flags);
+	}
+
+	// Check the ReadOnly flag
+	Stat stat;
+	res = fwfs->fstat(fwfile, &stat);
+	if(res >= 0 && stat.attr[FileAttribute::ReadOnly]) {
+		res = Error::ReadOnly;
+	}
+	if(res < 0) {
+		fwfs->close(fwfile);
+		return res;
+	}
+
+	FileDesc desc;
+	desc.file = fwfile;
+	desc.fwid = stat.id;
+	desc.flags = flags;
+
+	// Truncation is a modification, otherwise copy can be deferred
+	if(this->flags[Flag::lazyCopy] && !flags[OpenFlag::Truncate]) {
+		int index = allocateFileDesc();
+		if(index < 0) {
+			fwfs->close(fwfile);
+			return index;
 		}
-		if(err < 0) {
+		if(flags[OpenFlag::Append]) {
+			fwfs->lseek(fwfile, 0, SeekOrigin::End);
+		}
+		desc.path = path;
+		desc.pending = true;
+		fileDescs[index] = std::move(desc);
+		return HYFS_HANDLE_MIN + index;
+	}
+
+	// Copy-on-write requires a virtual handle
+	int index{-1};
+	if(this->flags[Flag::copyOnWrite]) {
+		index = allocateFileDesc();
+		if(index < 0) {
 			fwfs->close(fwfile);
-			return err;
+			return index;
 		}
 	}
 
-	// Now copy FW file to FFS
-	IFS::FileSystem::cast(ffs)->makedirs(path);
-	if(fwfile >= 0) {
-		flags |= OpenFlag::Create | OpenFlag::Read | OpenFlag::Write;
+	res = copyUp(desc, path);
+	if(res < 0) {
+		fwfs->close(fwfile);
+		return res;
 	}
-	FileHandle ffsfile = ffs->open(path, flags);
 
-	// If there's no FW file, nothing further to do so return FFS result (success or failure)
-	if(fwfile < 0) {
-		return ffsfile;
+	if(!desc.cow) {
+		return desc.file;
 	}
 
-	// If FFS file creation failed then fail
+	fileDescs[index] = std::move(desc);
+	return HYFS_HANDLE_MIN + index;
+}
+
+/*
+ * Copy FW file to FFS, returning the FFS file handle
+ */
+FileHandle FileSystem::copyFile(const char* path, FileHandle fwfile, OpenFlags flags)
+{
+	FileHandle ffsfile = ffs->open(path, flags | OpenFlag::Create | OpenFlag::Read | OpenFlag::Write);
 	if(ffsfile < 0) {
-		fwfs->close(fwfile);
 		return ffsfile;
 	}
 
-	// Copy metadata
-	auto callback = [&](IFS::AttributeEnum& e) -> bool {
-		// Ignore errors here as destination file system doesn't necessarily support all attributes
-		int err = ffs->fsetxattr(ffsfile, e.tag, e.buffer, e.size);
-		if(err < 0) {
-			debug_w("[HYFS] fsetxattr(%s): %s", toString(e.tag).c_str(), ffs->getErrorString(err).c_str());
-		}
-		return true;
-	};
-	char buffer[1024];
-	res = fwfs->fenumxattr(fwfile, callback, buffer, sizeof(buffer));
-	if(res < 0) {
-		debug_w("[HYFS] fenumxattr(): %s", fwfs->getErrorString(res).c_str());
-	}
+	copyAttributes(*fwfs, fwfile, ffsfile);
 
 	// If not truncating then copy content into FFS file
 	if(!flags[OpenFlag::Truncate]) {
+		fwfs->lseek(fwfile, 0, SeekOrigin::Start);
 		ffs->lseek(ffsfile, 0, SeekOrigin::Start);
 		uint8_t buffer[512];
 		while(fwfs->eof(fwfile) == 0) {
@@ -458,7 +950,6 @@ FileHandle FileSystem::open(const char* path, OpenFlags flags)
 			if(len < 0) {
 				ffs->fremove(ffsfile);
 				ffs->close(ffsfile);
-				fwfs->close(fwfile);
 				return len;
 			}
 		}
@@ -468,21 +959,202 @@ FileHandle FileSystem::open(const char* path, OpenFlags flags)
 		}
 	}
 
-	fwfs->close(fwfile);
-
 	return ffsfile;
 }
 
+/*
+ * Copy FW file to FFS, either in full or by creating a sidecar file.
+ * On success, the FW file is either closed or owned by the CowFile, and the current position is retained.
+ * On failure, the FW file remains open.
+ */
+int FileSystem::copyUp(FileDesc& fd, const char* path)
+{
+	auto pos = fwfs->tell(fd.file);
+
+	negativeCache.invalidate(path);
+	makeParentDirs(path);
+
+	// Another handle may already have copied the file, so use that copy instead of overwriting it
+	int res = openCopy(fd, path, pos);
+	if(res >= 0) {
+		fwfs->close(fd.file);
+		fd.file = fd.cow ? -1 : res;
+	} else if(res != Error::NotFound) {
+		return res;
+	}
+	bool copied = (res >= 0);
+
+	// Content only gets copied when it's modified
+	if(!copied && flags[Flag::copyOnWrite] && !fd.flags[OpenFlag::Truncate]) {
+		std::unique_ptr<CowFile> cow(new CowFile(*fwfs, *ffs));
+		if(!cow) {
+			return Error::NoMem;
+		}
+		res = cow->create(path, fd.file, fd.flags);
+		if(res >= 0) {
+			copyAttributes(*fwfs, fd.file, cow->getSidecar());
+			if(pos > 0 && !fd.flags[OpenFlag::Append]) {
+				cow->lseek(pos, SeekOrigin::Start);
+			}
+			fd.cow = std::move(cow);
+			fd.file = -1;
+		} else if(res != Error::NameTooLong) {
+			return res;
+		}
+		// Sidecar path too long, so fall back to copying entire file
+	}
+
+	if(!copied && !fd.cow) {
+		auto ffsfile = copyFile(path, fd.file, fd.flags);
+		if(ffsfile < 0) {
+			return ffsfile;
+		}
+		fwfs->close(fd.file);
+		fd.file = ffsfile;
+		if(pos > 0 && !fd.flags[OpenFlag::Append]) {
+			ffs->lseek(ffsfile, pos, SeekOrigin::Start);
+		}
+	}
+
+	// FFS copy now overrides FW file
+	hideFWFile(fd.fwid, true);
+	fd.path = nullptr;
+	fd.pending = false;
+
+	return FS_OK;
+}
+
+/*
+ * Open an existing FFS copy of a file, either in full or as a sidecar.
+ * On success, returns the FFS file handle or sets fd.cow. The FW file isn't closed.
+ */
+int FileSystem::openCopy(FileDesc& fd, const char* path, file_offset_t pos)
+{
+	auto seekPos = fd.flags[OpenFlag::Append] ? 0 : pos;
+
+	if(ffs->stat(path, nullptr) >= 0) {
+		auto ffsfile = ffs->open(path, fd.flags);
+		if(ffsfile >= 0 && seekPos > 0) {
+			ffs->lseek(ffsfile, seekPos, SeekOrigin::Start);
+		}
+		return ffsfile;
+	}
+
+	if(!flags[Flag::copyOnWrite]) {
+		return Error::NotFound;
+	}
+	std::unique_ptr<CowFile> cow(new CowFile(*fwfs, *ffs));
+	if(!cow) {
+		return Error::NoMem;
+	}
+	int res = cow->open(path, fd.flags);
+	if(res < 0) {
+		return (res == Error::NameTooLong) ? int(Error::NotFound) : res;
+	}
+	if(seekPos > 0) {
+		cow->lseek(seekPos, SeekOrigin::Start);
+	}
+	fd.cow = std::move(cow);
+	return FS_OK;
+}
+
+int FileSystem::allocateFileDesc()
+{
+	for(unsigned i = 0; i < HYFS_MAX_FDS; ++i) {
+		if(!fileDescs[i].isOpen()) {
+			return i;
+		}
+	}
+	return Error::OutOfFileDescs;
+}
+
+int FileSystem::copyAttributes(IFileSystem& srcfs, FileHandle srcfile, FileHandle ffsfile)
+{
+	auto callback = [&](IFS::AttributeEnum& e) -> bool {
+		// Ignore errors here as destination file system doesn't necessarily support all attributes
+		int err = ffs->fsetxattr(ffsfile, e.tag, e.buffer, e.size);
+		if(err < 0) {
+			debug_w("[HYFS] fsetxattr(%s): %s", toString(e.tag).c_str(), ffs->getErrorString(err).c_str());
+		}
+		return true;
+	};
+	char buffer[1024];
+	int res = srcfs.fenumxattr(srcfile, callback, buffer, sizeof(buffer));
+	if(res < 0) {
+		debug_w("[HYFS] fenumxattr(): %s", srcfs.getErrorString(res).c_str());
+	}
+	return res;
+}
+
+FileHandle FileSystem::openSidecar(const char* path, OpenFlags flags)
+{
+	int index = allocateFileDesc();
+	if(index < 0) {
+		return index;
+	}
+
+	std::unique_ptr<CowFile> cow(new CowFile(*fwfs, *ffs));
+	if(!cow) {
+		return Error::NoMem;
+	}
+
+	int res = cow->open(path, flags);
+	if(res < 0) {
+		return res;
+	}
+
+	auto& fd = fileDescs[index];
+	fd.cow = std::move(cow);
+	fd.flags = flags;
+	return HYFS_HANDLE_MIN + index;
+}
+
+int FileSystem::getCowSize(const char* dirPath, const NameBuffer& name, file_size_t& size)
+{
+	FileNameBuffer path;
+	path.copy(dirPath ?: "");
+	path.join(name);
+	if(path.overflow()) {
+		return Error::NameTooLong;
+	}
+	CowFile::Header header;
+	int res = CowFile::readHeader(*fwfs, *ffs, path.c_str(), header);
+	if(res >= 0) {
+		size = header.size;
+	}
+	return res;
+}
+
+/*
+ * Files may be on either layer so resolve using the full path
+ */
+FileHandle FileSystem::openat(DirHandle dir, const char* name, OpenFlags flags)
+{
+	GET_FILEDIR()
+
+	FileNameBuffer path;
+	path.copy(d->path.c_str());
+	path.join(name);
+	if(path.overflow()) {
+		return Error::NameTooLong;
+	}
+	return open(path.c_str(), flags);
+}
+
 int FileSystem::close(FileHandle file)
 {
 	GET_FS(file)
+	if(fd != nullptr) {
+		int res = cow ? cow->close() : fs->close(file);
+		fd->reset();
+		return res;
+	}
 	return fs->close(file);
 }
 
 /*
- * @todo if file isn't on ffs, but is on fw, then don't report an error.
- * needs a bit of thought this one; do we hide the FW file or unhide it?
- * perhaps an 'unremove' method...
+ * Removing an FFS file reveals the corresponding FW file, if any.
+ * Files which exist only on FW are deleted by recording a whiteout.
  */
 int FileSystem::remove(const char* path)
 {
@@ -491,13 +1163,32 @@ int FileSystem::remove(const char* path)
 		return Error::BadParam;
 	}
 
-	int res = ffs->remove(path);
-	if(hideFWFile(path, false) == FS_OK) {
-		if(res < 0) {
-			res = Error::ReadOnly;
+	int res{Error::NotFound};
+	if(!negativeCache.contains(path)) {
+		res = ffs->remove(path);
+		if(res == Error::NotFound && flags[Flag::copyOnWrite]) {
+			FileNameBuffer sidecarPath;
+			if(CowFile::getSidecarPath(sidecarPath, path) == FS_OK) {
+				res = ffs->remove(sidecarPath.c_str());
+			}
 		}
 	}
-	return res;
+	if(res != Error::NotFound) {
+		if(res >= 0) {
+			hideFWFile(path, false);
+		}
+		return res;
+	}
+
+	Stat stat;
+	res = statFW(path, &stat);
+	if(res < 0) {
+		return res;
+	}
+	if(stat.isDir() || stat.attr[FileAttribute::ReadOnly]) {
+		return Error::ReadOnly;
+	}
+	return whiteoutFWFile(stat.id);
 }
 
 int FileSystem::format()
@@ -506,36 +1197,187 @@ int FileSystem::format()
 		return Error::NoFileSystem;
 	}
 
+	journal.close();
+	negativeCache.clear();
+	whiteouts.clear();
 #if HYFS_HIDE_FLAGS == 1
-	hiddenFwFiles.removeAllElements();
+	hiddenFwFiles.clear();
 #endif
 
-	return ffs->format();
+	int res = ffs->format();
+	if(res >= 0 && mounted) {
+		openJournal();
+	}
+	return res;
 }
 
 int FileSystem::check()
 {
-	if(ffs == nullptr) {
+	if(fwfs == nullptr || ffs == nullptr) {
 		return Error::NoFileSystem;
 	}
 
+	// Firmware image may not contain a checksum
+	int res = fwfs->check();
+	if(res < 0 && res != Error::NotSupported && res != Error::NotImplemented) {
+		return res;
+	}
+
 	return ffs->check();
 }
 
+int FileSystem::expandSidecars()
+{
+	CHECK_MOUNTED()
+
+	for(auto& fd : fileDescs) {
+		if(fd.isOpen()) {
+			return Error::BadParam;
+		}
+	}
+
+	FileNameBuffer path;
+	return expandSidecars(path);
+}
+
+/*
+ * Recursively convert sidecars, continuing past failures so as many files as possible are preserved.
+ * The new file is created in the directory being read, but as it isn't a sidecar it's ignored if listed.
+ */
+int FileSystem::expandSidecars(NameBuffer& path)
+{
+	DirHandle dir;
+	int res = ffs->opendir(path.length ? path.c_str() : nullptr, dir);
+	if(res < 0) {
+		return res;
+	}
+
+	auto pathLength = path.length;
+	int count{0};
+	int err{FS_OK};
+	NameStat stat;
+	while(ffs->readdir(dir, stat) >= 0) {
+		path.join(stat.name);
+		if(path.overflow()) {
+			res = Error::NameTooLong;
+		} else if(stat.isDir()) {
+			res = expandSidecars(path);
+		} else if(CowFile::isSidecar(stat.name)) {
+			CowFile::stripSuffix(path);
+			res = expandSidecar(path.c_str());
+			if(res >= 0) {
+				res = 1;
+			}
+		} else {
+			res = 0;
+		}
+		if(res >= 0) {
+			count += res;
+		} else {
+			debug_e("[HYFS] Expand '%s': %s", path.c_str(), getErrorString(res).c_str());
+			if(err >= 0) {
+				err = res;
+			}
+		}
+		path.length = pathLength;
+		path.terminate();
+	}
+
+	ffs->closedir(dir);
+	return (err < 0) ? err : count;
+}
+
+int FileSystem::expandSidecar(const char* path)
+{
+	CowFile cow(*fwfs, *ffs);
+	int res = cow.open(path, OpenFlag::Read);
+	if(res < 0) {
+		return res;
+	}
+
+	auto file = ffs->open(path, OpenFlag::Create | OpenFlag::Truncate | OpenFlag::Write);
+	if(file < 0) {
+		return file;
+	}
+	copyAttributes(*ffs, cow.getSidecar(), file);
+
+	uint8_t buffer[512];
+	while((res = cow.read(buffer, sizeof(buffer))) > 0) {
+		int len = ffs->write(file, buffer, res);
+		if(len != res) {
+			res = (len < 0) ? len : int(Error::WriteFailure);
+			break;
+		}
+	}
+	if(res < 0) {
+		ffs->fremove(file);
+		ffs->close(file);
+		return res;
+	}
+	res = ffs->close(file);
+	cow.close();
+	if(res < 0) {
+		return res;
+	}
+
+	FileNameBuffer sidecarPath;
+	CowFile::getSidecarPath(sidecarPath, path);
+	return ffs->remove(sidecarPath.c_str());
+}
+
 int FileSystem::stat(const char* path, Stat* stat)
 {
 	CHECK_MOUNTED()
 
+	if(negativeCache.contains(path)) {
+		return statFW(path, stat);
+	}
+
 	int res = ffs->stat(path, stat);
-	if(res < 0) {
-		res = fwfs->stat(path, stat);
+	if(res >= 0) {
+		return res;
 	}
-	return res;
+
+	if(flags[Flag::copyOnWrite]) {
+		FileNameBuffer sidecarPath;
+		if(CowFile::getSidecarPath(sidecarPath, path) == FS_OK && ffs->stat(sidecarPath.c_str(), stat) >= 0) {
+			// Fail in the same way as open() if sidecar can't be used
+			CowFile::Header header;
+			res = CowFile::readHeader(*fwfs, *ffs, path, header);
+			if(res >= 0 && stat != nullptr) {
+				CowFile::stripSuffix(stat->name);
+				stat->size = header.size;
+			}
+			return res;
+		}
+	}
+
+	if(res == Error::NotFound) {
+		negativeCache.add(path);
+	}
+
+	return statFW(path, stat);
+}
+
+int FileSystem::statat(DirHandle dir, const char* name, Stat* stat)
+{
+	GET_FILEDIR()
+
+	FileNameBuffer path;
+	path.copy(d->path.c_str());
+	path.join(name);
+	if(path.overflow()) {
+		return Error::NameTooLong;
+	}
+	return this->stat(path.c_str(), stat);
 }
 
 int FileSystem::fstat(FileHandle file, Stat* stat)
 {
 	GET_FS(file)
+	if(cow != nullptr) {
+		return cow->fstat(stat);
+	}
 	return fs->fstat(file, stat);
 }
 
@@ -548,6 +1390,7 @@ int FileSystem::fcontrol(FileHandle file, ControlCode code, void* buffer, size_t
 int FileSystem::fsetxattr(FileHandle file, AttributeTag tag, const void* data, size_t size)
 {
 	GET_FS(file)
+	COPY_UP(file)
 	return fs->fsetxattr(file, tag, data, size);
 }
 
@@ -576,7 +1419,7 @@ int FileSystem::getxattr(const char* path, AttributeTag tag, void* buffer, size_
 	CHECK_MOUNTED()
 
 	int res = ffs->getxattr(path, tag, buffer, size);
-	if(res < 0) {
+	if(res < 0 && statFW(path, nullptr) >= 0) {
 		res = fwfs->getxattr(path, tag, buffer, size);
 	}
 	return res;
@@ -585,18 +1428,28 @@ int FileSystem::getxattr(const char* path, AttributeTag tag, void* buffer, size_
 int FileSystem::read(FileHandle file, void* data, size_t size)
 {
 	GET_FS(file)
+	if(cow != nullptr) {
+		return cow->read(data, size);
+	}
 	return fs->read(file, data, size);
 }
 
 int FileSystem::write(FileHandle file, const void* data, size_t size)
 {
 	GET_FS(file)
+	COPY_UP(file)
+	if(cow != nullptr) {
+		return cow->write(data, size);
+	}
 	return fs->write(file, data, size);
 }
 
 file_offset_t FileSystem::lseek(FileHandle file, file_offset_t offset, SeekOrigin origin)
 {
 	GET_FS(file)
+	if(cow != nullptr) {
+		return cow->lseek(offset, origin);
+	}
 	auto res = fs->lseek(file, offset, origin);
 	//  debug_i("CHybridFileSystem::lseek(%d, %d, %d): %d", file, offset, origin, res);
 	return res;
@@ -605,30 +1458,47 @@ file_offset_t FileSystem::lseek(FileHandle file, file_offset_t offset, SeekOrigi
 int FileSystem::eof(FileHandle file)
 {
 	GET_FS(file)
+	if(cow != nullptr) {
+		return cow->eof();
+	}
 	return fs->eof(file);
 }
 
 file_offset_t FileSystem::tell(FileHandle file)
 {
 	GET_FS(file)
+	if(cow != nullptr) {
+		return cow->tell();
+	}
 	return fs->tell(file);
 }
 
 int FileSystem::ftruncate(FileHandle file, file_size_t new_size)
 {
 	GET_FS(file)
+	COPY_UP(file)
+	if(cow != nullptr) {
+		return cow->ftruncate(new_size);
+	}
 	return fs->ftruncate(file, new_size);
 }
 
 int FileSystem::flush(FileHandle file)
 {
 	GET_FS(file)
+	if(cow != nullptr) {
+		return cow->flush();
+	}
 	return fs->flush(file);
 }
 
 int FileSystem::fgetextents(FileHandle file, Storage::Partition* part, Extent* list, uint16_t extcount)
 {
 	GET_FS(file)
+	if(cow != nullptr) {
+		// Content is split between layers
+		return Error::NotSupported;
+	}
 	return fs->fgetextents(file, part, list, extcount);
 }
 
@@ -646,19 +1516,73 @@ int FileSystem::rename(const char* oldpath, const char* newpath)
 		return file;
 	}
 
+	// Copy won't have happened yet if it's deferred
+	int res = FS_OK;
+	if(file >= HYFS_HANDLE_MIN && file <= HYFS_HANDLE_MAX) {
+		auto& fd = fileDescs[file - HYFS_HANDLE_MIN];
+		if(fd.pending) {
+			res = copyUp(fd, fd.path.c_str());
+		}
+	}
+
 	// Close the file and rename it
 	close(file);
-	return ffs->rename(oldpath, newpath);
+	if(res < 0) {
+		return res;
+	}
+
+	negativeCache.invalidate(newpath);
+
+	// Modified blocks may be in a sidecar, which identifies the FW file by ID so can be moved
+	if(flags[Flag::copyOnWrite] && ffs->stat(oldpath, nullptr) < 0) {
+		FileNameBuffer oldSidecar;
+		FileNameBuffer newSidecar;
+		res = CowFile::getSidecarPath(oldSidecar, oldpath);
+		if(res == FS_OK) {
+			res = CowFile::getSidecarPath(newSidecar, newpath);
+		}
+		if(res == FS_OK) {
+			res = ffs->rename(oldSidecar.c_str(), newSidecar.c_str());
+		}
+	} else {
+		res = ffs->rename(oldpath, newpath);
+	}
+	if(res < 0) {
+		return res;
+	}
+
+	// Any FW file at the new location is now overridden, and the original no longer exists
+	hideFWFile(newpath, true);
+	Stat fwstat;
+	if(statFW(oldpath, &fwstat) >= 0) {
+		res = whiteoutFWFile(fwstat.id);
+	}
+	return res;
 }
 
 /*
- * @note can only delete files with write permission, which means the
- * file is on FFS.
+ * As for remove(), FW files (including those with a pending copy) are deleted by recording a whiteout.
  */
 int FileSystem::fremove(FileHandle file)
 {
 	GET_FS(file)
-	return fs->fremove(file);
+	if(fs == fwfs) {
+		Stat stat;
+		int res = fwfs->fstat(file, &stat);
+		if(res < 0) {
+			return res;
+		}
+		if(stat.attr[FileAttribute::ReadOnly]) {
+			return Error::ReadOnly;
+		}
+		return whiteoutFWFile(stat.id);
+	}
+
+	int res = fs->fremove(file);
+	if(res >= 0 && fd != nullptr && fd->fwid != 0) {
+		hideFWFile(fd->fwid, false);
+	}
+	return res;
 }
 
 } // namespace IFS::HYFS
@@ -0,0 +1,223 @@
+/****
+ * Journal.cpp
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "../include/IFS/HYFS/Journal.h"
+#include "../include/IFS/NameBuffer.h"
+
+// Journal is rewritten to this file then renamed
+#define JOURNAL_TEMP_NAME HYFS_JOURNAL_NAME ".new"
+
+namespace IFS::HYFS
+{
+namespace
+{
+// Number of records read at a time when loading
+constexpr unsigned loadBatchSize{16};
+
+// Rewrite journal when superseded records exceed live ones by this margin
+constexpr unsigned compactMargin{32};
+
+} // namespace
+
+int Journal::load(IFileSystem& fs, const IFileSystem::Info& fwinfo, FileIDSet* overrides, FileIDSet& whiteouts)
+{
+	close();
+
+	auto f = fs.open(HYFS_JOURNAL_NAME, OpenFlag::Read | OpenFlag::Write);
+	if(f == Error::NotFound && fs.rename(JOURNAL_TEMP_NAME, HYFS_JOURNAL_NAME) >= 0) {
+		// A rewrite was interrupted after removing the old journal
+		f = fs.open(HYFS_JOURNAL_NAME, OpenFlag::Read | OpenFlag::Write);
+	}
+	if(f < 0) {
+		return f;
+	}
+
+	Header header;
+	int res = fs.read(f, &header, sizeof(header));
+	if(res >= 0 && (res != sizeof(header) || header.magic != magic || header.volumeID != fwinfo.volumeID ||
+					header.creationTime != fwinfo.creationTime)) {
+		res = Error::BadObject;
+	}
+
+	if(overrides != nullptr) {
+		overrides->clear();
+	}
+	whiteouts.clear();
+
+	unsigned count{0};
+	bool partial{false};
+	bool complete{true};
+	Record records[loadBatchSize];
+	while(res >= 0 && (res = fs.read(f, records, sizeof(records))) > 0) {
+		unsigned n = unsigned(res) / sizeof(Record);
+		partial = (unsigned(res) % sizeof(Record)) != 0;
+		for(unsigned i = 0; i < n; ++i) {
+			auto& rec = records[i];
+			switch(rec.type) {
+			case Type::override:
+				if(overrides != nullptr) {
+					complete &= overrides->add(rec.id);
+				}
+				break;
+			case Type::whiteout:
+				complete &= whiteouts.add(rec.id);
+				break;
+			case Type::clear:
+				if(overrides != nullptr) {
+					overrides->remove(rec.id);
+				}
+				break;
+			default:
+				// Ignore unknown record types
+				break;
+			}
+		}
+		count += n;
+	}
+
+	if(res >= 0 && !complete) {
+		res = Error::NoMem;
+	}
+	if(res < 0) {
+		fs.close(f);
+		return res;
+	}
+
+	ffs = &fs;
+	file = f;
+	recordCount = count;
+
+	// Incomplete record from an interrupted write, or lots of superseded records
+	unsigned live = whiteouts.count() + (overrides ? overrides->count() : 0);
+	if(partial || recordCount > 2 * live + compactMargin) {
+		debug_i("[HYFS] Compacting journal, %u records, %u live", recordCount, live);
+		return create(fs, fwinfo, overrides, whiteouts);
+	}
+
+	return FS_OK;
+}
+
+int Journal::create(IFileSystem& fs, const IFileSystem::Info& fwinfo, const FileIDSet* overrides,
+					const FileIDSet& whiteouts)
+{
+	close();
+
+	// Existing journal remains valid until the new one is complete
+	file = fs.open(JOURNAL_TEMP_NAME, OpenFlag::Create | OpenFlag::Truncate | OpenFlag::Read | OpenFlag::Write);
+	if(file < 0) {
+		int res = file;
+		file = -1;
+		return res;
+	}
+	ffs = &fs;
+
+	// Header is written last so an incomplete file gets rejected
+	Header header{};
+	int res = fs.write(file, &header, sizeof(header));
+	if(res >= 0) {
+		res = writeRecords(overrides, Type::override);
+	}
+	if(res >= 0) {
+		res = writeRecords(&whiteouts, Type::whiteout);
+	}
+	if(res >= 0) {
+		header = Header{magic, fwinfo.volumeID, fwinfo.creationTime};
+		res = fs.lseek(file, 0, SeekOrigin::Start);
+	}
+	if(res >= 0) {
+		res = fs.write(file, &header, sizeof(header));
+	}
+	fs.close(file);
+	file = -1;
+
+	if(res >= 0) {
+		fs.remove(HYFS_JOURNAL_NAME);
+		res = fs.rename(JOURNAL_TEMP_NAME, HYFS_JOURNAL_NAME);
+	}
+	if(res >= 0) {
+		file = fs.open(HYFS_JOURNAL_NAME, OpenFlag::Read | OpenFlag::Write);
+		res = file;
+	}
+	if(res >= 0) {
+		res = fs.lseek(file, 0, SeekOrigin::End);
+	}
+	if(res < 0) {
+		debug_w("[HYFS] Journal create failed: %s", fs.getErrorString(res).c_str());
+		close();
+		fs.remove(JOURNAL_TEMP_NAME);
+		return res;
+	}
+
+	return FS_OK;
+}
+
+int Journal::writeRecord(FileID id, Type type)
+{
+	Record rec{id, type, {}};
+	int res = ffs->write(file, &rec, sizeof(rec));
+	if(res < 0) {
+		return res;
+	}
+	if(res != sizeof(rec)) {
+		return Error::WriteFailure;
+	}
+	++recordCount;
+	return FS_OK;
+}
+
+int Journal::writeRecords(const FileIDSet* set, Type type)
+{
+	if(set == nullptr) {
+		return FS_OK;
+	}
+	int res{FS_OK};
+	set->forEach([&](FileID id) {
+		if(res >= 0) {
+			res = writeRecord(id, type);
+		}
+	});
+	return res;
+}
+
+int Journal::add(FileID id, Type type)
+{
+	if(file < 0) {
+		return Error::FileNotOpen;
+	}
+	int res = writeRecord(id, type);
+	if(res >= 0) {
+		// Record must survive power loss
+		res = ffs->flush(file);
+	}
+	if(res < 0) {
+		debug_w("[HYFS] Journal write failed: %s", ffs->getErrorString(res).c_str());
+	}
+	return res;
+}
+
+void Journal::close()
+{
+	if(file >= 0) {
+		ffs->close(file);
+		file = -1;
+	}
+	recordCount = 0;
+}
+
+} // namespace IFS::HYFS
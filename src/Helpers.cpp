@@ -54,6 +54,54 @@ private:
 	std::unique_ptr<Storage::FileDevice> device;
 };
 
+/**
+ * @brief Writes output sequentially to a partition
+ */
+class PartitionWriter : public Print
+{
+public:
+	PartitionWriter(Storage::Partition& partition) : partition(partition)
+	{
+	}
+
+	size_t write(uint8_t c) override
+	{
+		return write(&c, 1);
+	}
+
+	size_t write(const uint8_t* buffer, size_t size) override
+	{
+		if(error < 0) {
+			return 0;
+		}
+		if(offset + size > partition.size()) {
+			error = Error::NoSpace;
+			return 0;
+		}
+		if(!partition.write(offset, buffer, size)) {
+			error = Error::WriteFailure;
+			return 0;
+		}
+		offset += size;
+		return size;
+	}
+
+	storage_size_t getOffset() const
+	{
+		return offset;
+	}
+
+	int getError() const
+	{
+		return error;
+	}
+
+private:
+	Storage::Partition& partition;
+	storage_size_t offset{0};
+	int error{FS_OK};
+};
+
 } // namespace
 
 /** @brief required by IFS, platform-specific */
@@ -68,7 +116,8 @@ FileSystem* createFirmwareFilesystem(Storage::Partition partition)
 	return FileSystem::cast(fs);
 }
 
-FileSystem* createHybridFilesystem(Storage::Partition fwfsPartition, IFileSystem* flashFileSystem)
+FileSystem* createHybridFilesystem(Storage::Partition fwfsPartition, IFileSystem* flashFileSystem,
+								   HYFS::FileSystem::Flags flags)
 {
 	if(flashFileSystem == nullptr) {
 		return nullptr;
@@ -80,16 +129,35 @@ FileSystem* createHybridFilesystem(Storage::Partition fwfsPartition, IFileSystem
 		return nullptr;
 	}
 
-	auto fs = new HYFS::FileSystem(fwfs, flashFileSystem);
+	auto fs = new HYFS::FileSystem(fwfs, flashFileSystem, flags);
+	return FileSystem::cast(fs);
+}
+
+FileSystem* createUnionFilesystem(std::initializer_list<Storage::Partition> partitions)
+{
+	auto fs = new Union::FileSystem;
+	if(fs == nullptr) {
+		return nullptr;
+	}
+
+	for(auto& part : partitions) {
+		auto layer = new FWFS::FileSystem(part);
+		if(layer == nullptr || fs->addLayer(layer) < 0) {
+			delete fs;
+			return nullptr;
+		}
+	}
+
 	return FileSystem::cast(fs);
 }
 
-FileSystem* mountArchive(FileSystem& fs, const String& filename)
+FileSystem* mountArchive(FileSystem& fs, const String& filename, IFileSystem* base)
 {
 	auto arcfs = new ArchiveFileSystem(fs, filename);
 	if(arcfs == nullptr) {
 		return nullptr;
 	}
+	arcfs->setBase(base);
 	if(arcfs->mount() != FS_OK) {
 		delete arcfs;
 		return nullptr;
@@ -97,4 +165,31 @@ FileSystem* mountArchive(FileSystem& fs, const String& filename)
 	return IFS::FileSystem::cast(arcfs);
 }
 
+int createFirmwareImage(FileSystem& fs, Storage::Partition partition,
+						const FWFS::ArchiveStream::VolumeInfo& volumeInfo)
+{
+	if(!partition) {
+		return Error::NoPartition;
+	}
+
+	if(!partition.erase_range(0, partition.size())) {
+		return Error::EraseFailure;
+	}
+
+	FWFS::ArchiveStream archive(&fs, volumeInfo);
+	PartitionWriter writer(partition);
+	int res = archive.writeTo(writer);
+	if(res < 0) {
+		// Report the underlying cause where known
+		int err = writer.getError();
+		if(err == FS_OK) {
+			err = archive.getLastError();
+		}
+		return (err < 0) ? err : res;
+	}
+
+	debug_i("[IFS] Created FWFS image of %u bytes in '%s'", unsigned(writer.getOffset()), partition.name().c_str());
+	return FS_OK;
+}
+
 } // namespace IFS
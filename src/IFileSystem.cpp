@@ -87,4 +87,33 @@ size_t IFileSystem::Info::printTo(Print& p) const
 	return n;
 }
 
+/*
+ * Default path view handling for filesystems which require nul-terminated paths.
+ * The path is copied into a stack buffer so no heap allocation is required.
+ */
+
+#define GET_PATH(view, var)                                                                                            \
+	FileNameBuffer var;                                                                                                \
+	if(var.copy(view) < 0 || var.overflow()) {                                                                         \
+		return Error::NameTooLong;                                                                                     \
+	}
+
+int IFileSystem::opendir(PathView path, DirHandle& dir)
+{
+	GET_PATH(path, buf)
+	return opendir(buf.c_str(), dir);
+}
+
+int IFileSystem::stat(PathView path, Stat* stat)
+{
+	GET_PATH(path, buf)
+	return this->stat(buf.c_str(), stat);
+}
+
+FileHandle IFileSystem::open(PathView path, OpenFlags flags)
+{
+	GET_PATH(path, buf)
+	return open(buf.c_str(), flags);
+}
+
 } // namespace IFS
@@ -0,0 +1,654 @@
+/****
+ * FileSystem.cpp
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#include "../include/IFS/Union/FileSystem.h"
+#include "../include/IFS/Util.h"
+#include <algorithm>
+
+#define CHECK_MOUNTED()                                                                                                \
+	if(!mounted) {                                                                                                     \
+		return Error::NotMounted;                                                                                      \
+	}
+
+#define GET_FD(file)                                                                                                   \
+	CHECK_MOUNTED()                                                                                                    \
+	if(file < UNIONFS_HANDLE_MIN || file > UNIONFS_HANDLE_MAX) {                                                       \
+		return Error::InvalidHandle;                                                                                   \
+	}                                                                                                                  \
+	auto& fd = fileDescs[file - UNIONFS_HANDLE_MIN];                                                                   \
+	if(fd.fs == nullptr) {                                                                                             \
+		return Error::FileNotOpen;                                                                                     \
+	}
+
+namespace IFS::Union
+{
+namespace
+{
+/*
+ * Index entries hold a path hash in the upper bits and the layer in the lower bits.
+ * Layer is inverted so that sorting puts the topmost layer first for each hash.
+ */
+constexpr unsigned layerBits{3};
+constexpr uint32_t layerMask{(1U << layerBits) - 1};
+static_assert(UNIONFS_MAX_LAYERS <= (1U << layerBits), "UNIONFS_MAX_LAYERS too large");
+
+constexpr unsigned minIndexCapacity{64};
+
+uint32_t hashPath(const char* path)
+{
+	// FNV-1a, ignoring any leading separator
+	uint32_t hash{2166136261U};
+	if(path != nullptr) {
+		if(*path == '/') {
+			++path;
+		}
+		while(*path != '\0') {
+			hash ^= uint8_t(*path++);
+			hash *= 16777619U;
+		}
+	}
+	return hash & ~layerMask;
+}
+
+constexpr uint32_t makeEntry(uint32_t hash, uint8_t layer)
+{
+	return hash | (layerMask - layer);
+}
+
+constexpr uint8_t getEntryLayer(uint32_t entry)
+{
+	return layerMask - (entry & layerMask);
+}
+
+/*
+ * Directory cookies identify the layer using the top bits
+ */
+constexpr unsigned cookieLayerShift{56};
+constexpr DirCookie cookieMask{(1ULL << cookieLayerShift) - 1};
+constexpr uint8_t endOfListing{0xff};
+
+} // namespace
+
+// opendir() uses this structure to track file listing
+struct FileDir {
+	CString path;
+	DirHandle dirs[UNIONFS_MAX_LAYERS];
+	// Topmost layer containing this directory
+	int8_t topLayer;
+	// Layer being enumerated, -1 when complete
+	int8_t layer;
+};
+
+FileSystem::~FileSystem()
+{
+	for(auto& fd : fileDescs) {
+		if(fd.fs != nullptr) {
+			fd.fs->close(fd.handle);
+		}
+	}
+	for(unsigned i = 0; i < layerCount; ++i) {
+		delete layers[i];
+	}
+}
+
+int FileSystem::addLayer(IFileSystem* fileSystem)
+{
+	if(fileSystem == nullptr) {
+		return Error::BadParam;
+	}
+	if(mounted || layerCount >= UNIONFS_MAX_LAYERS) {
+		delete fileSystem;
+		return mounted ? Error::NotSupported : Error::BadVolumeIndex;
+	}
+	layers[layerCount++] = fileSystem;
+	return FS_OK;
+}
+
+int FileSystem::mount()
+{
+	if(mounted) {
+		return FS_OK;
+	}
+
+	if(layerCount == 0) {
+		return Error::NoFileSystem;
+	}
+
+	for(unsigned i = 0; i < layerCount; ++i) {
+		int res = layers[i]->mount();
+		if(res < 0) {
+			return res;
+		}
+	}
+
+	int res = buildIndex();
+	if(res < 0) {
+		debug_w("[UFS] Index unavailable, searching layers: %s", getErrorString(res).c_str());
+	}
+
+	mounted = true;
+	return FS_OK;
+}
+
+int FileSystem::buildIndex()
+{
+	index.reset();
+	indexCount = 0;
+	indexCapacity = 0;
+
+	int res = FS_OK;
+	for(uint8_t layer = 0; layer < layerCount && res >= 0; ++layer) {
+		FileNameBuffer path;
+		res = indexDirectory(layer, path);
+	}
+	if(res >= 0 && !index) {
+		// Layers are empty
+		res = addIndexEntry(0, "");
+	}
+	if(res < 0) {
+		index.reset();
+		indexCount = 0;
+		indexCapacity = 0;
+		return res;
+	}
+
+	// Keep only the topmost layer for each hash
+	auto begin = &index[0];
+	std::sort(begin, begin + indexCount);
+	auto end = std::unique(begin, begin + indexCount,
+						   [](uint32_t a, uint32_t b) { return (a & ~layerMask) == (b & ~layerMask); });
+	indexCount = end - begin;
+
+	// Release unused space
+	std::unique_ptr<uint32_t[]> newIndex(new(std::nothrow) uint32_t[indexCount]);
+	if(newIndex) {
+		std::copy(begin, end, &newIndex[0]);
+		index = std::move(newIndex);
+		indexCapacity = indexCount;
+	}
+
+	debug_i("[UFS] Index has %u entries for %u layers", indexCount, layerCount);
+	return FS_OK;
+}
+
+/*
+ * Recursively add all entries in a directory to the index
+ */
+int FileSystem::indexDirectory(uint8_t layer, NameBuffer& path)
+{
+	auto fs = layers[layer];
+	DirHandle dir;
+	int res = fs->opendir(path.length ? path.c_str() : nullptr, dir);
+	if(res < 0) {
+		// Unresolved mountpoints, for example
+		return (path.length == 0) ? res : FS_OK;
+	}
+
+	auto pathLength = path.length;
+	NameStat stat;
+	while((res = fs->readdir(dir, stat)) >= 0) {
+		path.join(stat.name);
+		if(!path.overflow()) {
+			res = addIndexEntry(layer, path.c_str());
+			if(res >= 0 && stat.isDir()) {
+				res = indexDirectory(layer, path);
+			}
+		}
+		path.length = pathLength;
+		path.terminate();
+		if(res < 0) {
+			break;
+		}
+	}
+
+	fs->closedir(dir);
+	return (res == Error::NoMoreFiles) ? FS_OK : res;
+}
+
+int FileSystem::addIndexEntry(uint8_t layer, const char* path)
+{
+	if(indexCount == indexCapacity) {
+		auto newCapacity = std::max(indexCapacity * 2, minIndexCapacity);
+		std::unique_ptr<uint32_t[]> newIndex(new(std::nothrow) uint32_t[newCapacity]);
+		if(!newIndex) {
+			return Error::NoMem;
+		}
+		if(indexCount != 0) {
+			std::copy(&index[0], &index[indexCount], &newIndex[0]);
+		}
+		index = std::move(newIndex);
+		indexCapacity = newCapacity;
+	}
+
+	index[indexCount++] = makeEntry(hashPath(path), layer);
+	return FS_OK;
+}
+
+/*
+ * Get the topmost layer which may contain a path.
+ * Other paths with the same hash may be present, so the caller must verify.
+ */
+int FileSystem::findTopLayer(const char* path) const
+{
+	if(!index) {
+		return layerCount - 1;
+	}
+
+	auto hash = hashPath(path);
+	auto end = &index[indexCount];
+	auto it = std::lower_bound(&index[0], end, hash);
+	if(it == end || (*it & ~layerMask) != hash) {
+		return Error::NotFound;
+	}
+	return getEntryLayer(*it);
+}
+
+/*
+ * Locate the topmost layer containing a path
+ */
+int FileSystem::findLayer(const char* path, Stat* stat)
+{
+	if(isRootPath(path)) {
+		int res = layers[layerCount - 1]->stat(nullptr, stat);
+		return (res < 0) ? res : layerCount - 1;
+	}
+
+	int top = findTopLayer(path);
+	if(top < 0) {
+		return top;
+	}
+
+	for(int layer = top; layer >= 0; --layer) {
+		int res = layers[layer]->stat(path, stat);
+		if(res >= 0) {
+			return layer;
+		}
+		if(res != Error::NotFound) {
+			return res;
+		}
+	}
+
+	return Error::NotFound;
+}
+
+/*
+ * Determine if a directory entry is hidden by one in a higher layer
+ */
+bool FileSystem::isShadowed(const FileDir& dir, const NameBuffer& name, uint8_t layer)
+{
+	FileNameBuffer path;
+	path.join(dir.path.c_str());
+	path.join(name);
+	if(path.overflow()) {
+		return false;
+	}
+
+	// Higher layers can only contain this entry if the index says so
+	int top = std::min(findTopLayer(path.c_str()), int(dir.topLayer));
+	for(int i = top; i > layer; --i) {
+		if(layers[i]->stat(path.c_str(), nullptr) >= 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int FileSystem::openLayerDir(FileDir& dir, uint8_t layer)
+{
+	if(dir.dirs[layer] != nullptr) {
+		return FS_OK;
+	}
+	return layers[layer]->opendir(dir.path.c_str(), dir.dirs[layer]);
+}
+
+int FileSystem::getinfo(Info& info)
+{
+	if(layerCount == 0) {
+		return Error::NoFileSystem;
+	}
+
+	int res = layers[layerCount - 1]->getinfo(info);
+	if(res < 0) {
+		return res;
+	}
+
+	info.type = Type::Union;
+	info.partition = Storage::Partition{};
+	info.attr = Attribute::ReadOnly + Attribute::Virtual;
+	if(mounted) {
+		info.attr |= Attribute::Mounted;
+	}
+	info.freeSpace = 0;
+	for(unsigned i = 0; i + 1 < layerCount; ++i) {
+		Info layerInfo;
+		layers[i]->getinfo(layerInfo);
+		info.volumeSize += layerInfo.volumeSize;
+		info.maxNameLength = std::min(info.maxNameLength, layerInfo.maxNameLength);
+		info.maxPathLength = std::min(info.maxPathLength, layerInfo.maxPathLength);
+	}
+
+	return FS_OK;
+}
+
+int FileSystem::opendir(const char* path, DirHandle& dir)
+{
+	CHECK_MOUNTED()
+
+	Stat stat;
+	int top = findLayer(path, &stat);
+	if(top < 0) {
+		return top;
+	}
+	if(!stat.isDir()) {
+		return Error::NotFound;
+	}
+
+	FS_CHECK_PATH(path)
+
+	auto d = new FileDir{};
+	if(d == nullptr) {
+		return Error::NoMem;
+	}
+
+	d->path = path;
+	d->topLayer = d->layer = top;
+	int res = openLayerDir(*d, top);
+	if(res < 0) {
+		delete d;
+		return res;
+	}
+
+	dir = DirHandle(d);
+	return FS_OK;
+}
+
+/*
+ * Enumerate layers from the top down, skipping entries already seen in a higher layer
+ */
+int FileSystem::readdir(DirHandle dir, Stat& stat)
+{
+	GET_FILEDIR()
+
+	while(d->layer >= 0) {
+		auto layer = uint8_t(d->layer);
+		// Directory needn't exist in lower layers
+		if(openLayerDir(*d, layer) == FS_OK) {
+			int res = layers[layer]->readdir(d->dirs[layer], stat);
+			if(res >= 0) {
+				if(layer == d->topLayer || !isShadowed(*d, stat.name, layer)) {
+					return res;
+				}
+				continue;
+			}
+			if(res != Error::NoMoreFiles) {
+				return res;
+			}
+		}
+		--d->layer;
+	}
+
+	return Error::NoMoreFiles;
+}
+
+int FileSystem::rewinddir(DirHandle dir)
+{
+	GET_FILEDIR()
+
+	for(unsigned i = 0; i < layerCount; ++i) {
+		if(d->dirs[i] != nullptr) {
+			int res = layers[i]->rewinddir(d->dirs[i]);
+			if(res < 0) {
+				return res;
+			}
+		}
+	}
+	d->layer = d->topLayer;
+	return FS_OK;
+}
+
+int FileSystem::telldir(DirHandle dir, DirCookie& cookie)
+{
+	GET_FILEDIR()
+
+	if(d->layer < 0) {
+		cookie = DirCookie(endOfListing) << cookieLayerShift;
+		return FS_OK;
+	}
+
+	auto layer = uint8_t(d->layer);
+	int res = openLayerDir(*d, layer);
+	if(res < 0) {
+		return res;
+	}
+	res = layers[layer]->telldir(d->dirs[layer], cookie);
+	if(res < 0) {
+		return res;
+	}
+	if(cookie > cookieMask) {
+		return Error::NotSupported;
+	}
+	cookie |= DirCookie(layer) << cookieLayerShift;
+	return FS_OK;
+}
+
+int FileSystem::seekdir(DirHandle dir, DirCookie cookie)
+{
+	GET_FILEDIR()
+
+	auto layer = uint8_t(cookie >> cookieLayerShift);
+	if(layer == endOfListing) {
+		d->layer = -1;
+		return FS_OK;
+	}
+	if(layer > d->topLayer) {
+		return Error::BadParam;
+	}
+
+	// Lower layers may already have been enumerated
+	for(unsigned i = 0; i < layer; ++i) {
+		if(d->dirs[i] != nullptr) {
+			layers[i]->rewinddir(d->dirs[i]);
+		}
+	}
+
+	d->layer = layer;
+	int res = openLayerDir(*d, layer);
+	if(res < 0) {
+		return res;
+	}
+	return layers[layer]->seekdir(d->dirs[layer], cookie & cookieMask);
+}
+
+int FileSystem::closedir(DirHandle dir)
+{
+	GET_FILEDIR()
+
+	for(unsigned i = 0; i < layerCount; ++i) {
+		if(d->dirs[i] != nullptr) {
+			layers[i]->closedir(d->dirs[i]);
+		}
+	}
+	delete d;
+
+	return FS_OK;
+}
+
+int FileSystem::stat(const char* path, Stat* stat)
+{
+	CHECK_MOUNTED()
+
+	int layer = findLayer(path, stat);
+	return (layer < 0) ? layer : FS_OK;
+}
+
+int FileSystem::statat(DirHandle dir, const char* name, Stat* stat)
+{
+	GET_FILEDIR()
+
+	FileNameBuffer path;
+	path.join(d->path.c_str());
+	path.join(name);
+	if(path.overflow()) {
+		return Error::NameTooLong;
+	}
+	return this->stat(path.c_str(), stat);
+}
+
+FileHandle FileSystem::open(const char* path, OpenFlags flags)
+{
+	CHECK_MOUNTED()
+
+	if(flags[OpenFlag::Write] || flags[OpenFlag::Create] || flags[OpenFlag::Truncate]) {
+		return Error::ReadOnly;
+	}
+
+	int index{-1};
+	for(unsigned i = 0; i < UNIONFS_MAX_FDS; ++i) {
+		if(fileDescs[i].fs == nullptr) {
+			index = i;
+			break;
+		}
+	}
+	if(index < 0) {
+		return Error::OutOfFileDescs;
+	}
+
+	// Root directory isn't in the index
+	int top = isRootPath(path) ? layerCount - 1 : findTopLayer(path);
+	if(top < 0) {
+		return top;
+	}
+
+	// Opening the file verifies the index entry
+	for(int layer = top; layer >= 0; --layer) {
+		auto fs = layers[layer];
+		FileHandle file = fs->open(path, flags);
+		if(file >= 0) {
+			fileDescs[index] = FileDesc{fs, file};
+			return UNIONFS_HANDLE_MIN + index;
+		}
+		if(file != Error::NotFound) {
+			return file;
+		}
+	}
+
+	return Error::NotFound;
+}
+
+FileHandle FileSystem::openat(DirHandle dir, const char* name, OpenFlags flags)
+{
+	GET_FILEDIR()
+
+	FileNameBuffer path;
+	path.join(d->path.c_str());
+	path.join(name);
+	if(path.overflow()) {
+		return Error::NameTooLong;
+	}
+	return open(path.c_str(), flags);
+}
+
+int FileSystem::close(FileHandle file)
+{
+	GET_FD(file)
+
+	int res = fd.fs->close(fd.handle);
+	fd = FileDesc{};
+	return res;
+}
+
+int FileSystem::fstat(FileHandle file, Stat* stat)
+{
+	GET_FD(file)
+	return fd.fs->fstat(fd.handle, stat);
+}
+
+int FileSystem::fcontrol(FileHandle file, ControlCode code, void* buffer, size_t bufSize)
+{
+	GET_FD(file)
+	return fd.fs->fcontrol(fd.handle, code, buffer, bufSize);
+}
+
+int FileSystem::read(FileHandle file, void* data, size_t size)
+{
+	GET_FD(file)
+	return fd.fs->read(fd.handle, data, size);
+}
+
+file_offset_t FileSystem::lseek(FileHandle file, file_offset_t offset, SeekOrigin origin)
+{
+	GET_FD(file)
+	return fd.fs->lseek(fd.handle, offset, origin);
+}
+
+int FileSystem::eof(FileHandle file)
+{
+	GET_FD(file)
+	return fd.fs->eof(fd.handle);
+}
+
+file_offset_t FileSystem::tell(FileHandle file)
+{
+	GET_FD(file)
+	return fd.fs->tell(fd.handle);
+}
+
+int FileSystem::fgetxattr(FileHandle file, AttributeTag tag, void* buffer, size_t size)
+{
+	GET_FD(file)
+	return fd.fs->fgetxattr(fd.handle, tag, buffer, size);
+}
+
+int FileSystem::fenumxattr(FileHandle file, AttributeEnumCallback callback, void* buffer, size_t bufsize)
+{
+	GET_FD(file)
+	return fd.fs->fenumxattr(fd.handle, callback, buffer, bufsize);
+}
+
+int FileSystem::getxattr(const char* path, AttributeTag tag, void* buffer, size_t size)
+{
+	CHECK_MOUNTED()
+
+	int layer = findLayer(path, nullptr);
+	if(layer < 0) {
+		return layer;
+	}
+	return layers[layer]->getxattr(path, tag, buffer, size);
+}
+
+int FileSystem::fgetextents(FileHandle file, Storage::Partition* part, Extent* list, uint16_t extcount)
+{
+	GET_FD(file)
+	return fd.fs->fgetextents(fd.handle, part, list, extcount);
+}
+
+int FileSystem::check()
+{
+	for(unsigned i = 0; i < layerCount; ++i) {
+		// Layers may not support checking, or not have a checksum
+		int res = layers[i]->check();
+		if(res < 0 && res != Error::NotImplemented && res != Error::NotSupported) {
+			return res;
+		}
+	}
+	return FS_OK;
+}
+
+} // namespace IFS::Union
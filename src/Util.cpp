@@ -38,6 +38,11 @@ bool isRootPath(const char*& path)
 	return false;
 }
 
+bool isRootPath(PathView& path)
+{
+	return path.trimRoot();
+}
+
 void checkStat(Stat& stat)
 {
 	stat.attr[FileAttribute::Compressed] = (stat.compression.type != Compression::Type::None);
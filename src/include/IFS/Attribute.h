@@ -90,6 +90,16 @@ inline AttributeTag getUserAttributeTag(uint8_t value)
 
 size_t getAttributeSize(AttributeTag tag);
 
+/**
+ * @brief Get name of attribute tag without using the heap
+ * @param tag
+ * @param buffer Buffer to receive nul-terminated name
+ * @param bufSize Size of buffer
+ * @retval size_t Length of name, 0 if tag is invalid or buffer too small
+ * @note Names are as returned by `toString(AttributeTag)`
+ */
+size_t getAttributeName(AttributeTag tag, char* buffer, size_t bufSize);
+
 } // namespace IFS
 
 String toString(IFS::AttributeTag tag);
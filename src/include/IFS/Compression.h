@@ -30,7 +30,8 @@ namespace IFS
  */
 #define IFS_COMPRESSION_TYPE_MAP(XX)                                                                                   \
 	XX(None, "Normal file, no compression")                                                                            \
-	XX(GZip, "GZIP compressed for serving via HTTP")
+	XX(GZip, "GZIP compressed for serving via HTTP")                                                                   \
+	XX(LZ4, "LZ4 compressed blocks, see FWFS::Lz4Encoder")
 
 /**
  * @brief A compression descriptor
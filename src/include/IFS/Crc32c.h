@@ -0,0 +1,38 @@
+/****
+ * Crc32c.h
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace IFS
+{
+/**
+ * @brief Calculate CRC32C (Castagnoli) checksum
+ * @param data Data to process
+ * @param length Number of bytes
+ * @param crc Result of previous call when processing data in several parts
+ * @retval uint32_t Checksum
+ *
+ * Produces the same values as `crc32c` in python, or `CRC-32C` as used by iSCSI, ext4, etc.
+ */
+uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0);
+
+} // namespace IFS
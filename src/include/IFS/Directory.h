@@ -58,6 +58,22 @@ public:
 	 */
 	bool rewind();
 
+	/**
+	 * @brief Get current read position
+	 * @param cookie OUT: Position of next entry
+	 * @retval bool true on success, false on error
+	 * @see IFileSystem::telldir()
+	 */
+	bool tell(DirCookie& cookie);
+
+	/**
+	 * @brief Set read position
+	 * @param cookie Value obtained from `tell()`
+	 * @retval bool true on success, false on error
+	 * @note `index()`, `count()` and `size()` are reset and are relative to the new position
+	 */
+	bool seek(DirCookie cookie);
+
 	/**
 	 * @brief Name of directory stream is attached to
 	 * @retval String invalid if stream isn't open
@@ -114,6 +130,24 @@ public:
 
 	bool next();
 
+	/**
+	 * @brief Open a file in this directory
+	 * @param name Name of file, such as `stat().name`
+	 * @param flags
+	 * @retval FileHandle
+	 * @note If the filesystem doesn't support `openat()` then the full path is used
+	 */
+	FileHandle openat(const char* name, OpenFlags flags = OpenFlag::Read);
+
+	/**
+	 * @brief Get information for a file in this directory
+	 * @param name Name of file, such as `stat().name`
+	 * @param stat
+	 * @retval bool true on success
+	 * @note If the filesystem doesn't support `statat()` then the full path is used
+	 */
+	bool statat(const char* name, Stat& stat);
+
 private:
 	String name;
 	DirHandle dir{};
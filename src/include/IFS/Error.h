@@ -77,7 +77,8 @@ namespace Error
 	XX(OutOfFileDescs, "Cannot open another file until one is closed")                                                 \
 	XX(Denied, "Operation denied")                                                                                     \
 	XX(NoSpace, "No free space")                                                                                       \
-	XX(TooBig, "File size too big")
+	XX(TooBig, "File size too big")                                                                                    \
+	XX(BadChecksum, "Checksum verification failed")
 
 enum class Value {
 #define XX(tag, text) tag,
@@ -0,0 +1,196 @@
+/****
+ * ArchiveRestoreStream.h
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include <IFS/FileSystem.h>
+#include <IFS/FsBase.h>
+#include "ArchiveStream.h"
+#include <Data/Stream/ReadWriteStream.h>
+#include <WVector.h>
+#include <memory>
+
+// Directory where content is held until its location is known, relative to the restore path
+#ifndef FWFS_RESTORE_STAGE_DIR
+#define FWFS_RESTORE_STAGE_DIR ".restore"
+#endif
+
+// Number of recently restored files remembered so deduplicated content can be copied.
+// Must be at least the number of entries ArchiveStream uses for deduplication.
+#ifndef FWFS_RESTORE_CONTENT_ENTRIES
+#define FWFS_RESTORE_CONTENT_ENTRIES FWFS_DEDUP_ENTRIES
+#endif
+
+static_assert(FWFS_RESTORE_CONTENT_ENTRIES >= FWFS_DEDUP_ENTRIES,
+			  "FWFS_RESTORE_CONTENT_ENTRIES too small to restore deduplicated archives");
+
+namespace IFS::FWFS
+{
+/**
+ * @brief Restores an FWFS image, such as produced by `ArchiveStream`, directly to a filesystem
+ *
+ * Write the image to this stream as it arrives, for example from a network connection.
+ * No temporary copy of the image is required.
+ *
+ * Objects in an image are written children first, so the name of a file is only known once its
+ * content has been received, and its directory only once all the directory content has been received.
+ * File content is therefore written to a staging directory, named by object ID.
+ * As each directory object arrives the staged entries it refers to are moved into it,
+ * and when the volume object arrives the content of the root directory is moved to the restore path.
+ * The target filesystem must support renaming of both files and directories.
+ *
+ * RAM usage is limited to the names of entries whose directory has not yet been received,
+ * the staged location of recent files for deduplicated content, plus one object header. As with `ArchiveStream`, this is proportional to the size of the
+ * largest directory.
+ *
+ * Data checksums and the image checksum are verified if present.
+ * Mountpoints are not restored. Differential archives cannot be restored as their
+ * base content is unavailable.
+ *
+ * @note The restore path should be empty or not exist. On failure, partially restored content
+ * is left in the staging directory.
+ */
+class ArchiveRestoreStream : public FsBase, public ReadWriteStream
+{
+public:
+	/**
+	 * @brief Construct a restore stream
+	 * @param fileSystem The filesystem to write to
+	 * @param rootPath Where to restore the image content
+	 */
+	ArchiveRestoreStream(FileSystem* fileSystem, const String& rootPath = nullptr);
+
+	~ArchiveRestoreStream();
+
+	size_t write(const uint8_t* data, size_t size) override;
+
+	using ReadWriteStream::write;
+
+	uint16_t readMemoryBlock(char*, int) override
+	{
+		return 0;
+	}
+
+	bool isFinished() override
+	{
+		return state >= State::done;
+	}
+
+	/**
+	 * @brief Determine if the image has been completely and successfully restored
+	 */
+	bool isSuccess() const
+	{
+		return state == State::done;
+	}
+
+	/**
+	 * @brief Get number of files restored so far
+	 */
+	unsigned getFileCount() const
+	{
+		return fileCount;
+	}
+
+	/**
+	 * @brief Get number of directories restored so far
+	 */
+	unsigned getDirectoryCount() const
+	{
+		return dirCount;
+	}
+
+private:
+	enum class State {
+		startMarker, ///< Expecting start marker
+		header,		 ///< Expecting object header
+		content,	 ///< Expecting object content
+		endMarker,	 ///< Expecting end marker
+		done,		 ///< Finished successfully
+		error,		 ///< Unsuccessful
+	};
+
+	/**
+	 * @brief File or directory waiting for its parent directory
+	 */
+	struct Entry {
+		Object::ID id;		///< Object ID
+		Object::ID stageId; ///< Name of entry in staging directory
+		CString name;
+	};
+
+	/**
+	 * @brief Data object in the current staged file
+	 */
+	struct DataInfo {
+		Object::ID id;
+		uint32_t crc; ///< CRC32C of object content
+	};
+
+	/**
+	 * @brief Where content of a recently restored file can be found
+	 */
+	struct ContentEntry {
+		Object::ID dataId; ///< First data object in file
+		String path;	   ///< Location relative to staging directory
+	};
+
+	using ChildCallback = Delegate<int(const Object& child, const uint8_t* content)>;
+	using AttributeCallback = Delegate<int(AttributeTag tag, const void* data, size_t size)>;
+
+	size_t consume(const uint8_t* data, size_t size);
+	int createStageDirectory();
+	int startObject();
+	int writeData(const void* data, size_t size);
+	int finishObject();
+	int restoreFile();
+	int restoreDirectory();
+	int restoreVolume();
+	int createStagedFile(Object::ID stageId);
+	int copyContent(Object::ID dataId);
+	int forEachChild(ChildCallback callback);
+	int setAttributes(AttributeCallback callback);
+	void addEntry(Object::ID stageId);
+	int findEntry(Object::ID id);
+	void moveContentEntries(const String& oldPath, const String& newPath);
+	String getStagePath(Object::ID id) const;
+	int fail(int err);
+
+	String rootPath;
+	String stagePath;
+	Object header{};
+	uint8_t headerSize{0};	///< Amount of header received
+	uint32_t objectOffset{0}; ///< Position of current object in image
+	uint32_t contentPos{0};   ///< Amount of object content received
+	std::unique_ptr<uint8_t[]> content;
+	Vector<Entry> entries;
+	Vector<DataInfo> pendingData;
+	FileHandle dataFile{-1};
+	Object::ID stageId{0}; ///< Name of staged file
+	ContentEntry contentEntries[FWFS_RESTORE_CONTENT_ENTRIES];
+	uint16_t contentNext{0}; ///< Entry to replace
+	uint32_t checksum{0};   ///< CRC32C of image content received
+	unsigned fileCount{0};
+	unsigned dirCount{0};
+	bool endFound{false}; ///< Checksum is complete
+	bool volumeRestored{false};
+	State state{};
+};
+
+} // namespace IFS::FWFS
@@ -24,6 +24,45 @@
 #include "ObjectBuffer.h"
 #include "BlockEncoder.h"
 
+// Number of files remembered for deduplication, 16 bytes each
+#ifndef FWFS_DEDUP_ENTRIES
+#define FWFS_DEDUP_ENTRIES 64
+#endif
+
+// Size of each of the two buffers used for reading file data with Flag::ReadAhead
+#ifndef FWFS_READAHEAD_SIZE
+#define FWFS_READAHEAD_SIZE 4096
+#endif
+
+// Minimum amount of output between checkpoints recorded with Flag::Checkpoints
+#ifndef FWFS_CHECKPOINT_INTERVAL
+#define FWFS_CHECKPOINT_INTERVAL 32768
+#endif
+
+// Number of checkpoints retained
+#ifndef FWFS_CHECKPOINT_COUNT
+#define FWFS_CHECKPOINT_COUNT 4
+#endif
+
+// Directory child tables larger than this are moved to a scratch file, if one has been set
+#ifndef FWFS_SCRATCH_THRESHOLD
+#define FWFS_SCRATCH_THRESHOLD 512
+#endif
+
+// Initial size of object buffers, see ArchiveStream::setBufferSize()
+#ifndef FWFS_ARCHIVE_BUFFER_SIZE
+#define FWFS_ARCHIVE_BUFFER_SIZE 0
+#endif
+
+// Size of buffer used by ArchiveStream::writeTo()
+#ifndef FWFS_WRITE_BUFFER_SIZE
+#ifdef ARCH_HOST
+#define FWFS_WRITE_BUFFER_SIZE 65536
+#else
+#define FWFS_WRITE_BUFFER_SIZE 4096
+#endif
+#endif
+
 namespace IFS::FWFS
 {
 /**
@@ -52,9 +91,14 @@ class ArchiveStream : public FsBase, public IDataSourceStream
 public:
 	enum class Flag {
 		IncludeMountPoints, ///< Set to include mountpoints in archive
+		DataChecksums,		///< Add checksum for each data object, verified when first read
+		Deduplicate,		///< Store identical file content once, see `getDedupCount()`
+		ReadAhead,			///< Read file data in advance using `ReadAheadStream`
+		Checkpoints,		///< Record checkpoints so output can be resumed, see `getCheckpoint()`
+		Compress,			///< Compress file content using `Lz4Encoder` where no other encoder is provided
 	};
 
-	using Flags = BitSet<uint8_t, Flag, 1>;
+	using Flags = BitSet<uint8_t, Flag, 6>;
 
 	struct VolumeInfo {
 		String name;			   ///< Volume Name
@@ -117,6 +161,19 @@ public:
 		DirInfo& dir;
 	};
 
+	/**
+	 * @brief Archiver state at a file or directory boundary, from which output can be resumed
+	 */
+	struct Checkpoint {
+		uint32_t offset{0}; ///< Position in output stream
+		String data;		///< Saved state, content is private to the archiver
+
+		explicit operator bool() const
+		{
+			return data.length() != 0;
+		}
+	};
+
 	using FilterStatCallback = Delegate<bool(const Stat& stat)>;
 	using CreateEncoderCallback = Delegate<IBlockEncoder*(FileInfo& file)>;
 
@@ -129,7 +186,8 @@ public:
 	 */
 	ArchiveStream(FileSystem* fileSystem, const VolumeInfo& volumeInfo, const String& rootPath = nullptr,
 				  Flags flags = 0)
-		: FsBase(fileSystem), currentPath(rootPath), volumeInfo(volumeInfo), flags(flags)
+		: FsBase(fileSystem), currentPath(rootPath), rootPathLength(rootPath.length()), volumeInfo(volumeInfo),
+		  flags(flags)
 	{
 	}
 
@@ -183,6 +241,13 @@ public:
 
 	uint16_t readMemoryBlock(char* data, int bufSize) override;
 
+	/**
+	 * @brief Change read position
+	 *
+	 * Seeking from current position is limited to the object being output.
+	 * Seeking from start continues from the closest checkpoint before the requested position,
+	 * or from the beginning if there is none, reading and discarding any intervening output.
+	 */
 	int seekFrom(int offset, SeekOrigin origin) override;
 
 	bool isFinished() override
@@ -200,8 +265,152 @@ public:
 		return state == State::done;
 	}
 
+	/**
+	 * @brief Write remainder of archive to a stream
+	 * @param out Where to write output, such as a `ReadWriteStream`
+	 * @param bufferSize Size of buffer to allocate for the duration of the call
+	 * @retval int Number of bytes written, or negative error code
+	 *
+	 * This is more efficient than reading the archive via `readMemoryBlock()` as output is produced
+	 * in blocks of `bufferSize`, without the 16-bit limit on block size. File content is read
+	 * straight into the buffer rather than via an intermediate stream, except where an encoder
+	 * or `Flag::ReadAhead` is in use.
+	 *
+	 * Output continues from the current position. On failure the stream may be repositioned
+	 * (for example, using a checkpoint) and output continued.
+	 */
+	int writeTo(Print& out, size_t bufferSize = FWFS_WRITE_BUFFER_SIZE);
+
+	/**
+	 * @brief Write remainder of archive to a file
+	 * @param fileSystem
+	 * @param file Handle to file open for writing
+	 * @param bufferSize
+	 * @retval int Number of bytes written, or negative error code
+	 * @see See `writeTo(Print&, size_t)`
+	 */
+	int writeTo(IFileSystem& fileSystem, FileHandle file, size_t bufferSize = FWFS_WRITE_BUFFER_SIZE);
+
+	/**
+	 * @brief Get number of files stored as a reference to identical content archived earlier
+	 *
+	 * With `Flag::Deduplicate` set, content of each file which isn't stored inline or encoded
+	 * is hashed as it's archived. The most recent `FWFS_DEDUP_ENTRIES` hashes are retained.
+	 * A file is only read in advance if one of these has the same size.
+	 */
+	unsigned getDedupCount() const
+	{
+		return dedupCount;
+	}
+
+	/**
+	 * @brief Get total size of file content omitted by deduplication
+	 */
+	uint32_t getDedupSize() const
+	{
+		return dedupSize;
+	}
+
+	/**
+	 * @brief Create a differential archive
+	 * @param fileSystem Previous archive of the same tree, typically a mounted FWFS image.
+	 * Must remain valid whilst the archive is being read.
+	 *
+	 * Files found at the same path in the base with identical size and modification time are
+	 * assumed to be unchanged, so their content is stored as a reference to the base file.
+	 * Attributes are always taken from the file being archived.
+	 *
+	 * To read files from the archive the same base must be provided via `FWFS::FileSystem::setBase()`.
+	 */
+	void setBase(IFileSystem* fileSystem)
+	{
+		base = fileSystem;
+	}
+
+	/**
+	 * @brief Get number of files stored as a reference to the base archive
+	 */
+	unsigned getBaseCount() const
+	{
+		return baseCount;
+	}
+
+	/**
+	 * @brief Get total size of file content held in the base archive
+	 */
+	uint32_t getBaseSize() const
+	{
+		return baseSize;
+	}
+
+	/**
+	 * @brief Set location for large directory child tables
+	 * @param fileSystem Writeable filesystem to use, may be the one being archived
+	 * @param path Prefix for scratch file names, the directory nesting level is appended.
+	 * Must be outside the tree being archived.
+	 *
+	 * The child table for each open directory is normally held in RAM until the directory object is output.
+	 * Once a table exceeds `FWFS_SCRATCH_THRESHOLD` bytes it is moved to a scratch file and later output from there.
+	 * Scratch files are removed when the stream is reset or destroyed.
+	 *
+	 * @note Checkpoints are not recorded whilst any table is held in a scratch file.
+	 */
+	void setScratch(FileSystem* fileSystem, const String& path)
+	{
+		scratchFs = fileSystem;
+		scratchPath = path;
+	}
+
+	/**
+	 * @brief Set initial size of object buffers
+	 * @param size Bytes to allocate for each buffer when first used
+	 *
+	 * Each directory level has a buffer for building file and directory objects. These are kept for the
+	 * duration of the archive and grow as required. Setting a size sufficient for the largest objects
+	 * (see `getPeakMemoryUsage()`) avoids reallocation and so reduces heap fragmentation.
+	 */
+	void setBufferSize(size_t size)
+	{
+		bufferSize = size;
+	}
+
+	/**
+	 * @brief Get largest amount of RAM used for the directory stack, object buffers and current path
+	 *
+	 * This depends on the depth of the tree and the size of its largest directories, so use it to
+	 * determine heap requirements. Fixed allocations such as the deduplication table, read-ahead
+	 * buffers and encoders are not included.
+	 */
+	size_t getPeakMemoryUsage() const
+	{
+		return peakMemoryUsage;
+	}
+
+	/**
+	 * @brief Get most recent checkpoint at or before a given output position
+	 * @param offset Position in output stream
+	 * @retval const Checkpoint* nullptr if there isn't one
+	 *
+	 * With `Flag::Checkpoints` set, a checkpoint is recorded at the first file or directory boundary
+	 * after each `FWFS_CHECKPOINT_INTERVAL` bytes of output, and the most recent `FWFS_CHECKPOINT_COUNT`
+	 * are retained. Each holds the directory stack, including child tables built so far, and the
+	 * deduplication table if in use. No file content is stored.
+	 */
+	const Checkpoint* getCheckpoint(uint32_t offset) const;
+
+	/**
+	 * @brief Continue output from a checkpoint
+	 * @param checkpoint Obtained from this stream, or another created with identical parameters
+	 * @retval bool false if state could not be restored, in which case the stream is in error
+	 *
+	 * Output continues from `checkpoint.offset` and is identical to that originally produced,
+	 * provided the filesystem has not changed and any encoders produce the same output.
+	 */
+	bool resume(const Checkpoint& checkpoint);
+
 	/**
 	 * @brief Reset stream to beginning
+	 * @note Discards any checkpoints
 	 */
 	void reset();
 
@@ -220,53 +429,123 @@ private:
 	};
 
 	struct DirInfo {
-		DirHandle handle;
-		std::unique_ptr<ObjectBuffer> content; // Directory or object content
-		Object::Type type;					   // Differentiate between e.g. Directory and MountPoint
-		uint8_t namelen;					   // Used to track current path
+		DirHandle handle{};
+		std::unique_ptr<ObjectBuffer> content;				// Directory or object content
+		std::unique_ptr<IDataSourceStream> scratchStream; // Directory content, if held in scratch file
+		FileHandle scratchFile{-1};							// Scratch file being written
+		uint32_t scratchSize{0};							// Amount of content in scratch file
+		Object::Type type{};								// Differentiate between e.g. Directory and MountPoint
+		uint8_t namelen{0};									// Used to track current path
 
 		void reset()
 		{
 			assert(handle == nullptr);
+			assert(scratchFile < 0);
 			namelen = 0;
 			handle = nullptr;
-			content.reset();
+			if(content) {
+				content->clear();
+			}
+			scratchStream.reset();
+			scratchSize = 0;
 		}
 
-		void createContent()
+		/**
+		 * @brief Prepare to build a new object, re-using existing buffer if there is one
+		 */
+		void createContent(size_t bufferSize)
 		{
-			content = std::make_unique<ObjectBuffer>();
+			if(content) {
+				content->clear();
+			} else {
+				content = std::make_unique<ObjectBuffer>(bufferSize);
+			}
 		}
 
 		int addAttribute(AttributeTag tag, const void* data, size_t size);
 	};
 
+	struct DedupEntry {
+		uint32_t size;
+		uint32_t crc;	  ///< CRC32C of content
+		uint32_t hash;	 ///< FNV-1a of content
+		Object::ID dataId; ///< Data object containing the content
+	};
+
+	using WriteCallback = Delegate<int(const void* data, size_t size)>;
+
+	int pump(WriteCallback callback, size_t bufferSize);
 	bool fillBuffers();
 	void queueStream(IDataSourceStream* stream, State newState);
 	bool openRootDirectory();
-	void openDirectory(const Stat& stat);
+	bool reserveLevels(unsigned count);
+	bool openDirectory(const Stat& stat);
 	bool readDirectory();
 	bool readFileEntry(const Stat& stat);
+	FileHandle openEntry(const char* name, OpenFlags flags);
 	void sendDataHeader();
 	void sendDataContent();
 	void sendFileHeader();
 	int getAttributes(FileHandle file, DirInfo& entry);
+	void addChild(unsigned parentLevel, Object::Type type, Object::ID objId);
+	bool writeScratch(unsigned dirLevel);
+	bool closeScratch(unsigned dirLevel);
+	String getScratchPath(unsigned dirLevel) const
+	{
+		return scratchPath + String(dirLevel);
+	}
 	void closeDirectory();
 	void getVolume();
+	void updateChecksum(const char* data, size_t length)
+	{
+		updateChecksum(getStreamPosition(), data, length);
+	}
+	void updateChecksum(uint32_t pos, const char* data, size_t length);
+	bool findBaseFile(const Stat& stat);
+	bool findDuplicate(const Stat& stat);
+	void addDedupEntry();
+	uint32_t getStreamPosition();
+	bool skipTo(uint32_t offset);
+	void release();
+	void saveCheckpoint();
+	void updatePeakMemoryUsage();
 
 	String currentPath;
+	uint16_t rootPathLength; ///< currentPath is truncated to this length on reset
 	VolumeInfo volumeInfo;
 	FilterStatCallback filterStatCallback;
 	CreateEncoderCallback createEncoderCallback;
 	ObjectBuffer buffer;
 	std::unique_ptr<IBlockEncoder> encoder;
 	IDataSourceStream* dataBlock{nullptr};
+	FileHandle dataFile{-1}; ///< File being output without encoding, read directly by writeTo()
 	IDataSourceStream* source{nullptr};
-	unsigned level{0}; ///< Directory nesting level
-	static constexpr size_t maxLevels{16};
-	DirInfo directories[maxLevels]{};
+	unsigned level{0};		///< Directory nesting level
+	unsigned maxLevels{0};	///< Number of entries allocated in directories
+	std::unique_ptr<DirInfo[]> directories; ///< Open directories, followed by current file
 	uint32_t streamOffset{0}; ///< Current object ID
 	uint32_t queuedSize{0};
+	uint32_t checksum{0};		///< CRC32C of data read so far
+	uint32_t checksumOffset{0}; ///< Position in stream up to which checksum has been calculated
+	uint32_t dataChecksum{0};	///< CRC32C of current data object
+	std::unique_ptr<DedupEntry[]> dedupTable;
+	DedupEntry dedupPending{};	///< Hash of file content being archived, size is 0 if none
+	bool dedupStreaming{false}; ///< dedupPending is calculated as content is output
+	uint16_t dedupUsed{0};		///< Number of table entries in use
+	uint16_t dedupNext{0};		///< Entry to replace when table is full
+	unsigned dedupCount{0};
+	uint32_t dedupSize{0};
+	IFileSystem* base{nullptr};
+	unsigned baseCount{0};
+	uint32_t baseSize{0};
+	std::unique_ptr<Checkpoint[]> checkpoints;
+	uint32_t checkpointOffset{0}; ///< Position of most recent checkpoint
+	uint8_t checkpointNext{0};	///< Entry to replace
+	FileSystem* scratchFs{nullptr};
+	String scratchPath;
+	unsigned scratchLevels{0}; ///< Scratch files created for levels below this
+	size_t peakMemoryUsage{0};
+	size_t bufferSize{FWFS_ARCHIVE_BUFFER_SIZE};
 	Flags flags{};
 	State state{};
 };
@@ -42,6 +42,19 @@ namespace IFS::FWFS
 #define FWFS_MAX_VOLUMES 4
 #endif
 
+// Buffer used to read image when verifying checksum
+#ifndef FWFS_CHECK_BUFFER_SIZE
+#define FWFS_CHECK_BUFFER_SIZE 4096
+#endif
+
+/*
+ * Verified data objects are tracked using one bit per granule of image space.
+ * Smaller objects could share a granule so are instead remembered by the file descriptor.
+ */
+#ifndef FWFS_VERIFY_GRANULE
+#define FWFS_VERIFY_GRANULE 64
+#endif
+
 // Maximum file handle value
 #define FWFS_HANDLE_MAX (FWFS_HANDLE_MIN + FWFS_MAX_FDS - 1)
 
@@ -64,6 +77,9 @@ struct FWFileDesc {
 			};
 		};
 	};
+	FileHandle baseFile{-1}; ///< Open file in base filesystem for BaseData content
+	uint32_t baseFileId{0};	 ///< Identifies baseFile
+	FileID verifiedData{0};	 ///< Most recent data object smaller than FWFS_VERIFY_GRANULE verified
 
 	bool isAllocated() const
 	{
@@ -104,11 +120,17 @@ public:
 	String getErrorString(int err) override;
 	int setVolume(uint8_t index, IFileSystem* fileSystem) override;
 	int opendir(const char* path, DirHandle& dir) override;
+	int opendir(PathView path, DirHandle& dir) override;
 	int readdir(DirHandle dir, Stat& stat) override;
 	int rewinddir(DirHandle dir) override;
+	int telldir(DirHandle dir, DirCookie& cookie) override;
+	int seekdir(DirHandle dir, DirCookie cookie) override;
 	int closedir(DirHandle dir) override;
 	int mkdir(const char* path) override;
 	int stat(const char* path, Stat* stat) override;
+	int stat(PathView path, Stat* stat) override;
+	int statById(FileID id, Stat* stat) override;
+	int statat(DirHandle dir, const char* name, Stat* stat) override;
 	int fstat(FileHandle file, Stat* stat) override;
 	int fcontrol(FileHandle file, ControlCode code, void* buffer, size_t bufSize) override;
 	int fsetxattr(FileHandle file, AttributeTag tag, const void* data, size_t size) override;
@@ -117,6 +139,9 @@ public:
 	int setxattr(const char* path, AttributeTag tag, const void* data, size_t size) override;
 	int getxattr(const char* path, AttributeTag tag, void* buffer, size_t size) override;
 	FileHandle open(const char* path, OpenFlags flags) override;
+	FileHandle open(PathView path, OpenFlags flags) override;
+	FileHandle openById(FileID id, OpenFlags flags) override;
+	FileHandle openat(DirHandle dir, const char* name, OpenFlags flags) override;
 	int close(FileHandle file) override;
 	int read(FileHandle file, void* data, size_t size) override;
 	int write(FileHandle file, const void* data, size_t size) override;
@@ -133,17 +158,67 @@ public:
 	{
 		return Error::ReadOnly;
 	}
-	int check() override
+	/**
+	 * @brief Verify image checksum
+	 * @retval int error code
+	 * @note Returns Error::NotSupported if the image doesn't contain a checksum
+	 *
+	 * The entire image is read, so for large images this can take some time:
+	 * the `Performance` test module reports throughput for the target device.
+	 */
+	int check() override;
+
+	/**
+	 * @brief Set filesystem holding content for a differential image
+	 * @param fileSystem Mounted base filesystem, typically the FWFS image the archive was created against.
+	 * Ownership is not transferred: it must remain valid until this filesystem is destroyed.
+	 *
+	 * Differential images created by `ArchiveStream::setBase()` contain `BaseData` objects in place
+	 * of unchanged file content. These are resolved by opening the corresponding file in the base.
+	 * Without a base filesystem, reading such files fails with `Error::NoFileSystem`.
+	 */
+	void setBase(IFileSystem* fileSystem)
 	{
-		/* We could implement this, but since problems would indicate corrupted firmware
-    	 * there isn't much we can do other than suggest a re-flashing. This sort of issue
-    	 * is better resolved externally using a hash of the entire firmware image. */
-		return Error::NotImplemented;
+		base = fileSystem;
 	}
 
 private:
 	int getMd5Hash(FWFileDesc& fd, void* buffer, size_t bufSize);
 
+	/**
+	 * @brief Verify content of a data object against its checksum, if present
+	 * @param fd The open file
+	 * @param child Reference to data object, relative to file
+	 * @param odData The resolved data object
+	 * @retval int error code
+	 *
+	 * A checksum is optional and, if present, is stored in the child object following the data.
+	 * Objects are verified the first time they are read and the result remembered.
+	 */
+	int verifyData(FWFileDesc& fd, const FWObjDesc& child, const FWObjDesc& odData);
+
+	/**
+	 * @brief Read content of a BaseData object
+	 * @param parent The file object
+	 * @param child The BaseData object, relative to parent
+	 * @param info OUT: The identifier, size and modification time of file content in base image
+	 * @retval int error code
+	 */
+	int readBaseInfo(const FWObjDesc& parent, const FWObjDesc& child, BaseDataInfo& info);
+
+	/**
+	 * @brief Read file content from base filesystem
+	 * @param fd Descriptor caching the open base file
+	 * @param info Identifies the base file
+	 * @param offset Location within base file
+	 * @param size Number of bytes to read
+	 * @param buffer
+	 * @retval int error code
+	 *
+	 * The base file is opened and checked against `info` on first access, then kept open until `fd` is closed.
+	 */
+	int readBaseData(FWFileDesc& fd, const BaseDataInfo& info, uint32_t offset, uint32_t size, void* buffer);
+
 	bool isMounted()
 	{
 		return flags[Flag::mounted];
@@ -196,6 +271,25 @@ private:
 	int findChildObject(const FWObjDesc& parent, FWObjDesc& child, const char* name, unsigned namelen);
 	int findObject(Object::ID objId, FWObjDesc& od);
 
+	/**
+	 * @brief Locate a named object using its identifier (as returned in Stat::id)
+	 * @param id Offset of the object within the image
+	 * @param od Located object
+	 * @retval int error code
+	 *
+	 * The identifier is validated to ensure it refers to a file, directory or mountpoint.
+	 */
+	int findNamedObject(FileID id, FWObjDesc& od);
+
+	/**
+	 * @brief Allocate a descriptor for a located object
+	 * @param od The object to open
+	 * @param path Remaining path, passed to mounted filesystem if object is a mountpoint
+	 * @param flags
+	 * @retval FileHandle
+	 */
+	FileHandle openObject(const FWObjDesc& od, PathView path, OpenFlags flags);
+
 	/**
 	 * @brief Parse a file path to locate the corresponding object
 	 * @param path Path to parse. If a mountpoint is located this returns remainder of path
@@ -203,8 +297,16 @@ private:
 	 * 
 	 * Parsing stops if a mountpoint is found.
 	 */
+	int findObjectByPath(PathView& path, FWObjDesc& od);
 	int findObjectByPath(const char*& path, FWObjDesc& od);
 
+	/**
+	 * @brief Parse a path relative to a directory object
+	 * @param path Path to parse. If a mountpoint is located this returns remainder of path
+	 * @param od IN: Directory to start from, OUT: Located object
+	 */
+	int findRelativeObject(PathView& path, FWObjDesc& od);
+
 	/**
 	 * @brief Resolve a mountpoint object to mounted filesystem
 	 * @param odMountPoint The mountpoint object to resolve
@@ -248,6 +350,10 @@ protected:
 	FWFileDesc fileDescriptors[FWFS_MAX_FDS];
 	FWObjDesc odRoot; ///< Reference to root directory object
 	Object::ID volume;
+	Object::ID endObject; ///< Location of End object, marks limit of object space
+	uint32_t checksum{0}; ///< CRC32C stored in End object, 0 if absent
+	std::unique_ptr<uint8_t[]> verified; ///< Bitmap of verified data objects, allocated on demand
+	IFileSystem* base{nullptr}; ///< Provides content for BaseData objects
 	ACL rootACL{};
 	BitSet<uint8_t, Flag> flags;
 };
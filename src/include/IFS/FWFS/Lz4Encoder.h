@@ -0,0 +1,182 @@
+/****
+ * Lz4Encoder.h
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "ArchiveStream.h"
+#include <Data/Stream/LimitedMemoryStream.h>
+
+// Amount of file data compressed in each block, maximum 65535
+#ifndef FWFS_LZ4_BLOCK_SIZE
+#define FWFS_LZ4_BLOCK_SIZE 4096
+#endif
+
+// Size of compressor hash table is (2 << FWFS_LZ4_HASH_BITS) bytes
+#ifndef FWFS_LZ4_HASH_BITS
+#define FWFS_LZ4_HASH_BITS 10
+#endif
+
+// Files smaller than this are not worth compressing
+#ifndef FWFS_LZ4_MIN_SIZE
+#define FWFS_LZ4_MIN_SIZE 128
+#endif
+
+namespace IFS::FWFS
+{
+/**
+ * @brief Raw LZ4 block compression
+ *
+ * Output is in standard LZ4 block format, without any framing.
+ */
+namespace LZ4
+{
+/**
+ * @brief Each compressed block of file content starts with this header
+ *
+ * If sizes are equal then the block could not be compressed and is stored as-is.
+ */
+struct BlockHeader {
+	uint16_t compressedSize; ///< Size of block data which follows
+	uint16_t originalSize;	 ///< Size of data after decompression
+};
+
+/**
+ * @brief Get maximum compressed size for a given amount of data
+ */
+constexpr size_t compressBound(size_t size)
+{
+	return size + (size / 255) + 16;
+}
+
+/**
+ * @brief Compress a single block of data
+ * @param src Data to compress, maximum 65535 bytes
+ * @param srcSize
+ * @param dst Buffer for compressed data
+ * @param dstSize Space available in buffer
+ * @param hashTable Working storage of `1 << FWFS_LZ4_HASH_BITS` entries
+ * @retval int Size of compressed data, or Error::BufferTooSmall if data didn't compress
+ */
+int compress(const void* src, size_t srcSize, void* dst, size_t dstSize, uint16_t* hashTable);
+
+/**
+ * @brief Decompress a single block of data
+ * @param src Compressed data
+ * @param srcSize
+ * @param dst Buffer for decompressed data
+ * @param dstSize Space available in buffer
+ * @retval int Size of decompressed data, or Error::BadObject if data is malformed
+ */
+int decompress(const void* src, size_t srcSize, void* dst, size_t dstSize);
+
+} // namespace LZ4
+
+/**
+ * @brief Compresses file content in blocks using LZ4
+ *
+ * Each block is written as a separate data object containing an `LZ4::BlockHeader`
+ * followed by the block data, so file content can be decompressed as a stream using `Lz4Decoder`.
+ * The file gets `Compression::Type::LZ4` and the original size as its compression attribute.
+ *
+ * Use via `ArchiveStream::Flag::Compress`, or from a custom `ArchiveStream::createEncoder()`.
+ */
+class Lz4Encoder : public IBlockEncoder
+{
+public:
+	/**
+	 * @brief Create an encoder for the given file, if appropriate
+	 * @param file The file being archived
+	 * @retval IBlockEncoder* nullptr if file should be stored as-is
+	 *
+	 * Small files, those already compressed and those with a MIME type indicating compressed
+	 * content (images, archives) are left alone. Also returns nullptr if there's insufficient memory.
+	 */
+	static IBlockEncoder* create(ArchiveStream::FileInfo& file);
+
+	~Lz4Encoder();
+
+	IDataSourceStream* getNextStream() override;
+
+private:
+	Lz4Encoder(ArchiveStream::FileInfo& file, uint8_t* buffer);
+
+	static constexpr size_t outputSize{sizeof(LZ4::BlockHeader) + LZ4::compressBound(FWFS_LZ4_BLOCK_SIZE)};
+	static constexpr size_t hashTableSize{1U << FWFS_LZ4_HASH_BITS};
+	static constexpr size_t bufferSize{FWFS_LZ4_BLOCK_SIZE + outputSize + hashTableSize * sizeof(uint16_t)};
+
+	IFS::FileSystem* fileSystem;
+	FileHandle file;
+	std::unique_ptr<uint8_t[]> buffer; ///< Input block, output block and hash table
+	std::unique_ptr<LimitedMemoryStream> stream;
+};
+
+/**
+ * @brief Decompresses file content created by `Lz4Encoder`
+ *
+ * For example, to serve content to a client which doesn't support LZ4.
+ */
+class Lz4Decoder : public IDataSourceStream
+{
+public:
+	/**
+	 * @brief Constructor
+	 * @param source Stream containing compressed content. Ownership is transferred.
+	 * @param originalSize Size of uncompressed content, from the file's compression attribute
+	 */
+	Lz4Decoder(IDataSourceStream* source, uint32_t originalSize) : source(source), originalSize(originalSize)
+	{
+	}
+
+	int available() override
+	{
+		return originalSize - consumed;
+	}
+
+	uint16_t readMemoryBlock(char* data, int bufSize) override;
+
+	int seekFrom(int offset, SeekOrigin origin) override;
+
+	bool isFinished() override
+	{
+		return consumed >= originalSize || failed;
+	}
+
+	/**
+	 * @brief Determine if content was found to be corrupt
+	 */
+	bool isFailed() const
+	{
+		return failed;
+	}
+
+private:
+	bool readSource(void* buffer, size_t size);
+	bool decodeBlock();
+
+	std::unique_ptr<IDataSourceStream> source;
+	std::unique_ptr<uint8_t[]> buffer; ///< Compressed block followed by decompressed block
+	uint32_t originalSize;
+	uint32_t consumed{0};
+	uint16_t blockSize{0};	///< Space allocated for each block
+	uint16_t blockLength{0}; ///< Amount of decompressed data
+	uint16_t blockPos{0};	///< Read position in decompressed data
+	bool failed{false};
+};
+
+} // namespace IFS::FWFS
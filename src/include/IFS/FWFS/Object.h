@@ -126,6 +126,8 @@ constexpr uint32_t FWFILESYS_END_MARKER{0x46574653}; // "SFWF"
 	XX(8, Md5Hash, "MD5 Hash Value")                                                                                   \
 	XX(9, Comment, "Comment")                                                                                          \
 	XX(10, UserAttribute, "User Attribute")                                                                            \
+	XX(11, DataChecksum, "CRC32C of preceding data object")                                                            \
+	XX(12, BaseData, "File content held in base image")                                                                \
 	XX(32, Data16, "Data, max 64K - 1")                                                                                \
 	XX(33, Volume, "Volume, top-level container object")                                                               \
 	XX(34, MountPoint, "Root for another filesystem")                                                                  \
@@ -285,6 +287,11 @@ struct Object {
 					// uint8_t[] data;
 				} userAttribute;
 
+				// Follows a data object (or reference) in a child table
+				struct {
+					uint32_t crc; ///< CRC32C of data object content
+				} dataChecksum;
+
 				// END - immediately followed by end marker
 				struct {
 					uint32_t checksum;
@@ -403,6 +410,19 @@ struct Object {
 		}
 	}
 
+	/** @brief Get largest content size which can be stored for this object type
+	 */
+	uint32_t maxContentSize() const
+	{
+		if(isRef() || type() < Type::Data16) {
+			return 0xff;
+		} else if(type() < Type::Data24) {
+			return 0xffff;
+		} else {
+			return 0xffffff;
+		}
+	}
+
 	void setContentSize(size_t size)
 	{
 		if(isRef() || type() < Type::Data16) {
@@ -438,6 +458,17 @@ struct Object {
 
 static_assert(sizeof(Object) == 8, "Object alignment wrong!");
 
+/**
+ * @brief Content of a BaseData object
+ *
+ * Differential archives refer to unchanged file content in the image they were based on.
+ */
+struct BaseDataInfo {
+	uint32_t fileId;  ///< Identifier of file in base image (Stat::id)
+	uint32_t size;	  ///< Size of file content
+	TimeStamp mtime; ///< Modification time of base file
+};
+
 #pragma pack()
 
 /**
@@ -19,22 +19,62 @@
 
 #pragma once
 
-#include <Data/Stream/MemoryDataStream.h>
+#include <Data/Stream/DataSourceStream.h>
 #include "../include/IFS/FWFS/Object.h"
+#include "../Crc32c.h"
+
+// Minimum amount by which an ObjectBuffer grows
+#ifndef FWFS_OBJECT_BUFFER_GROWTH
+#define FWFS_OBJECT_BUFFER_GROWTH 64
+#endif
 
 namespace IFS::FWFS
 {
 /**
  * @brief Class to manage writing object data into a stream
+ *
+ * Storage is kept when the buffer is cleared so it can be re-used for many objects without
+ * further heap activity. When more space is required the buffer grows by half its current size,
+ * or it can be sized in advance using `reserve()`.
  */
 class ObjectBuffer
 {
 public:
+	/**
+	 * @brief Constructor
+	 * @param capacity Initial size of buffer
+	 */
+	ObjectBuffer(size_t capacity = 0)
+	{
+		reserve(capacity);
+	}
+
+	/**
+	 * @brief Ensure buffer can hold at least the given amount of data without reallocation
+	 * @retval bool false if memory could not be allocated
+	 */
+	bool reserve(size_t capacity)
+	{
+		return stream.reserve(capacity);
+	}
+
+	/**
+	 * @brief Get amount of memory allocated to the buffer
+	 */
+	size_t getCapacity() const
+	{
+		return stream.capacity;
+	}
+
 	void write(const void* data, size_t size)
 	{
-		auto n = mem.write(static_cast<const uint8_t*>(data), size);
-		(void)n;
-		assert(n == size);
+		bool ok = ensureSpace(size);
+		(void)ok;
+		assert(ok);
+		if(ok) {
+			memcpy(stream.data + stream.size, data, size);
+			stream.size += size;
+		}
 	}
 
 	void write(const String& value)
@@ -56,7 +96,7 @@ public:
 	{
 		size_t headerSize = hdr.contentOffset() + extra;
 		if(bodySize != 0) {
-			mem.ensureCapacity(mem.getSize() + headerSize + bodySize);
+			ensureSpace(headerSize + bodySize);
 		}
 		write(&hdr, headerSize);
 	}
@@ -71,23 +111,42 @@ public:
 		write(hdr, idSize, 0);
 	}
 
+	/**
+	 * @brief Get type of data object required to store content of the given size
+	 */
+	static Object::Type getDataType(size_t size)
+	{
+		return (size <= 0xff) ? Object::Type::Data8 : (size <= 0xffff) ? Object::Type::Data16 : Object::Type::Data24;
+	}
+
 	Object::Type writeDataHeader(size_t size)
 	{
 		Object hdr;
-		if(size <= 0xff) {
-			hdr.setType(Object::Type::Data8);
-			hdr.data8.setContentSize(size);
-		} else if(size <= 0xffff) {
-			hdr.setType(Object::Type::Data16);
-			hdr.data16.setContentSize(size);
-		} else {
-			hdr.setType(Object::Type::Data24);
-			hdr.data24.setContentSize(size);
-		}
+		hdr.setType(getDataType(size));
+		hdr.setContentSize(size);
 		write(hdr, 0, 0);
 		return hdr.type();
 	}
 
+	void writeDataChecksum(uint32_t crc)
+	{
+		Object hdr;
+		hdr.setType(Object::Type::DataChecksum);
+		hdr.data8.setContentSize(sizeof(crc));
+		hdr.data8.dataChecksum.crc = crc;
+		write(hdr, sizeof(crc), 0);
+	}
+
+	void writeBaseData(uint32_t fileId, uint32_t size, TimeStamp mtime)
+	{
+		BaseDataInfo info{fileId, size, mtime};
+		Object hdr;
+		hdr.setType(Object::Type::BaseData);
+		hdr.data8.setContentSize(sizeof(info));
+		write(hdr, 0, sizeof(info));
+		write(&info, sizeof(info));
+	}
+
 	void writeNamed(Object::Type type, const char* name, uint8_t namelen, TimeStamp mtime)
 	{
 		Object hdr;
@@ -98,27 +157,154 @@ public:
 		write(name, namelen);
 	}
 
-	void fixupSize()
+	/**
+	 * @brief Update size of object at start of buffer to include all content written
+	 * @retval bool false if content is too large for the object type
+	 */
+	bool fixupSize()
 	{
-		auto objptr = mem.getStreamPointer();
+		auto objptr = stream.data + stream.readPos;
 		Object hdr;
 		memcpy(&hdr, objptr, 4);
-		hdr.setContentSize(mem.available() - hdr.contentOffset());
-		memcpy(const_cast<char*>(objptr), &hdr, 4);
+		auto size = getSize() - hdr.contentOffset();
+		if(size > hdr.maxContentSize()) {
+			debug_e("[FWFS] Object content too large (%u bytes, maximum %u)", size, hdr.maxContentSize());
+			return false;
+		}
+		hdr.setContentSize(size);
+		memcpy(objptr, &hdr, 4);
+		return true;
 	}
 
+	/**
+	 * @brief Get pointer to unread data
+	 */
+	const char* getData() const
+	{
+		return stream.data + stream.readPos;
+	}
+
+	/**
+	 * @brief Get amount of unread data
+	 */
+	size_t getSize() const
+	{
+		return stream.size - stream.readPos;
+	}
+
+	/**
+	 * @brief Calculate CRC32C of unread data
+	 */
+	uint32_t checksum(uint32_t crc)
+	{
+		return crc32c(getData(), getSize(), crc);
+	}
+
+	/**
+	 * @brief Discard content, retaining storage
+	 */
 	void clear()
 	{
-		mem.clear();
+		stream.size = 0;
+		stream.readPos = 0;
 	}
 
 	operator IDataSourceStream*()
 	{
-		return &mem;
+		return &stream;
 	}
 
 private:
-	MemoryDataStream mem;
+	/**
+	 * @brief Provides read access to buffer content
+	 */
+	class BufferStream : public IDataSourceStream
+	{
+	public:
+		~BufferStream()
+		{
+			free(data);
+		}
+
+		bool reserve(size_t newCapacity)
+		{
+			if(newCapacity <= capacity) {
+				return true;
+			}
+			auto newData = static_cast<char*>(realloc(data, newCapacity));
+			if(newData == nullptr) {
+				debug_e("[FWFS] No memory for %u byte object buffer", newCapacity);
+				return false;
+			}
+			data = newData;
+			capacity = newCapacity;
+			return true;
+		}
+
+		int available() override
+		{
+			return size - readPos;
+		}
+
+		uint16_t readMemoryBlock(char* buffer, int bufSize) override
+		{
+			if(bufSize <= 0) {
+				return 0;
+			}
+			auto len = std::min(size_t(bufSize), size - readPos);
+			memcpy(buffer, data + readPos, len);
+			return len;
+		}
+
+		int seekFrom(int offset, SeekOrigin origin) override
+		{
+			size_t newPos;
+			switch(origin) {
+			case SeekOrigin::Start:
+				newPos = offset;
+				break;
+			case SeekOrigin::Current:
+				newPos = readPos + offset;
+				break;
+			case SeekOrigin::End:
+				newPos = size + offset;
+				break;
+			default:
+				return -1;
+			}
+			if(newPos > size) {
+				return -1;
+			}
+			readPos = newPos;
+			return readPos;
+		}
+
+		bool isFinished() override
+		{
+			return readPos >= size;
+		}
+
+		char* data{nullptr};
+		size_t capacity{0};
+		size_t size{0};	///< Amount of data written
+		size_t readPos{0}; ///< Amount of data read
+	};
+
+	bool ensureSpace(size_t length)
+	{
+		size_t required = stream.size + length;
+		if(required <= stream.capacity) {
+			return true;
+		}
+		// Allocate exactly what's needed initially, as many objects are small
+		if(stream.capacity == 0) {
+			return stream.reserve(required);
+		}
+		auto growth = std::max(stream.capacity / 2, size_t(FWFS_OBJECT_BUFFER_GROWTH));
+		return stream.reserve(std::max(required, stream.capacity + growth));
+	}
+
+	BufferStream stream;
 };
 
 } // namespace IFS::FWFS
@@ -0,0 +1,135 @@
+/****
+ * PatchStream.h
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "../Error.h"
+#include <Data/Stream/ReadWriteStream.h>
+#include <Storage/Partition.h>
+
+namespace IFS::FWFS
+{
+/**
+ * @brief Applies a delta patch, as created by `tools/fsbuild/delta.py`, to an FWFS image
+ *
+ * Patch data is written to this stream as it arrives, for example from an HTTP download.
+ * The new image is assembled in the target partition from ranges of the source image
+ * plus literal data from the patch. RAM usage is fixed regardless of image or patch size.
+ *
+ * Before any changes are made the source image is verified against the checksum recorded
+ * in the patch. On completion the target image is read back and verified: the application should only
+ * switch to it if `isComplete()` returns true.
+ *
+ * @note Source and target must be different partitions.
+ */
+class PatchStream : public ReadWriteStream
+{
+public:
+	/*
+	 * Patch file format, all values are little-endian
+	 */
+	static constexpr uint32_t magic{0x50445746}; ///< "FWDP"
+
+	struct Header {
+		uint32_t magic;
+		uint32_t sourceSize;
+		uint32_t sourceChecksum; ///< CRC32C of source image
+		uint32_t targetSize;
+		uint32_t targetChecksum; ///< CRC32C of target image
+	};
+
+	/**
+	 * @brief Each operation is a single byte followed by its arguments
+	 */
+	enum class Op : uint8_t {
+		copy = 1,   ///< uint32_t offset, uint32_t length: Copy range from source image
+		insert = 2, ///< uint32_t length, data: Copy data from patch
+	};
+
+	PatchStream(Storage::Partition source, Storage::Partition target) : source(source), target(target)
+	{
+	}
+
+	size_t write(const uint8_t* data, size_t size) override;
+
+	uint16_t readMemoryBlock(char*, int) override
+	{
+		return 0;
+	}
+
+	bool isFinished() override
+	{
+		return state == State::done || state == State::failed;
+	}
+
+	/**
+	 * @brief Determine if target image has been written and verified
+	 */
+	bool isComplete() const
+	{
+		return state == State::done;
+	}
+
+	/**
+	 * @brief Get error code, FS_OK if no error has occurred
+	 */
+	int getLastError() const
+	{
+		return lastError;
+	}
+
+	/**
+	 * @brief Get number of bytes written to target partition
+	 */
+	uint32_t getTargetOffset() const
+	{
+		return targetOffset;
+	}
+
+private:
+	enum class State {
+		header,
+		op,
+		args,
+		insert,
+		done,
+		failed,
+	};
+
+	size_t fill(const uint8_t* data, size_t size, unsigned required);
+	int begin();
+	int execute();
+	int copy(uint32_t offset, uint32_t length);
+	int insert(const void* data, size_t length);
+	void finish();
+	void setError(int err);
+
+	Storage::Partition source;
+	Storage::Partition target;
+	Header header{};
+	uint8_t buffer[sizeof(Header)]; ///< Incoming header or operation arguments
+	uint8_t bufferLength{0};
+	Op op{};
+	State state{State::header};
+	uint32_t insertRemaining{0};
+	uint32_t targetOffset{0};
+	int lastError{FS_OK};
+};
+
+} // namespace IFS::FWFS
@@ -0,0 +1,100 @@
+/****
+ * ReadAheadStream.h
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "../Types.h"
+#include <Data/Stream/DataSourceStream.h>
+#include <memory>
+
+#ifdef ARCH_HOST
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+namespace IFS::FWFS
+{
+/**
+ * @brief Reads a source stream in large blocks using a pair of buffers
+ *
+ * Whilst one buffer is being consumed the other is filled from the source.
+ * On Host this is done by a worker thread, so reading the source overlaps with whatever
+ * the consumer does with the data, such as sending it over a network.
+ * Other architectures fill buffers on demand, so the source is still read in large
+ * blocks regardless of how much the consumer asks for at a time.
+ *
+ * If the buffers cannot be allocated then calls pass straight through to the source.
+ *
+ * @note The source must not be accessed by anything else until it has been fully read
+ * or this stream destroyed.
+ */
+class ReadAheadStream : public IDataSourceStream
+{
+public:
+	/**
+	 * @brief Constructor
+	 * @param source Stream to read, must report its size via `available()`. Ownership is transferred.
+	 * @param bufferSize Size of each buffer
+	 */
+	ReadAheadStream(IDataSourceStream* source, uint16_t bufferSize);
+
+	~ReadAheadStream();
+
+	int available() override
+	{
+		return storage ? int(size - consumed) : source->available();
+	}
+
+	uint16_t readMemoryBlock(char* data, int bufSize) override;
+
+	int seekFrom(int offset, SeekOrigin origin) override;
+
+	bool isFinished() override;
+
+private:
+	struct Buffer {
+		uint8_t* data;
+		uint16_t length; ///< Amount of data in buffer, 0 if empty
+	};
+
+	uint16_t fill(uint8_t* data);
+	Buffer* getFront();
+	void releaseFront();
+
+	std::unique_ptr<IDataSourceStream> source;
+	std::unique_ptr<uint8_t[]> storage;
+	Buffer buffers[2]{};
+	uint32_t size;		  ///< Total amount of data in source
+	uint32_t consumed{0}; ///< Read position
+	uint16_t bufferSize;
+	uint16_t frontPos{0}; ///< Read position within front buffer
+	uint8_t front{0};	 ///< Index of buffer being consumed
+	bool sourceDone{false};
+#ifdef ARCH_HOST
+	void run();
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool stop{false};
+#endif
+};
+
+} // namespace IFS::FWFS
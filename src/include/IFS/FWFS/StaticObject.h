@@ -0,0 +1,94 @@
+/****
+ * StaticObject.h
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "../IFileSystem.h"
+
+namespace IFS::FWFS
+{
+/**
+ * @brief Location of a file within an FWFS image, known at build time
+ *
+ * Generated by fsbuild using the `--header` option.
+ */
+struct StaticObject {
+	const char* path; ///< Path to file, used if image doesn't match
+	FileID id;		  ///< Object identifier
+	uint32_t size;	  ///< Stored size of file data
+};
+
+/**
+ * @brief Provides access to files using identifiers generated at build time
+ *
+ * Before any identifier is used the mounted volume ID and creation time are compared with those from the image build.
+ * The result is cached for the most recently used filesystem, so this check is only
+ * performed once.
+ *
+ * If either does not match, or the filesystem does not support opening by ID,
+ * then the regular path lookup is used instead.
+ *
+ * @note If a filesystem is destroyed and a different one created in its place, call `reset()`.
+ */
+class StaticImage
+{
+public:
+	constexpr StaticImage(uint32_t volumeID, uint32_t creationTime) : volumeID(volumeID), creationTime(creationTime)
+	{
+	}
+
+	/**
+	 * @brief Determine if identifiers may be used with the given filesystem
+	 */
+	bool isValid(IFileSystem& fileSystem);
+
+	/**
+	 * @brief Open a file
+	 * @param fileSystem The filesystem containing the image
+	 * @param obj The generated object information
+	 * @param flags
+	 * @retval FileHandle
+	 */
+	FileHandle open(IFileSystem& fileSystem, const StaticObject& obj, OpenFlags flags = OpenFlag::Read);
+
+	/**
+	 * @brief Get file information
+	 * @param fileSystem The filesystem containing the image
+	 * @param obj The generated object information
+	 * @param stat
+	 * @retval int error code
+	 */
+	int stat(IFileSystem& fileSystem, const StaticObject& obj, Stat* stat);
+
+	/**
+	 * @brief Discard cached volume check
+	 */
+	void reset()
+	{
+		checkedFileSystem = nullptr;
+	}
+
+private:
+	uint32_t volumeID;
+	uint32_t creationTime;
+	IFileSystem* checkedFileSystem{nullptr};
+	bool valid{false};
+};
+
+} // namespace IFS::FWFS
@@ -99,6 +99,33 @@ public:
 		return check(handle);
 	}
 
+	/**
+	 * @brief open a file using its identifier
+	 * @param id Identifier obtained from `Stat::id` for this filesystem
+	 * @param flags opens for opening file
+	 * @retval bool true on success
+	 */
+	bool openById(FileID id, OpenFlags flags = OpenFlag::Read)
+	{
+		GET_FS(false);
+		fs->close(handle);
+		handle = fs->openById(id, flags);
+		return check(handle);
+	}
+
+	/**
+	 * @brief Take ownership of an already-open file handle
+	 * @param file Handle obtained from this filesystem, e.g. via `Directory::openat()`
+	 * @retval bool true on success
+	 * @note If an error code is passed this fails, and the code is available via `getLastError()`
+	 */
+	bool attach(FileHandle file)
+	{
+		close();
+		handle = file;
+		return check(file);
+	}
+
 	/**
 	 * @brief close an open file
      * @retval bool true on success
@@ -98,9 +98,24 @@ public:
 
 	FileCopier(FileSystem& srcfs, FileSystem& dstfs);
 
-	bool copyFile(const String& srcFileName, const String& dstFileName);
-	bool copyDir(const String& srcPath, const String& dstPath);
-	bool copyAttributes(const String& srcPath, const String& dstPath);
+	bool copyFile(const char* srcFileName, const char* dstFileName);
+	bool copyDir(const char* srcPath, const char* dstPath);
+	bool copyAttributes(const char* srcPath, const char* dstPath);
+
+	bool copyFile(const String& srcFileName, const String& dstFileName)
+	{
+		return copyFile(srcFileName.c_str(), dstFileName.c_str());
+	}
+
+	bool copyDir(const String& srcPath, const String& dstPath)
+	{
+		return copyDir(srcPath.c_str(), dstPath.c_str());
+	}
+
+	bool copyAttributes(const String& srcPath, const String& dstPath)
+	{
+		return copyAttributes(srcPath.c_str(), dstPath.c_str());
+	}
 
 	void onError(ErrorHandler callback)
 	{
@@ -109,7 +124,9 @@ public:
 
 private:
 	bool copyFile(const String& srcPath, const String& dstPath, const Stat& stat);
-	bool copyAttributes(File& src, File& dst, const String& srcPath, const String& dstPath);
+	bool copyAttributes(File& src, File& dst, const char* srcPath, const char* dstPath);
+	bool copyFile(File& srcFile, const char* srcFileName, const char* dstFileName);
+	bool copyDir(NameBuffer& srcPath, NameBuffer& dstPath);
 
 	bool handleError(const ErrorInfo& info);
 
@@ -0,0 +1,125 @@
+/****
+ * FileIDSet.h
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "Stat.h"
+#include <memory>
+
+namespace IFS
+{
+/**
+ * @brief Set of file identifiers using an open-addressed hash table
+ *
+ * Lookups, additions and removals are O(1) on average.
+ * Linear probing is used with backward-shift deletion so no tombstones are required.
+ *
+ * @note A FileID of 0 is used internally to mark empty slots so cannot be stored.
+ */
+class FileIDSet
+{
+public:
+	/**
+	 * @brief Determine if set contains an identifier
+	 */
+	bool contains(FileID id) const
+	{
+		return id != 0 && capacity != 0 && table[findSlot(id)] == id;
+	}
+
+	/**
+	 * @brief Add an identifier to the set
+	 * @retval bool false if memory allocation failed or id is invalid
+	 */
+	bool add(FileID id);
+
+	/**
+	 * @brief Remove an identifier from the set
+	 * @retval bool true if identifier was found and removed
+	 */
+	bool remove(FileID id);
+
+	/**
+	 * @brief Remove all identifiers and release memory
+	 */
+	void clear()
+	{
+		table.reset();
+		capacity = 0;
+		itemCount = 0;
+	}
+
+	/**
+	 * @brief Get number of identifiers in set
+	 */
+	unsigned count() const
+	{
+		return itemCount;
+	}
+
+	/**
+	 * @brief Invoke a callback for every identifier in the set
+	 * @param callback Function or lambda taking a FileID parameter
+	 * @note Order is unspecified. The set must not be modified during iteration.
+	 */
+	template <typename Callback> void forEach(Callback callback) const
+	{
+		for(unsigned i = 0; i < capacity; ++i) {
+			if(table[i] != 0) {
+				callback(table[i]);
+			}
+		}
+	}
+
+private:
+	static constexpr unsigned minCapacity{16};
+
+	/**
+	 * @brief Get preferred slot for id
+	 *
+	 * Fibonacci hashing: object offsets are typically clustered, and the high bits
+	 * of the product depend on all bits of the identifier.
+	 */
+	unsigned home(FileID id) const
+	{
+		// capacity is a power of 2, so this takes the top log2(capacity) bits
+		return uint32_t(id * 2654435769U) >> __builtin_clz(capacity - 1);
+	}
+
+	/**
+	 * @brief Locate slot containing id, or empty slot where it should be placed
+	 */
+	unsigned findSlot(FileID id) const
+	{
+		auto mask = capacity - 1;
+		auto i = home(id);
+		while(table[i] != 0 && table[i] != id) {
+			i = (i + 1) & mask;
+		}
+		return i;
+	}
+
+	bool resize(unsigned newCapacity);
+
+	std::unique_ptr<FileID[]> table;
+	unsigned capacity{0}; ///< Always a power of 2
+	unsigned itemCount{0};
+};
+
+} // namespace IFS
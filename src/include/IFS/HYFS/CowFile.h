@@ -0,0 +1,197 @@
+/****
+ * CowFile.h
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "../IFileSystem.h"
+#include <WVector.h>
+#include <memory>
+
+// Size of blocks stored in sidecar files
+#ifndef HYFS_COW_BLOCK_SIZE
+#define HYFS_COW_BLOCK_SIZE 512
+#endif
+
+// Suffix appended to file path to identify sidecar files
+#ifndef HYFS_COW_SUFFIX
+#define HYFS_COW_SUFFIX ".~cow"
+#endif
+
+namespace IFS::HYFS
+{
+/**
+ * @brief Copy-on-write file
+ *
+ * Presents an FWFS file with any modified blocks held in a 'sidecar' file on the writeable filesystem.
+ * The sidecar is named by appending HYFS_COW_SUFFIX to the file path, and is laid out as:
+ *
+ * 		Header
+ * 		Block records: {uint32_t block; uint8_t data[HYFS_COW_BLOCK_SIZE]}
+ *
+ * Records are appended as blocks are first modified, so the block map is rebuilt when the file is opened.
+ * Reads are served from the sidecar for modified blocks, otherwise from FWFS.
+ *
+ * The base file is identified by its FWFS object ID, so the header also records the FW volume.
+ * If the FWFS image has changed, the base file is located again by path and accepted if its size
+ * and modification time are unchanged. Otherwise the sidecar is rejected with Error::BadObject.
+ *
+ * Attributes are copied to the sidecar file when it's created and are managed there.
+ */
+class CowFile
+{
+public:
+	static constexpr uint32_t magic{0x57434648}; // "HFCW"
+	static constexpr uint16_t blockSize{HYFS_COW_BLOCK_SIZE};
+
+	struct Header {
+		uint32_t magic;
+		uint16_t blockSize;
+		uint16_t reserved;
+		FileID fwid;			  ///< Identifies base file on FWFS
+		uint32_t size;			  ///< Logical file size
+		uint32_t fwLimit;		  ///< Content beyond this offset is not visible in FWFS file
+		uint32_t fwVolumeID;	  ///< FW volume identifier, as fwid is only valid for the same image
+		TimeStamp fwCreationTime; ///< FW volume creation time
+		uint32_t fwSize;		  ///< Size of base file
+		TimeStamp fwMtime;		  ///< Modification time of base file
+	};
+
+	CowFile(IFileSystem& fwfs, IFileSystem& ffs) : fwfs(fwfs), ffs(ffs)
+	{
+	}
+
+	~CowFile()
+	{
+		close();
+	}
+
+	/**
+	 * @brief Create a new sidecar file for an open FWFS file
+	 * @param path Path to file
+	 * @param fwfile Open FWFS file, ownership is transferred to this object on success
+	 * @param flags How file is being opened
+	 * @retval int error code
+	 */
+	int create(const char* path, FileHandle fwfile, OpenFlags flags);
+
+	/**
+	 * @brief Open an existing sidecar file
+	 * @param path Path to file
+	 * @param flags How file is being opened
+	 * @retval int error code
+	 */
+	int open(const char* path, OpenFlags flags);
+
+	int close();
+	int read(void* data, size_t size);
+	int write(const void* data, size_t size);
+	file_offset_t lseek(file_offset_t offset, SeekOrigin origin);
+	int eof();
+	file_offset_t tell()
+	{
+		return cursor;
+	}
+	int ftruncate(file_size_t new_size);
+	int flush();
+	int fstat(Stat* stat);
+
+	/**
+	 * @brief Get handle for the sidecar file, where file attributes are stored
+	 */
+	FileHandle getSidecar() const
+	{
+		return sidecar;
+	}
+
+	/**
+	 * @brief Build path to sidecar file
+	 * @param buffer Where to write path
+	 * @param path File path
+	 * @retval int error code
+	 */
+	static int getSidecarPath(NameBuffer& buffer, const char* path);
+
+	/**
+	 * @brief Determine if a name refers to a sidecar file
+	 */
+	static bool isSidecar(const NameBuffer& name)
+	{
+		return name.endsWith(HYFS_COW_SUFFIX);
+	}
+
+	/**
+	 * @brief Remove sidecar suffix from a name
+	 */
+	static void stripSuffix(NameBuffer& name);
+
+	/**
+	 * @brief Read header from the sidecar for a file
+	 * @param fwfs Filesystem containing base file
+	 * @param ffs Filesystem containing sidecar
+	 * @param path Path to file
+	 * @param header On success, contains validated header bound to the current FW image
+	 * @retval int error code
+	 */
+	static int readHeader(IFileSystem& fwfs, IFileSystem& ffs, const char* path, Header& header);
+
+	/**
+	 * @brief Locate base file in the current FW image
+	 * @param fwfs Filesystem containing base file
+	 * @param path Path to file
+	 * @param header Header read from sidecar, updated if base file is found in a different image
+	 * @retval int error code, Error::BadObject if base file has changed
+	 */
+	static int bindBase(IFileSystem& fwfs, const char* path, Header& header);
+
+private:
+	static int readHeader(IFileSystem& ffs, FileHandle file, Header& header);
+	int loadBlockMap();
+	int findSlot(uint32_t block) const
+	{
+		return (block < mapSize) ? int(map[block]) - 1 : -1;
+	}
+	int setSlot(uint32_t block, int slot);
+	int allocateSlot(uint32_t block);
+	int readBase(uint32_t offset, uint8_t* buffer, size_t size);
+	int writeRecord(int slot, uint32_t block, const uint8_t* data);
+	int writeHeader();
+
+	static constexpr uint32_t recordSize{sizeof(uint32_t) + blockSize};
+	static constexpr uint32_t freeBlock{0xffffffff};
+
+	uint32_t slotOffset(int slot) const
+	{
+		return sizeof(Header) + uint32_t(slot) * recordSize;
+	}
+
+	IFileSystem& fwfs;
+	IFileSystem& ffs;
+	FileHandle fwfile{-1};
+	FileHandle sidecar{-1};
+	Header header{};
+	std::unique_ptr<uint16_t[]> map; ///< Slot number + 1 for each block, 0 if unmodified
+	uint32_t mapSize{0};
+	uint16_t slotCount{0};
+	Vector<uint16_t> freeSlots;
+	uint32_t cursor{0};
+	OpenFlags flags;
+	bool dirty{false};
+};
+
+} // namespace IFS::HYFS
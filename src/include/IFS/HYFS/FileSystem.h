@@ -28,11 +28,8 @@
  *
  * Images are created using a python script.
  *
- * @todo
- * 	When a file is deleted, if it exists on FW then a zero-length file should be placed on SPIFFS
- * 	with an attribute to indicate it has been deleted.
- * 	An 'undelete' could be added which would remove this to restore the FW file. It probably wouldn't
- * 	be useful on any other filing system though, and may not always succeed.
+ * Deleting a file which exists only on FW records a 'whiteout' in a journal file on SPIFFS,
+ * so it remains deleted after remounting. See `Journal`.
  *
  */
 
@@ -44,21 +41,85 @@
 #define HYFS_HIDE_FLAGS 1
 #endif
 
-#if HYFS_HIDE_FLAGS == 1
-#include "WVector.h"
+#include "CowFile.h"
+#include "Journal.h"
+#include "NegativeCache.h"
+
+// Handles for copy-on-write files start at this value
+#ifndef HYFS_HANDLE_MIN
+#define HYFS_HANDLE_MIN 1000
+#endif
+
+// Maximum number of open virtual file handles
+#ifndef HYFS_MAX_FDS
+#define HYFS_MAX_FDS 8
 #endif
 
+// Maximum virtual file handle value
+#define HYFS_HANDLE_MAX (HYFS_HANDLE_MIN + HYFS_MAX_FDS - 1)
+
 namespace IFS::HYFS
 {
+struct FileDir;
+
+/**
+ * @brief Descriptor for virtual file handles
+ *
+ * Used for copy-on-write files, and for FW files where copying is deferred until first modification.
+ */
+struct FileDesc {
+	CString path;				  ///< Path to file whilst copy is pending
+	std::unique_ptr<CowFile> cow; ///< Copy-on-write file
+	FileHandle file{-1};		  ///< FW file if copy is pending, otherwise FFS file
+	FileID fwid{0};				  ///< FW file identifier
+	OpenFlags flags;			  ///< Flags passed to open()
+	bool pending{false};		  ///< File hasn't yet been copied to FFS
+
+	bool isOpen() const
+	{
+		return cow || file >= 0;
+	}
+
+	void reset()
+	{
+		*this = FileDesc{};
+	}
+};
+
 class FileSystem : public IFileSystem
 {
 public:
-	FileSystem(IFileSystem* fwfs, IFileSystem* ffs) : fwfs(fwfs), ffs(ffs)
+	enum class Flag {
+		/**
+		 * @brief Store only modified blocks of FW files instead of copying them in full
+		 *
+		 * Blocks are kept in sidecar files on the writeable filesystem, see `CowFile`.
+		 * Once in use, this flag must remain set so sidecar files continue to be recognised.
+		 */
+		copyOnWrite,
+		/**
+		 * @brief Defer copying FW files until they're modified
+		 *
+		 * FW files opened for writing are read directly from FWFS. The copy is made on the first
+		 * call to `write()`, `ftruncate()` or `fsetxattr()`, so if none of these occur the FFS is untouched.
+		 * Opening with OpenFlag::Truncate is treated as an immediate modification.
+		 */
+		lazyCopy,
+	};
+
+	using Flags = BitSet<uint8_t, Flag, 2>;
+
+	FileSystem(IFileSystem* fwfs, IFileSystem* ffs, Flags flags = 0) : fwfs(fwfs), ffs(ffs), flags(flags)
 	{
 	}
 
 	~FileSystem()
 	{
+		// Release anything which refers to the filesystems first
+		for(auto& fd : fileDescs) {
+			fd.reset();
+		}
+		journal.close();
 		delete ffs;
 		delete fwfs;
 	}
@@ -71,9 +132,12 @@ public:
 	int opendir(const char* path, DirHandle& dir) override;
 	int readdir(DirHandle dir, Stat& stat) override;
 	int rewinddir(DirHandle dir) override;
+	int telldir(DirHandle dir, DirCookie& cookie) override;
+	int seekdir(DirHandle dir, DirCookie cookie) override;
 	int closedir(DirHandle dir) override;
 	int mkdir(const char* path) override;
 	int stat(const char* path, Stat* stat) override;
+	int statat(DirHandle dir, const char* name, Stat* stat) override;
 	int fstat(FileHandle file, Stat* stat) override;
 	int fcontrol(FileHandle file, ControlCode code, void* buffer, size_t bufSize) override;
 	int fsetxattr(FileHandle file, AttributeTag tag, const void* data, size_t size) override;
@@ -82,6 +146,7 @@ public:
 	int setxattr(const char* path, AttributeTag tag, const void* data, size_t size) override;
 	int getxattr(const char* path, AttributeTag tag, void* buffer, size_t size) override;
 	FileHandle open(const char* path, OpenFlags flags) override;
+	FileHandle openat(DirHandle dir, const char* name, OpenFlags flags) override;
 	int close(FileHandle file) override;
 	int read(FileHandle file, void* data, size_t size) override;
 	int write(FileHandle file, const void* data, size_t size) override;
@@ -97,16 +162,68 @@ public:
 	int format() override;
 	int check() override;
 
+	/**
+	 * @brief Get statistics for cache of paths known to be absent from the writeable filesystem
+	 */
+	const NegativeCache::Stats& getLookupStats() const
+	{
+		return negativeCache.getStats();
+	}
+
+	void resetLookupStats()
+	{
+		negativeCache.resetStats();
+	}
+
+	/**
+	 * @brief Convert copy-on-write sidecar files into full copies on the writeable filesystem
+	 * @retval int Number of files converted, or error code
+	 *
+	 * Sidecars hold only modified blocks so depend on the original file in the FW image.
+	 * Call this before switching to a new image in which modified files may have changed,
+	 * so the modifications are retained. Fails with Error::BadParam if any files are open.
+	 */
+	int expandSidecars();
+
 private:
+	int copyAttributes(IFileSystem& srcfs, FileHandle srcfile, FileHandle ffsfile);
+	FileHandle copyFile(const char* path, FileHandle fwfile, OpenFlags flags);
+	int copyUp(FileDesc& fd, const char* path);
+	int openCopy(FileDesc& fd, const char* path, file_offset_t pos);
+	int allocateFileDesc();
+	FileHandle openSidecar(const char* path, OpenFlags flags);
+	int getCowSize(const char* dirPath, const NameBuffer& name, file_size_t& size);
+	int expandSidecars(NameBuffer& path);
+	int expandSidecar(const char* path);
 	int hideFWFile(const char* path, bool hide);
-	bool isFWFileHidden(const Stat& fwstat);
+	void hideFWFile(FileID id, bool hide);
+	bool isFWFileHidden(const FileDir& dir, const Stat& fwstat);
+	int whiteoutFWFile(FileID id);
+	int statFW(const char* path, Stat* stat);
+	FileHandle openFW(const char* path);
+	void makeParentDirs(const char* path);
+	void openJournal();
+	void scanOverrides(NameBuffer& path);
+
+	/**
+	 * @brief Determine if all FW entries overridden by FFS are known without probing
+	 */
+	bool overridesKnown() const
+	{
+		return HYFS_HIDE_FLAGS == 1 && journal.isOpen();
+	}
 
 private:
 	IFileSystem* fwfs;
 	IFileSystem* ffs;
 #if HYFS_HIDE_FLAGS == 1
-	Vector<FileID> hiddenFwFiles;
+	FileIDSet hiddenFwFiles;
 #endif
+	FileIDSet whiteouts; ///< Deleted FW files
+	Journal journal;
+	NegativeCache negativeCache;
+	FileDesc fileDescs[HYFS_MAX_FDS];
+	Flags flags;
 	bool mounted{false};
 };
 
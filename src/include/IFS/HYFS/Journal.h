@@ -0,0 +1,128 @@
+/****
+ * Journal.h
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "../IFileSystem.h"
+#include "../FileIDSet.h"
+
+// Name of journal file in root directory of writeable filesystem
+#ifndef HYFS_JOURNAL_NAME
+#define HYFS_JOURNAL_NAME ".hyfs-journal"
+#endif
+
+namespace IFS::HYFS
+{
+/**
+ * @brief Persistent record of FW files which are overridden or deleted
+ *
+ * Stored as a single append-only file on the writeable filesystem:
+ *
+ * 		Header
+ * 		Records: {FileID id; Type type; uint8_t reserved[3]}
+ *
+ * Replaying the records in order gives the current state. Records are only written when state changes,
+ * and the file is rewritten when loaded if it contains too many superseded records.
+ *
+ * FW file identifiers are only meaningful for a specific image, so the header records the FW volume
+ * identity. If this doesn't match then the journal is discarded.
+ */
+class Journal
+{
+public:
+	static constexpr uint32_t magic{0x4c4a5948}; // "HYJL"
+
+	enum class Type : uint8_t {
+		override = 1, ///< FW entry has a corresponding FFS entry
+		whiteout = 2, ///< FW file has been deleted
+		clear = 3,	  ///< FW entry is no longer overridden
+	};
+
+	struct Header {
+		uint32_t magic;
+		uint32_t volumeID;		///< FW volume identifier
+		TimeStamp creationTime; ///< FW volume creation time
+	};
+
+	struct Record {
+		FileID id;
+		Type type;
+		uint8_t reserved[3];
+	};
+
+	~Journal()
+	{
+		close();
+	}
+
+	/**
+	 * @brief Load an existing journal and keep it open for appending
+	 * @param ffs Filesystem containing journal
+	 * @param fwinfo Identifies FW volume
+	 * @param overrides Populated with overridden FW entries, may be null if not required
+	 * @param whiteouts Populated with deleted FW files
+	 * @retval int error code
+	 * 	- Error::NotFound if journal doesn't exist
+	 * 	- Error::BadObject if journal is corrupt or belongs to a different FW volume
+	 */
+	int load(IFileSystem& ffs, const IFileSystem::Info& fwinfo, FileIDSet* overrides, FileIDSet& whiteouts);
+
+	/**
+	 * @brief Write a new journal containing the given state and keep it open for appending
+	 * @param ffs Filesystem to contain journal
+	 * @param fwinfo Identifies FW volume
+	 * @param overrides Overridden FW entries, may be null
+	 * @param whiteouts Deleted FW files
+	 * @retval int error code
+	 */
+	int create(IFileSystem& ffs, const IFileSystem::Info& fwinfo, const FileIDSet* overrides,
+			   const FileIDSet& whiteouts);
+
+	/**
+	 * @brief Append a record
+	 * @retval int error code
+	 */
+	int add(FileID id, Type type);
+
+	void close();
+
+	bool isOpen() const
+	{
+		return file >= 0;
+	}
+
+	/**
+	 * @brief Determine if a root directory entry is the journal, or a temporary file used to rewrite it
+	 */
+	static bool isJournal(const NameBuffer& name)
+	{
+		return name.length >= sizeof(HYFS_JOURNAL_NAME) - 1 &&
+			   memcmp(name.buffer, HYFS_JOURNAL_NAME, sizeof(HYFS_JOURNAL_NAME) - 1) == 0;
+	}
+
+private:
+	int writeRecord(FileID id, Type type);
+	int writeRecords(const FileIDSet* set, Type type);
+
+	IFileSystem* ffs{nullptr};
+	FileHandle file{-1};
+	unsigned recordCount{0};
+};
+
+} // namespace IFS::HYFS
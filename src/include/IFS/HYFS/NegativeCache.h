@@ -0,0 +1,136 @@
+/****
+ * NegativeCache.h
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include <cstdint>
+#include <array>
+
+// Number of paths remembered as absent from the writeable filesystem, 0 to disable
+#ifndef HYFS_NEGCACHE_SIZE
+#define HYFS_NEGCACHE_SIZE 32
+#endif
+
+namespace IFS::HYFS
+{
+/**
+ * @brief Direct-mapped cache of paths known not to exist on the writeable filesystem
+ *
+ * Paths are stored as 64-bit FNV-1a hashes so a false match is vanishingly unlikely.
+ * Each path maps to a single slot, so a new entry replaces whichever path occupied it.
+ */
+class NegativeCache
+{
+public:
+	struct Stats {
+		uint32_t hits;			///< Lookups which avoided a query
+		uint32_t misses;		///< Lookups which required a query
+		uint32_t invalidations; ///< Entries removed because the path was created
+	};
+
+	/**
+	 * @brief Determine if path is known to be absent
+	 */
+	bool contains(const char* path)
+	{
+		if(table.size() == 0) {
+			return false;
+		}
+		auto h = hash(path);
+		bool hit = (table[slot(h)] == h);
+		if(hit) {
+			++stats.hits;
+		} else {
+			++stats.misses;
+		}
+		return hit;
+	}
+
+	/**
+	 * @brief Record path as absent
+	 */
+	void add(const char* path)
+	{
+		if(table.size() != 0) {
+			auto h = hash(path);
+			table[slot(h)] = h;
+		}
+	}
+
+	/**
+	 * @brief Forget path, called whenever it may have been created
+	 */
+	void invalidate(const char* path)
+	{
+		if(table.size() == 0) {
+			return;
+		}
+		auto h = hash(path);
+		auto& entry = table[slot(h)];
+		if(entry == h) {
+			entry = 0;
+			++stats.invalidations;
+		}
+	}
+
+	void clear()
+	{
+		table.fill(0);
+	}
+
+	const Stats& getStats() const
+	{
+		return stats;
+	}
+
+	void resetStats()
+	{
+		stats = Stats{};
+	}
+
+private:
+	static constexpr unsigned slot(uint64_t h)
+	{
+		// Avoid 64-bit division
+		return uint32_t(h) % (HYFS_NEGCACHE_SIZE ?: 1);
+	}
+
+	/*
+	 * Leading separator is ignored. Never returns 0 as that marks an empty slot.
+	 */
+	static uint64_t hash(const char* path)
+	{
+		uint64_t h{0xcbf29ce484222325ULL};
+		if(path != nullptr) {
+			if(*path == '/') {
+				++path;
+			}
+			while(*path != '\0') {
+				h ^= uint8_t(*path++);
+				h *= 0x100000001b3ULL;
+			}
+		}
+		return h ?: 1;
+	}
+
+	std::array<uint64_t, HYFS_NEGCACHE_SIZE> table{};
+	Stats stats{};
+};
+
+} // namespace IFS::HYFS
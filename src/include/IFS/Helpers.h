@@ -23,6 +23,9 @@
 #pragma once
 
 #include "FileSystem.h"
+#include "HYFS/FileSystem.h"
+#include "Union/FileSystem.h"
+#include "FWFS/ArchiveStream.h"
 
 namespace IFS
 {
@@ -37,16 +40,49 @@ FileSystem* createFirmwareFilesystem(Storage::Partition partition);
  * @brief Create a hybrid filesystem
  * @param fwfsPartition Base read-only filesystem partition
  * @param flashFileSystem The filesystem to use for writing
+ * @param flags Options for hybrid filesystem
  * @retval FileSystem* constructed filesystem object
  */
-FileSystem* createHybridFilesystem(Storage::Partition fwfsPartition, IFileSystem* flashFileSystem);
+FileSystem* createHybridFilesystem(Storage::Partition fwfsPartition, IFileSystem* flashFileSystem,
+								   HYFS::FileSystem::Flags flags = 0);
+
+/**
+ * @brief Create a read-only union of firmware filesystems
+ * @param partitions FWFS partitions, lowest layer first
+ * @retval FileSystem* constructed filesystem object
+ *
+ * Each image shadows those listed before it, so a small patch image can be deployed
+ * on top of a base image instead of replacing it.
+ */
+FileSystem* createUnionFilesystem(std::initializer_list<Storage::Partition> partitions);
 
 /**
  * @brief Mount an FWFS archive
  * @param fs Filesystem where file is located
  * @param filename Name of archive file
+ * @param base For differential archives, the filesystem holding unchanged content.
+ * See `FWFS::FileSystem::setBase()`.
  * @retval FileSystem* constructed filesystem object
+ *
+ * A full image can be restored from a differential archive by passing the mounted
+ * archive to `createFirmwareImage()`, or to an `FWFS::ArchiveStream`.
+ */
+FileSystem* mountArchive(FileSystem& fs, const String& filename, IFileSystem* base = nullptr);
+
+/**
+ * @brief Write the content of a filesystem to a partition as an FWFS image
+ * @param fs Filesystem to read
+ * @param partition Destination partition, which is erased first
+ * @param volumeInfo Information to store in the image
+ * @retval int error code
+ *
+ * Used to flatten a hybrid filesystem: the merged view is written, so overridden files appear with their
+ * current content and deleted files are omitted. The application can then mount the new image in place
+ * of the original and format the writeable layer.
+ *
+ * @note The destination partition must not be in use.
  */
-FileSystem* mountArchive(FileSystem& fs, const String& filename);
+int createFirmwareImage(FileSystem& fs, Storage::Partition partition,
+						const FWFS::ArchiveStream::VolumeInfo& volumeInfo);
 
 } // namespace IFS
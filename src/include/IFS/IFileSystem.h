@@ -50,7 +50,8 @@
 	XX(Host, HOST, "Host File System")                                                                                 \
 	XX(Fat, FAT, "FAT File System")                                                                                    \
 	XX(Fat32, FAT32, "FAT32 File System")                                                                              \
-	XX(ExFat, exFAT, "EXFAT File System")
+	XX(ExFat, exFAT, "EXFAT File System")                                                                              \
+	XX(Union, UNION, "Union File System")
 
 /**
  * @brief Attribute flags for filing system
@@ -71,6 +72,14 @@ class IFileSystem;
  */
 using DirHandle = struct ImplFileDir*;
 
+/**
+ * @brief Opaque directory read position
+ *
+ * Obtained via `IFileSystem::telldir()` and passed to `IFileSystem::seekdir()`.
+ * Values are only meaningful for the directory they were obtained from.
+ */
+using DirCookie = uint64_t;
+
 #if DEBUG_BUILD
 #define debug_ifserr(err, func, ...)                                                                                   \
 	do {                                                                                                               \
@@ -230,6 +239,16 @@ public:
      */
 	virtual int opendir(const char* path, DirHandle& dir) = 0;
 
+	/**
+	 * @brief open a directory for reading
+	 * @param path View of path to directory, need not be nul-terminated
+	 * @param dir returns a pointer to the directory object
+	 * @retval int error code
+	 * @note Default implementation copies the path into a stack buffer.
+	 * Filesystems which can parse a view directly should override this.
+	 */
+	virtual int opendir(PathView path, DirHandle& dir);
+
 	/**
 	 * @brief read a directory entry
      * @param dir
@@ -247,6 +266,32 @@ public:
      */
 	virtual int rewinddir(DirHandle dir) = 0;
 
+	/**
+	 * @brief Get current directory read position
+	 * @param dir
+	 * @param cookie OUT: Position of next entry to be returned by `readdir()`
+	 * @retval int error code
+	 *
+	 * This allows enumeration to be resumed later, for example when serving a large directory in pages.
+	 * Where possible filesystems return a value which remains valid for other handles opened
+	 * on the same (unmodified) directory.
+	 */
+	virtual int telldir([[maybe_unused]] DirHandle dir, [[maybe_unused]] DirCookie& cookie)
+	{
+		return Error::NotImplemented;
+	}
+
+	/**
+	 * @brief Set directory read position
+	 * @param dir
+	 * @param cookie Value previously obtained from `telldir()`
+	 * @retval int error code
+	 */
+	virtual int seekdir([[maybe_unused]] DirHandle dir, [[maybe_unused]] DirCookie cookie)
+	{
+		return Error::NotImplemented;
+	}
+
 	/**
 	 * @brief close a directory object
      * @param dir directory to close
@@ -284,6 +329,41 @@ public:
      */
 	virtual int stat(const char* path, Stat* stat) = 0;
 
+	/**
+	 * @brief get file information
+	 * @param path View of path to file, need not be nul-terminated
+	 * @param stat structure to return information in, may be null
+	 * @retval int error code
+	 */
+	virtual int stat(PathView path, Stat* stat);
+
+	/**
+	 * @brief get information for a file relative to an open directory
+	 * @param dir Directory handle obtained from `opendir()`
+	 * @param name Name of file within the directory
+	 * @param stat structure to return information in, may be null
+	 * @retval int error code
+	 * @note Returns Error::NotImplemented if the filesystem doesn't support this,
+	 * in which case the caller must use the full path. See `Directory::statat()`.
+	 */
+	virtual int statat([[maybe_unused]] DirHandle dir, [[maybe_unused]] const char* name, [[maybe_unused]] Stat* stat)
+	{
+		return Error::NotImplemented;
+	}
+
+	/**
+	 * @brief get file information using its identifier
+	 * @param id Identifier as returned in `Stat::id`
+	 * @param stat structure to return information in, may be null
+	 * @retval int error code
+	 * @note Filesystems which cannot locate an object directly from its identifier
+	 * return Error::NotSupported, in which case the caller must use the path.
+	 */
+	virtual int statById([[maybe_unused]] FileID id, [[maybe_unused]] Stat* stat)
+	{
+		return Error::NotSupported;
+	}
+
 	/**
 	 * @brief get file information
      * @param file handle to open file
@@ -322,6 +402,48 @@ public:
      */
 	virtual FileHandle open(const char* path, OpenFlags flags) = 0;
 
+	/**
+	 * @brief open a file (or directory) by path
+	 * @param path View of path to file, need not be nul-terminated
+	 * @param flags Desired access and other options
+	 * @retval FileHandle file handle or error code
+	 */
+	virtual FileHandle open(PathView path, OpenFlags flags);
+
+	/**
+	 * @brief open a file (or directory) relative to an open directory
+	 * @param dir Directory handle obtained from `opendir()`
+	 * @param name Name of file within the directory
+	 * @param flags Desired access and other options
+	 * @retval FileHandle file handle or error code
+	 *
+	 * Filesystems implementing this need only search the directory, rather than
+	 * re-resolving the full path from the root.
+	 *
+	 * @note Returns Error::NotImplemented if the filesystem doesn't support this,
+	 * in which case the caller must use the full path. See `Directory::openat()`.
+	 */
+	virtual FileHandle openat([[maybe_unused]] DirHandle dir, [[maybe_unused]] const char* name,
+							  [[maybe_unused]] OpenFlags flags)
+	{
+		return Error::NotImplemented;
+	}
+
+	/**
+	 * @brief open a file (or directory) using its identifier
+	 * @param id Identifier as returned in `Stat::id`
+	 * @param flags Desired access and other options
+	 * @retval FileHandle file handle or error code
+	 *
+	 * This avoids a second path lookup when serving files obtained from a directory listing.
+	 * Note that the identifier must have been obtained from this filesystem:
+	 * for layered filesystems check `Stat::fs` and call this method on that filesystem.
+	 */
+	virtual FileHandle openById([[maybe_unused]] FileID id, [[maybe_unused]] OpenFlags flags)
+	{
+		return Error::NotSupported;
+	}
+
 	/**
 	 * @brief close an open file
      * @param file handle to open file
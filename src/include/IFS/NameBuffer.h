@@ -23,6 +23,7 @@
 
 #include "Types.h"
 #include "Error.h"
+#include "PathView.h"
 
 namespace IFS
 {
@@ -111,6 +112,55 @@ struct NameBuffer {
 		return copy(name.buffer, name.length);
 	}
 
+	int copy(PathView path)
+	{
+		return copy(path.text, path.length);
+	}
+
+	/**
+	 * @brief append text to the buffer
+	 * @param src source text
+	 * @param srclen number of characters to append
+	 * @retval int error code
+	 * @note As with `copy`, length always reflects the required length so overflow() may be checked
+	 * after a sequence of operations instead of checking every return value.
+	 */
+	int append(const char* src, uint16_t srclen)
+	{
+		if(length < size) {
+			uint16_t copylen = std::min(srclen, uint16_t(size - length));
+			if(copylen != 0) {
+				memcpy(&buffer[length], src, copylen);
+			}
+		}
+		length += srclen;
+		terminate();
+		return overflow() ? Error::BufferTooSmall : FS_OK;
+	}
+
+	int append(PathView path)
+	{
+		return append(path.text, path.length);
+	}
+
+	/**
+	 * @brief Append a path element, adding a separator if required
+	 * @param name Name or relative path to append
+	 * @retval int error code
+	 */
+	int join(PathView name)
+	{
+		if(length != 0 && length <= size && buffer[length - 1] != '/') {
+			addSep();
+		}
+		return append(name);
+	}
+
+	int join(const NameBuffer& name)
+	{
+		return join(PathView(name.buffer, name.length));
+	}
+
 	/**
 	 * @brief When building file paths this method simplified appending separators
 	 * @retval int error code
@@ -188,6 +238,32 @@ struct NameBuffer {
 	}
 };
 
+/**
+ * @brief Name buffer with storage of a given size, intended for use on the stack
+ * @tparam bufferSize Size of buffer, including nul terminator
+ *
+ * Use to build paths without heap allocation:
+ *
+ * 		PathBuffer<PATH_MAX> path;
+ * 		path.copy(dirPath);
+ * 		path.join(stat.name);
+ * 		if(path.overflow()) {
+ * 			return Error::NameTooLong;
+ * 		}
+ */
+template <uint16_t bufferSize> struct PathBuffer : public NameBuffer {
+public:
+	PathBuffer() : NameBuffer(buffer, bufferSize)
+	{
+		buffer[0] = '\0';
+	}
+
+	PathBuffer(const PathBuffer&) = delete;
+
+private:
+	char buffer[bufferSize];
+};
+
 /**
  * @brief a quick'n'dirty name buffer with maximum path allocation
  */
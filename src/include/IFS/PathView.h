@@ -0,0 +1,127 @@
+/****
+ * PathView.h
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "Types.h"
+
+namespace IFS
+{
+/**
+ * @brief Non-owning reference to a path, or part of a path
+ *
+ * The text is identified by pointer and length so does not have to be nul-terminated.
+ * This allows path elements to be passed around without copying or allocating Strings.
+ *
+ * Filesystems which cannot consume a view directly will copy it into a stack buffer.
+ *
+ * @note The referenced text must remain valid for as long as the view is in use.
+ */
+struct PathView {
+	const char* text{nullptr}; ///< Start of path, need not be nul-terminated
+	uint16_t length{0};		   ///< Number of characters in path
+
+	PathView() = default;
+
+	PathView(const char* path) : text(path), length(path ? strlen(path) : 0)
+	{
+	}
+
+	PathView(const char* path, uint16_t length) : text(path), length(path ? length : 0)
+	{
+	}
+
+	PathView(const String& path) : text(path.c_str()), length(path.length())
+	{
+	}
+
+	/**
+	 * @brief Determine if this view refers to the root directory
+	 * @note Empty paths and "/" are equivalent
+	 */
+	bool isRoot() const
+	{
+		return length == 0 || (length == 1 && text[0] == '/');
+	}
+
+	/**
+	 * @brief Remove any leading separator
+	 * @retval bool true if resulting path is empty, i.e. refers to the root directory
+	 */
+	bool trimRoot()
+	{
+		if(length != 0 && text[0] == '/') {
+			++text;
+			--length;
+		}
+		return length == 0;
+	}
+
+	/**
+	 * @brief Get the final element of the path
+	 */
+	PathView name() const
+	{
+		for(unsigned i = length; i != 0; --i) {
+			if(text[i - 1] == '/') {
+				return PathView(&text[i], length - i);
+			}
+		}
+		return *this;
+	}
+
+	/**
+	 * @brief Get length of the first path element
+	 */
+	uint16_t elementLength() const
+	{
+		auto sep = static_cast<const char*>(memchr(text, '/', length));
+		return sep ? sep - text : length;
+	}
+
+	/**
+	 * @brief Advance the view past the given number of characters
+	 */
+	void skip(uint16_t count)
+	{
+		count = std::min(count, length);
+		text += count;
+		length -= count;
+	}
+
+	bool operator==(const char* other) const
+	{
+		if(other == nullptr) {
+			return length == 0;
+		}
+		return strncmp(text, other, length) == 0 && other[length] == '\0';
+	}
+
+	bool operator!=(const char* other) const
+	{
+		return !operator==(other);
+	}
+
+	explicit operator String() const
+	{
+		return String(text, length);
+	}
+};
+
+} // namespace IFS
@@ -0,0 +1,171 @@
+/****
+ * FileSystem.h
+ * Read-only union of several filesystem images
+ *
+ * Copyright 2024 mikee47 <mike@sillyhouse.net>
+ *
+ * This file is part of the IFS Library
+ *
+ * This library is free software: you can redistribute it and/or modify it under the terms of the
+ * GNU General Public License as published by the Free Software Foundation, version 3 or later.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this library.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ ****/
+
+#pragma once
+
+#include "../IFileSystem.h"
+#include <memory>
+
+// Maximum number of layers
+#ifndef UNIONFS_MAX_LAYERS
+#define UNIONFS_MAX_LAYERS 4
+#endif
+
+// File handles start at this value
+#ifndef UNIONFS_HANDLE_MIN
+#define UNIONFS_HANDLE_MIN 1100
+#endif
+
+// Maximum number of open files
+#ifndef UNIONFS_MAX_FDS
+#define UNIONFS_MAX_FDS 8
+#endif
+
+// Maximum file handle value
+#define UNIONFS_HANDLE_MAX (UNIONFS_HANDLE_MIN + UNIONFS_MAX_FDS - 1)
+
+namespace IFS::Union
+{
+struct FileDir;
+
+/**
+ * @brief Read-only union of filesystems, typically FWFS images
+ *
+ * Layers are added from the bottom up, so each layer shadows those added before it on a per-path basis.
+ * Directories present in more than one layer are merged when listed.
+ *
+ * When mounted, all layers are enumerated to build an index mapping path hashes to the topmost layer
+ * containing that path. Lookups then go directly to the correct layer, and paths which don't exist in any
+ * layer are rejected without probing each one. As different paths may share a hash, the located entry is
+ * always verified. If there isn't enough memory for the index then layers are searched in turn.
+ *
+ * @note Layers must not be modified whilst mounted.
+ */
+class FileSystem : public IFileSystem
+{
+public:
+	~FileSystem();
+
+	/**
+	 * @brief Add a layer above any existing ones
+	 * @param fileSystem Layer to add, ownership is transferred to this object
+	 * @retval int error code
+	 * @note Layers must be added before mounting
+	 */
+	int addLayer(IFileSystem* fileSystem);
+
+	/**
+	 * @brief Get number of index entries, 0 if index couldn't be built
+	 */
+	unsigned getIndexSize() const
+	{
+		return indexCount;
+	}
+
+	// IFileSystem methods
+	int mount() override;
+	int getinfo(Info& info) override;
+	int opendir(const char* path, DirHandle& dir) override;
+	int readdir(DirHandle dir, Stat& stat) override;
+	int rewinddir(DirHandle dir) override;
+	int telldir(DirHandle dir, DirCookie& cookie) override;
+	int seekdir(DirHandle dir, DirCookie cookie) override;
+	int closedir(DirHandle dir) override;
+	int mkdir(const char*) override
+	{
+		return Error::ReadOnly;
+	}
+	int stat(const char* path, Stat* stat) override;
+	int statat(DirHandle dir, const char* name, Stat* stat) override;
+	int fstat(FileHandle file, Stat* stat) override;
+	int fcontrol(FileHandle file, ControlCode code, void* buffer, size_t bufSize) override;
+	FileHandle open(const char* path, OpenFlags flags) override;
+	FileHandle openat(DirHandle dir, const char* name, OpenFlags flags) override;
+	int close(FileHandle file) override;
+	int read(FileHandle file, void* data, size_t size) override;
+	int write(FileHandle, const void*, size_t) override
+	{
+		return Error::ReadOnly;
+	}
+	file_offset_t lseek(FileHandle file, file_offset_t offset, SeekOrigin origin) override;
+	int eof(FileHandle file) override;
+	file_offset_t tell(FileHandle file) override;
+	int ftruncate(FileHandle, file_size_t) override
+	{
+		return Error::ReadOnly;
+	}
+	int flush(FileHandle) override
+	{
+		return Error::ReadOnly;
+	}
+	int fsetxattr(FileHandle, AttributeTag, const void*, size_t) override
+	{
+		return Error::ReadOnly;
+	}
+	int fgetxattr(FileHandle file, AttributeTag tag, void* buffer, size_t size) override;
+	int fenumxattr(FileHandle file, AttributeEnumCallback callback, void* buffer, size_t bufsize) override;
+	int setxattr(const char*, AttributeTag, const void*, size_t) override
+	{
+		return Error::ReadOnly;
+	}
+	int getxattr(const char* path, AttributeTag tag, void* buffer, size_t size) override;
+	int fgetextents(FileHandle file, Storage::Partition* part, Extent* list, uint16_t extcount) override;
+	int rename(const char*, const char*) override
+	{
+		return Error::ReadOnly;
+	}
+	int remove(const char*) override
+	{
+		return Error::ReadOnly;
+	}
+	int fremove(FileHandle) override
+	{
+		return Error::ReadOnly;
+	}
+	int format() override
+	{
+		return Error::ReadOnly;
+	}
+	int check() override;
+
+private:
+	struct FileDesc {
+		IFileSystem* fs;
+		FileHandle handle;
+	};
+
+	int buildIndex();
+	int indexDirectory(uint8_t layer, NameBuffer& path);
+	int addIndexEntry(uint8_t layer, const char* path);
+	int findTopLayer(const char* path) const;
+	int findLayer(const char* path, Stat* stat);
+	bool isShadowed(const FileDir& dir, const NameBuffer& name, uint8_t layer);
+	int openLayerDir(FileDir& dir, uint8_t layer);
+
+	IFileSystem* layers[UNIONFS_MAX_LAYERS]{};
+	FileDesc fileDescs[UNIONFS_MAX_FDS]{};
+	std::unique_ptr<uint32_t[]> index; ///< Sorted hash entries with layer number in low bits
+	unsigned indexCount{0};
+	unsigned indexCapacity{0};
+	uint8_t layerCount{0};
+	bool mounted{false};
+};
+
+} // namespace IFS::Union
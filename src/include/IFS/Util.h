@@ -36,6 +36,13 @@ namespace IFS
  */
 bool isRootPath(const char*& path);
 
+/**
+ * @brief Check if path view is root directory
+ * @param Path to check, any leading separator is removed
+ * @retval bool true if path is root directory
+ */
+bool isRootPath(PathView& path);
+
 #define FS_CHECK_PATH(path) isRootPath(path);
 
 /*
@@ -48,11 +48,14 @@ APP_CFLAGS += -DRESTART_DELAY=$(RESTART_DELAY)
 execute: flash run
 
 # This gets referred to using IMPORT_FSTR so need to build before code is compiled
-all: out/fwfsImage1.bin
+all: out/fwfsImage1.bin out/fwfsImage1.patch
 
 out/fwfsImage1.bin: out/backup.fwfs.bin out/large-random.bin
 out/backup.fwfs.bin:
 	$(Q) $(FSBUILD) -i backup.fwfs -o $@
+# Delta to build main image from backup image
+out/fwfsImage1.patch: out/backup.fwfs.bin out/fwfsImage1.bin
+	$(Q) $(FSDELTA) $^ -o $@
 # Checks Data24 so size needs to be >= 0x10000
 out/large-random.bin:
 	openssl rand -out $@ $$((0x12340))
@@ -60,4 +63,4 @@ out/large-random.bin:
 clean: fstest-clean
 .PHONY: fstest-clean
 fstest-clean:
-	$(Q) rm -f out/*.bin
+	$(Q) rm -f out/*.bin out/*.patch
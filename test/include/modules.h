@@ -1,7 +1,7 @@
 // List of test modules to register
 
 #ifdef ARCH_HOST
-#define HOST_TEST_MAP(XX) XX(Hybrid)
+#define HOST_TEST_MAP(XX) XX(Hybrid) XX(Allocation) XX(HybridPerformance)
 #else
 #define HOST_TEST_MAP(XX)
 #endif
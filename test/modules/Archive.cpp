@@ -8,6 +8,8 @@
 #include <FsTest.h>
 #include <IFS/Helpers.h>
 #include <IFS/FWFS/ArchiveStream.h>
+#include <IFS/FWFS/Lz4Encoder.h>
+#include <IFS/FWFS/ArchiveRestoreStream.h>
 #include <Storage/FileDevice.h>
 #include <LittleFS.h>
 #include <Data/Buffer/CircularBuffer.h>
@@ -16,6 +18,17 @@
 DEFINE_FSTR_LOCAL(LFS_ARCHIVE_BIN, "archive-lfs.bin")
 DEFINE_FSTR_LOCAL(LFS_ARCHIVE_FILTERED_BIN, "archive-lfs-filtered.bin")
 DEFINE_FSTR_LOCAL(FWFS_ARCHIVE_BIN, "archive-fwfs.bin")
+DEFINE_FSTR_LOCAL(FWFS_CHECKED_ARCHIVE_BIN, "archive-fwfs-checked.bin")
+DEFINE_FSTR_LOCAL(DEDUP_ARCHIVE_BIN, "archive-dedup.bin")
+DEFINE_FSTR_LOCAL(READAHEAD_ARCHIVE_BIN, "archive-readahead.bin")
+DEFINE_FSTR_LOCAL(BASE_ARCHIVE_BIN, "archive-base.bin")
+DEFINE_FSTR_LOCAL(TOUCHED_ARCHIVE_BIN, "archive-touched.bin")
+DEFINE_FSTR_LOCAL(DIFF_ARCHIVE_BIN, "archive-diff.bin")
+DEFINE_FSTR_LOCAL(RESTORED_ARCHIVE_BIN, "archive-restored.bin")
+DEFINE_FSTR_LOCAL(COMPRESSED_ARCHIVE_BIN, "archive-compressed.bin")
+DEFINE_FSTR_LOCAL(LARGE_ARCHIVE_BIN, "archive-large.bin")
+DEFINE_FSTR_LOCAL(SCRATCH_ARCHIVE_BIN, "archive-scratch.bin")
+DEFINE_FSTR_LOCAL(WRITETO_ARCHIVE_BIN, "archive-writeto.bin")
 
 using ArchiveStream = IFS::FWFS::ArchiveStream;
 
@@ -112,6 +125,32 @@ public:
 			file.setAttribute(IFS::AttributeTag::Comment, F("This is a file comment"));
 			return new XorEncoder(file);
 		});
+
+		TEST_CASE("Deduplicate file content")
+		{
+			dedupTest(*lfs);
+		}
+
+		TEST_CASE("Differential archive")
+		{
+			diffTest(*lfs);
+		}
+
+		TEST_CASE("Compress file content")
+		{
+			compressTest(*lfs);
+		}
+
+		TEST_CASE("Restore archive")
+		{
+			restoreTest(*lfs);
+		}
+
+		TEST_CASE("Large and deep directories")
+		{
+			largeDirectoryTest(*lfs);
+		}
+
 		delete lfs;
 
 		// Create an archive which should be byte-identical to original image
@@ -119,11 +158,38 @@ public:
 		auto fwfs = IFS::createFirmwareFilesystem(fwfsPart);
 		CHECK(fwfs != nullptr);
 		CHECK(fwfs->mount() == FS_OK);
+		// Image built by fsbuild contains a checksum, as does the archive built from it
+		CHECK(fwfs->check() == FS_OK);
 		IFS::FileSystem::NameInfo fsinfo;
 		int err = fwfs->getinfo(fsinfo);
 		CHECK(err >= 0);
 		volumeInfo = fsinfo;
 		backupFilesystem(*fwfs, volumeInfo, FWFS_ARCHIVE_BIN);
+		// Leave out the nested image to save space
+		auto filterNested = [](const IFS::Stat& stat) { return strcmp(stat.name.c_str(), "backup.fwfs.bin") != 0; };
+		backupFilesystem(*fwfs, volumeInfo, FWFS_CHECKED_ARCHIVE_BIN, filterNested, nullptr,
+						 ArchiveStream::Flag::DataChecksums);
+
+		TEST_CASE("Verify data checksums")
+		{
+			verifyDataChecksums(*fwfs, FWFS_CHECKED_ARCHIVE_BIN);
+		}
+
+		TEST_CASE("Read-ahead")
+		{
+			readAheadTest(*fwfs, volumeInfo);
+		}
+
+		TEST_CASE("Resume from checkpoint")
+		{
+			resumeTest(*fwfs, volumeInfo);
+		}
+
+		TEST_CASE("Write archive directly")
+		{
+			writeToTest(*fwfs, volumeInfo);
+		}
+
 		delete fwfs;
 
 		// Verify that the generated image is identical to the source image
@@ -151,7 +217,8 @@ public:
 
 	void backupFilesystem(IFS::FileSystem& fs, const ArchiveStream::VolumeInfo& volumeInfo, const String& filename,
 						  ArchiveStream::FilterStatCallback filterStat = nullptr,
-						  ArchiveStream::CreateEncoderCallback createEncoder = nullptr)
+						  ArchiveStream::CreateEncoderCallback createEncoder = nullptr,
+						  ArchiveStream::Flags flags = 0)
 	{
 		char name[64];
 		IFS::FileSystem::Info info{name, sizeof(name)};
@@ -160,7 +227,7 @@ public:
 				 filename.c_str());
 		printFsInfo(Serial, fs);
 		listDirectory(Serial, fs, nullptr, Option::attributes);
-		ArchiveStream archive(&fs, volumeInfo);
+		ArchiveStream archive(&fs, volumeInfo, nullptr, flags);
 		archive.onFilterStat(filterStat);
 		archive.onCreateEncoder(createEncoder);
 		FileStream stream;
@@ -191,6 +258,509 @@ public:
 		}
 	}
 
+	/*
+	 * Archive a directory containing two copies of the same file and check content is only stored once.
+	 * A file of the same size but different content must not match.
+	 */
+	void dedupTest(IFS::FileSystem& fs)
+	{
+		const String dir(F("dedup"));
+		const String files[]{dir + F("/copy1.js"), dir + F("/sub/copy2.js"), dir + F("/other.txt"),
+							 dir + F("/sub/same-size.js")};
+		const String content = fs.getContent(F("index.js"));
+		REQUIRE(content.length() > 255);
+		String altered(content);
+		altered[0] = (altered[0] == 'x') ? 'y' : 'x';
+		CHECK(fs.makedirs(dir + F("/sub")) >= 0);
+		CHECK(fs.setContent(files[0], content) >= 0);
+		CHECK(fs.setContent(files[1], content) >= 0);
+		CHECK(fs.setContent(files[2], content + content) >= 0);
+		CHECK(fs.setContent(files[3], altered) >= 0);
+
+		ArchiveStream::VolumeInfo volumeInfo;
+		volumeInfo.name = F("Deduplicated");
+		ArchiveStream archive(&fs, volumeInfo, dir, ArchiveStream::Flag::Deduplicate);
+		FileStream stream;
+		stream.open(DEDUP_ARCHIVE_BIN, File::CreateNewAlways | File::WriteOnly);
+		stream.copyFrom(&archive);
+		stream.close();
+		REQUIRE(archive.isSuccess());
+		CHECK_EQ(archive.getDedupCount(), 1U);
+		CHECK_EQ(archive.getDedupSize(), content.length());
+		debug_i("Archive is %u bytes, %u bytes deduplicated", fileGetSize(DEDUP_ARCHIVE_BIN), archive.getDedupSize());
+
+		auto archiveFs = fileMountArchive(DEDUP_ARCHIVE_BIN);
+		REQUIRE(archiveFs != nullptr);
+		REQUIRE(archiveFs->mount() >= 0);
+		for(auto& file : files) {
+			auto name = file.substring(dir.length() + 1);
+			CHECK(archiveFs->getContent(name) == fs.getContent(file));
+		}
+		delete archiveFs;
+
+		fileDelete(DEDUP_ARCHIVE_BIN);
+		for(auto& file : files) {
+			fs.remove(file);
+		}
+		fs.remove(dir + F("/sub"));
+		fs.remove(dir);
+	}
+
+	/*
+	 * Archive a directory then change it: a differential archive must only contain the changes,
+	 * and restoring it against the original archive must give the current content.
+	 */
+	void diffTest(IFS::FileSystem& fs)
+	{
+		const String dir(F("diff"));
+		const String files[]{dir + F("/same.js"), dir + F("/changed.js"), dir + F("/added.js")};
+		const String content = fs.getContent(F("index.js"));
+		REQUIRE(content.length() > 255);
+		CHECK(fs.makedirs(dir) >= 0);
+		CHECK(fs.setContent(files[0], content) >= 0);
+		CHECK(fs.setContent(files[1], content) >= 0);
+
+		auto createArchive = [&](IFS::FileSystem& src, const String& rootPath, const String& filename,
+								 IFS::IFileSystem* base) -> unsigned {
+			ArchiveStream::VolumeInfo volumeInfo;
+			volumeInfo.name = filename;
+			ArchiveStream archive(&src, volumeInfo, rootPath);
+			archive.setBase(base);
+			FileStream stream;
+			stream.open(filename, File::CreateNewAlways | File::WriteOnly);
+			stream.copyFrom(&archive);
+			stream.close();
+			CHECK(archive.isSuccess());
+			debug_i("'%s' is %u bytes, %u bytes in base", filename.c_str(), fileGetSize(filename),
+					archive.getBaseSize());
+			return archive.getBaseCount();
+		};
+
+		CHECK_EQ(createArchive(fs, dir, BASE_ARCHIVE_BIN, nullptr), 0U);
+
+		// Same layout as base, but unchanged file has a different timestamp
+		IFS::Stat stat;
+		CHECK(fs.stat(files[0], stat) >= 0);
+		CHECK(fs.settime(files[0], stat.mtime + 10) >= 0);
+		CHECK_EQ(createArchive(fs, dir, TOUCHED_ARCHIVE_BIN, nullptr), 0U);
+		CHECK(fs.settime(files[0], stat.mtime) >= 0);
+
+		CHECK(fs.setContent(files[1], content.substring(0, 100)) >= 0);
+		CHECK(fs.setContent(files[2], content) >= 0);
+
+		auto baseFs = fileMountArchive(BASE_ARCHIVE_BIN);
+		REQUIRE(baseFs != nullptr);
+		REQUIRE(baseFs->mount() >= 0);
+		CHECK_EQ(createArchive(fs, dir, DIFF_ARCHIVE_BIN, baseFs), 1U);
+
+		auto checkContent = [&](IFS::FileSystem& archiveFs) {
+			for(auto& file : files) {
+				auto name = file.substring(dir.length() + 1);
+				CHECK(archiveFs.getContent(name) == fs.getContent(file));
+			}
+		};
+
+		// Base is required to read unchanged files
+		auto diffFs = fileMountArchive(DIFF_ARCHIVE_BIN);
+		REQUIRE(diffFs != nullptr);
+		REQUIRE(diffFs->mount() >= 0);
+		{
+			IFS::File file(diffFs);
+			CHECK(file.open(F("same.js")));
+			char buffer[16];
+			CHECK_EQ(file.read(buffer, sizeof(buffer)), IFS::Error::NoFileSystem);
+		}
+		delete diffFs;
+
+		// Base file must match the one archived against
+		auto touchedFs = fileMountArchive(TOUCHED_ARCHIVE_BIN);
+		REQUIRE(touchedFs != nullptr);
+		REQUIRE(touchedFs->mount() >= 0);
+		diffFs = IFS::mountArchive(*getFileSystem(), DIFF_ARCHIVE_BIN, touchedFs);
+		REQUIRE(diffFs != nullptr);
+		{
+			IFS::File file(diffFs);
+			CHECK(file.open(F("same.js")));
+			char buffer[16];
+			CHECK_EQ(file.read(buffer, sizeof(buffer)), IFS::Error::BadObject);
+		}
+		delete diffFs;
+		delete touchedFs;
+
+		diffFs = IFS::mountArchive(*getFileSystem(), DIFF_ARCHIVE_BIN, baseFs);
+		REQUIRE(diffFs != nullptr);
+		checkContent(*diffFs);
+
+		// Restore full image
+		CHECK_EQ(createArchive(*diffFs, nullptr, RESTORED_ARCHIVE_BIN, nullptr), 0U);
+		delete diffFs;
+		delete baseFs;
+		auto restoredFs = fileMountArchive(RESTORED_ARCHIVE_BIN);
+		REQUIRE(restoredFs != nullptr);
+		REQUIRE(restoredFs->mount() >= 0);
+		checkContent(*restoredFs);
+		delete restoredFs;
+
+		fileDelete(BASE_ARCHIVE_BIN);
+		fileDelete(TOUCHED_ARCHIVE_BIN);
+		fileDelete(DIFF_ARCHIVE_BIN);
+		fileDelete(RESTORED_ARCHIVE_BIN);
+		for(auto& file : files) {
+			fs.remove(file);
+		}
+		fs.remove(dir);
+	}
+
+	/*
+	 * Text files should be compressed and decode to their original content, images left alone
+	 */
+	void compressTest(IFS::FileSystem& fs)
+	{
+		ArchiveStream::VolumeInfo volumeInfo;
+		volumeInfo.name = F("Compressed");
+		ArchiveStream archive(&fs, volumeInfo, nullptr, ArchiveStream::Flag::Compress);
+		FileStream stream;
+		stream.open(COMPRESSED_ARCHIVE_BIN, File::CreateNewAlways | File::WriteOnly);
+		stream.copyFrom(&archive);
+		stream.close();
+		REQUIRE(archive.isSuccess());
+
+		auto archiveFs = fileMountArchive(COMPRESSED_ARCHIVE_BIN);
+		REQUIRE(archiveFs != nullptr);
+		REQUIRE(archiveFs->mount() >= 0);
+		CHECK(archiveFs->check() == FS_OK);
+
+		auto getContent = [&](const String& name) -> String {
+			IFS::Stat stat;
+			CHECK(archiveFs->stat(name, &stat) >= 0);
+			if(stat.compression.type != IFS::Compression::Type::LZ4) {
+				return archiveFs->getContent(name);
+			}
+			debug_i("'%s' compressed from %u to %u bytes", name.c_str(), stat.compression.originalSize, stat.size);
+			CHECK(stat.size < stat.compression.originalSize);
+			auto src = new IFS::FileStream(archiveFs);
+			CHECK(src->open(name));
+			IFS::FWFS::Lz4Decoder decoder(src, stat.compression.originalSize);
+			String content;
+			char buffer[200];
+			while(!decoder.isFinished()) {
+				auto len = decoder.readMemoryBlock(buffer, sizeof(buffer));
+				if(len == 0) {
+					break;
+				}
+				content.concat(buffer, len);
+				decoder.seek(len);
+			}
+			CHECK(!decoder.isFailed());
+			return content;
+		};
+
+		for(auto name : {F("stswsio.js"), F("index.js"), F("error.html"), F("apple-touch-icon-180x180.png")}) {
+			CHECK(getContent(name) == fs.getContent(name));
+		}
+
+		IFS::Stat stat;
+		CHECK(archiveFs->stat(F("stswsio.js"), &stat) >= 0);
+		CHECK(stat.compression.type == IFS::Compression::Type::LZ4);
+		CHECK(archiveFs->stat(F("apple-touch-icon-180x180.png"), &stat) >= 0);
+		CHECK(stat.compression.type == IFS::Compression::Type::None);
+		delete archiveFs;
+
+		fileDelete(COMPRESSED_ARCHIVE_BIN);
+	}
+
+	/*
+	 * Restoring an archive as it's generated must reproduce the original directory tree
+	 */
+	void restoreTest(IFS::FileSystem& fs)
+	{
+		const String dir(F("restore"));
+		const String target(F("restored"));
+		const String files[]{F("/copy1.js"), F("/sub/copy2.js"), F("/sub/deeper/copy3.js"), F("/other.txt")};
+		const String content = fs.getContent(F("index.js"));
+		REQUIRE(content.length() > 255);
+		CHECK(fs.makedirs(dir + F("/sub/deeper/")) >= 0);
+		for(unsigned i = 0; i < ARRAY_SIZE(files); ++i) {
+			CHECK(fs.setContent(dir + files[i], (i == 3) ? content + content : content) >= 0);
+		}
+
+		ArchiveStream::VolumeInfo volumeInfo;
+		volumeInfo.name = F("Restore");
+		ArchiveStream::Flags flags = ArchiveStream::Flag::Deduplicate;
+		flags += ArchiveStream::Flag::DataChecksums;
+		ArchiveStream archive(&fs, volumeInfo, dir, flags);
+		IFS::FWFS::ArchiveRestoreStream restore(&fs, target);
+		restore.copyFrom(&archive);
+		REQUIRE(archive.isSuccess());
+		REQUIRE(restore.isSuccess());
+		CHECK_EQ(restore.getFileCount(), ARRAY_SIZE(files));
+		CHECK_EQ(restore.getDirectoryCount(), 2U);
+		for(auto& file : files) {
+			CHECK(fs.getContent(target + file) == fs.getContent(dir + file));
+		}
+		CHECK(fs.stat(target + F("/" FWFS_RESTORE_STAGE_DIR), nullptr) < 0);
+
+		for(auto path : {dir, target}) {
+			for(auto& file : files) {
+				fs.remove(path + file);
+			}
+			fs.remove(path + F("/sub/deeper"));
+			fs.remove(path + F("/sub"));
+			fs.remove(path);
+		}
+
+		/*
+		 * Duplicate content may refer to any file in the deduplication table,
+		 * not just the most recent ones
+		 */
+		const unsigned fileCount{12};
+		CHECK(fs.makedirs(dir + '/') >= 0);
+		for(unsigned i = 0; i < fileCount; ++i) {
+			CHECK(fs.setContent(dir + F("/file") + char('a' + i), content + i) >= 0);
+		}
+		CHECK(fs.setContent(dir + F("/zcopy"), content + 0U) >= 0);
+		ArchiveStream archive2(&fs, volumeInfo, dir, flags);
+		IFS::FWFS::ArchiveRestoreStream restore2(&fs, target);
+		restore2.copyFrom(&archive2);
+		REQUIRE(archive2.isSuccess());
+		CHECK_EQ(archive2.getDedupCount(), 1U);
+		REQUIRE(restore2.isSuccess());
+		CHECK(fs.getContent(target + F("/zcopy")) == fs.getContent(dir + F("/filea")));
+
+		for(auto path : {dir, target}) {
+			for(unsigned i = 0; i < fileCount; ++i) {
+				fs.remove(path + F("/file") + char('a' + i));
+			}
+			fs.remove(path + F("/zcopy"));
+			fs.remove(path);
+		}
+	}
+
+	/*
+	 * Holding child tables in a scratch file must not change the archive, but use less RAM.
+	 * Nesting is not limited to a fixed depth.
+	 */
+	void largeDirectoryTest(IFS::FileSystem& fs)
+	{
+		const String dir(F("large"));
+		constexpr unsigned fileCount{200};
+		constexpr unsigned depth{24};
+		CHECK(fs.makedirs(dir + '/') >= 0);
+		for(unsigned i = 0; i < fileCount; ++i) {
+			CHECK(fs.setContent(dir + F("/file") + i, String(i)) >= 0);
+		}
+		String path = dir;
+		for(unsigned i = 0; i < depth; ++i) {
+			path += F("/d");
+			CHECK(fs.mkdir(path) >= 0);
+		}
+		CHECK(fs.setContent(path + F("/deepest.txt"), path) >= 0);
+
+		auto createArchive = [&](const String& filename, bool useScratch) -> size_t {
+			ArchiveStream::VolumeInfo volumeInfo;
+			volumeInfo.name = F("Large");
+			ArchiveStream archive(&fs, volumeInfo, dir);
+			if(useScratch) {
+				archive.setScratch(&fs, F("archive.tmp"));
+			}
+			FileStream stream;
+			stream.open(filename, File::CreateNewAlways | File::WriteOnly);
+			stream.copyFrom(&archive);
+			stream.close();
+			CHECK(archive.isSuccess());
+			debug_i("'%s' is %u bytes, peak RAM %u bytes", filename.c_str(), fileGetSize(filename),
+					archive.getPeakMemoryUsage());
+			return archive.getPeakMemoryUsage();
+		};
+
+		auto ramUsage = createArchive(LARGE_ARCHIVE_BIN, false);
+		auto scratchRamUsage = createArchive(SCRATCH_ARCHIVE_BIN, true);
+		CHECK(scratchRamUsage < ramUsage);
+		CHECK(fs.stat(F("archive.tmp0"), nullptr) < 0);
+		CHECK(fileGetContent(LARGE_ARCHIVE_BIN) == fileGetContent(SCRATCH_ARCHIVE_BIN));
+
+		auto archiveFs = fileMountArchive(SCRATCH_ARCHIVE_BIN);
+		REQUIRE(archiveFs != nullptr);
+		REQUIRE(archiveFs->mount() >= 0);
+		CHECK(archiveFs->check() == FS_OK);
+		CHECK(archiveFs->getContent(F("file123")) == F("123"));
+		CHECK(archiveFs->getContent(path.substring(dir.length() + 1) + F("/deepest.txt")) == path);
+		delete archiveFs;
+
+		fileDelete(LARGE_ARCHIVE_BIN);
+		fileDelete(SCRATCH_ARCHIVE_BIN);
+		fs.remove(path + F("/deepest.txt"));
+		while(path.length() > dir.length()) {
+			fs.remove(path);
+			path.setLength(path.lastIndexOf('/'));
+		}
+		for(unsigned i = 0; i < fileCount; ++i) {
+			fs.remove(dir + F("/file") + i);
+		}
+		fs.remove(dir);
+	}
+
+	/*
+	 * Reading file content ahead must not change the archive
+	 */
+	void readAheadTest(IFS::FileSystem& fs, const ArchiveStream::VolumeInfo& volumeInfo)
+	{
+		ArchiveStream archive(&fs, volumeInfo, nullptr, ArchiveStream::Flag::ReadAhead);
+		FileStream stream;
+		stream.open(READAHEAD_ARCHIVE_BIN, File::CreateNewAlways | File::WriteOnly);
+		stream.copyFrom(&archive);
+		stream.close();
+		REQUIRE(archive.isSuccess());
+
+		compareFiles(FWFS_ARCHIVE_BIN, READAHEAD_ARCHIVE_BIN);
+
+		fileDelete(READAHEAD_ARCHIVE_BIN);
+	}
+
+	/*
+	 * Output from writeTo() must be identical to that read as a stream, whatever the buffer size
+	 */
+	void writeToTest(IFS::FileSystem& fs, const ArchiveStream::VolumeInfo& volumeInfo)
+	{
+		auto size = fileGetSize(FWFS_ARCHIVE_BIN);
+
+		ArchiveStream archive(&fs, volumeInfo);
+		FileStream stream;
+		stream.open(WRITETO_ARCHIVE_BIN, File::CreateNewAlways | File::WriteOnly);
+		CHECK_EQ(archive.writeTo(stream), int(size));
+		stream.close();
+		REQUIRE(archive.isSuccess());
+		compareFiles(FWFS_ARCHIVE_BIN, WRITETO_ARCHIVE_BIN);
+
+		// Small buffer, continuing after partial read
+		archive.reset();
+		char buf[100];
+		auto len = archive.readMemoryBlock(buf, sizeof(buf));
+		archive.seek(len);
+		auto outfs = getFileSystem();
+		auto file = outfs->open(WRITETO_ARCHIVE_BIN, File::CreateNewAlways | File::WriteOnly);
+		REQUIRE(file >= 0);
+		CHECK_EQ(outfs->write(file, buf, len), int(len));
+		CHECK_EQ(archive.writeTo(*outfs, file, 100), int(size - len));
+		outfs->close(file);
+		REQUIRE(archive.isSuccess());
+		compareFiles(FWFS_ARCHIVE_BIN, WRITETO_ARCHIVE_BIN);
+
+		fileDelete(WRITETO_ARCHIVE_BIN);
+	}
+
+	void compareFiles(const String& filename1, const String& filename2)
+	{
+		File f1;
+		File f2;
+		REQUIRE(f1.open(filename1));
+		REQUIRE(f2.open(filename2));
+		REQUIRE_EQ(f1.getSize(), f2.getSize());
+		char buf1[512];
+		char buf2[512];
+		int len;
+		while((len = f1.read(buf1, sizeof(buf1))) > 0) {
+			REQUIRE_EQ(f2.read(buf2, sizeof(buf2)), len);
+			REQUIRE(memcmp(buf1, buf2, len) == 0);
+		}
+	}
+
+	/*
+	 * Output following a seek or resume must be identical to the original archive
+	 */
+	void resumeTest(IFS::FileSystem& fs, const ArchiveStream::VolumeInfo& volumeInfo)
+	{
+		File ref;
+		REQUIRE(ref.open(FWFS_ARCHIVE_BIN));
+		auto size = ref.getSize();
+
+		// Compare archive output from given position to end
+		auto compare = [&](ArchiveStream& archive, uint32_t offset) {
+			CHECK(ref.seek(offset, SeekOrigin::Start) == int(offset));
+			char buf1[512];
+			char buf2[512];
+			while(!archive.isFinished()) {
+				auto len = archive.readMemoryBlock(buf1, sizeof(buf1));
+				if(len == 0) {
+					continue;
+				}
+				archive.seek(len);
+				REQUIRE_EQ(ref.read(buf2, len), int(len));
+				REQUIRE(memcmp(buf1, buf2, len) == 0);
+				offset += len;
+			}
+			REQUIRE(archive.isSuccess());
+			CHECK_EQ(offset, size);
+		};
+
+		ArchiveStream archive(&fs, volumeInfo, nullptr, ArchiveStream::Flag::Checkpoints);
+		compare(archive, 0);
+		auto checkpoint = archive.getCheckpoint(size);
+		REQUIRE(checkpoint != nullptr);
+		debug_i("Last checkpoint @ %u, %u bytes", checkpoint->offset, checkpoint->data.length());
+
+		for(uint32_t offset : {size / 2, size / 4, size - 1}) {
+			CHECK_EQ(archive.seekFrom(offset, SeekOrigin::Start), int(offset));
+			compare(archive, offset);
+		}
+
+		ArchiveStream archive2(&fs, volumeInfo);
+		REQUIRE(archive2.resume(*checkpoint));
+		compare(archive2, checkpoint->offset);
+	}
+
+	/*
+	 * Content must be unaffected by checksums, but any corruption must be reported on first read
+	 */
+	void verifyDataChecksums(IFS::FileSystem& ref, const String& filename)
+	{
+		const String largeFile(F("large-random.bin"));
+		const String smallFile(F("error.html"));
+
+		auto fs = fileMountArchive(filename);
+		REQUIRE(fs != nullptr);
+		REQUIRE(fs->mount() >= 0);
+		CHECK(fs->check() == FS_OK);
+		CHECK(fs->getContent(largeFile) == ref.getContent(largeFile));
+		CHECK(fs->getContent(smallFile) == ref.getContent(smallFile));
+
+		// Locate some file data to corrupt
+		auto getDataOffset = [&](const String& name) -> uint32_t {
+			IFS::File file(fs);
+			CHECK(file.open(name));
+			IFS::Extent ext{};
+			CHECK(file.getExtents(nullptr, &ext, 1) == 1);
+			return ext.offset + ext.length / 2;
+		};
+		uint32_t offsets[]{getDataOffset(largeFile), getDataOffset(smallFile)};
+		delete fs;
+
+		File f;
+		REQUIRE(f.open(filename, File::ReadWrite));
+		for(auto offset : offsets) {
+			char c;
+			CHECK(f.seek(offset, SeekOrigin::Start) == int(offset));
+			CHECK(f.read(&c, 1) == 1);
+			c ^= 0x55;
+			CHECK(f.seek(offset, SeekOrigin::Start) == int(offset));
+			CHECK(f.write(&c, 1) == 1);
+		}
+		f.close();
+
+		fs = fileMountArchive(filename);
+		REQUIRE(fs != nullptr);
+		REQUIRE(fs->mount() >= 0);
+		for(auto& name : {largeFile, smallFile}) {
+			IFS::File file(fs);
+			CHECK(file.open(name));
+			char buffer[16];
+			CHECK_EQ(file.read(buffer, sizeof(buffer)), IFS::Error::BadChecksum);
+		}
+		delete fs;
+
+		fileDelete(filename);
+	}
+
 	void listImage(const String& filename)
 	{
 		m_puts("\r\n");
@@ -0,0 +1,156 @@
+/*
+ * Allocation.cpp
+ *
+ * Check path operations don't hit the heap
+ */
+
+#include <FsTest.h>
+#include <IFS/Host/FileSystem.h>
+#include <IFS/FWFS/ArchiveStream.h>
+
+#ifdef ENABLE_MALLOC_COUNT
+#include <malloc_count.h>
+#endif
+
+namespace
+{
+DEFINE_FSTR(FWFS_FILENAME, "apple-touch-icon-180x180.png")
+DEFINE_FSTR(FWFS_NESTED_FILENAME, "A Subdirectory/a/b/c/d/e/f/lonely.txt")
+DEFINE_FSTR(HOST_DIRNAME, "files")
+DEFINE_FSTR(HOST_FILENAME, "files/index.html")
+
+#define ITERATIONS 100
+
+} // namespace
+
+class AllocationTest : public TestGroup
+{
+public:
+	AllocationTest() : TestGroup(_F("Path allocation tests"))
+	{
+	}
+
+	void execute() override
+	{
+#ifndef ENABLE_MALLOC_COUNT
+		Serial.println(_F("malloc_count not enabled, skipping"));
+#else
+		TEST_CASE("FWFS path operations")
+		{
+			fileSetFileSystem(nullptr);
+			fwfs_mount();
+			auto fs = getFileSystem();
+			REQUIRE(fs != nullptr);
+
+			checkStat(*fs, String(FWFS_FILENAME).c_str());
+			checkStat(*fs, String(FWFS_NESTED_FILENAME).c_str());
+			checkOpen(*fs, String(FWFS_NESTED_FILENAME).c_str());
+			checkReaddir(*fs, nullptr);
+			fileSetFileSystem(nullptr);
+		}
+
+		TEST_CASE("Host path operations")
+		{
+			auto& fs = IFS::Host::getFileSystem();
+			checkStat(fs, String(HOST_FILENAME).c_str());
+			checkOpen(fs, String(HOST_FILENAME).c_str());
+			checkReaddir(fs, String(HOST_DIRNAME).c_str());
+		}
+
+		TEST_CASE("Archive heap usage")
+		{
+			fileSetFileSystem(nullptr);
+			fwfs_mount();
+			auto fs = getFileSystem();
+			REQUIRE(fs != nullptr);
+
+			// Pre-sizing buffers avoids reallocation
+			auto allocs = checkArchive(*fs, 0);
+			CHECK(checkArchive(*fs, 512) <= allocs);
+			fileSetFileSystem(nullptr);
+		}
+#endif
+	}
+
+#ifdef ENABLE_MALLOC_COUNT
+	void checkStat(IFS::IFileSystem& fs, const char* path)
+	{
+		IFS::Stat stat;
+		auto count = MallocCount::getAllocCount();
+		for(unsigned i = 0; i < ITERATIONS; ++i) {
+			int err = fs.stat(path, &stat);
+			CHECK(err >= 0);
+		}
+		auto allocs = MallocCount::getAllocCount() - count;
+		debug_i("stat('%s'): %u allocations", path, allocs);
+		CHECK_EQ(allocs, 0);
+	}
+
+	void checkOpen(IFS::IFileSystem& fs, const char* path)
+	{
+		auto count = MallocCount::getAllocCount();
+		for(unsigned i = 0; i < ITERATIONS; ++i) {
+			auto file = fs.open(path, IFS::OpenFlag::Read);
+			CHECK(file >= 0);
+			fs.close(file);
+		}
+		auto allocs = MallocCount::getAllocCount() - count;
+		debug_i("open('%s'): %u allocations", path, allocs);
+		CHECK_EQ(allocs, 0);
+	}
+
+	/*
+	 * Opening a directory may allocate a descriptor, but reading entries must not
+	 */
+	void checkReaddir(IFS::IFileSystem& fs, const char* path)
+	{
+		IFS::DirHandle dir;
+		int err = fs.opendir(path, dir);
+		REQUIRE(err >= 0);
+		IFS::NameStat stat;
+		unsigned entries{0};
+		auto count = MallocCount::getAllocCount();
+		while(fs.readdir(dir, stat) >= 0) {
+			++entries;
+		}
+		auto allocs = MallocCount::getAllocCount() - count;
+		fs.closedir(dir);
+		debug_i("readdir('%s'): %u entries, %u allocations", path ?: "", entries, allocs);
+		CHECK(entries != 0);
+		CHECK_EQ(allocs, 0);
+	}
+
+	/*
+	 * Object buffers are re-used for each file, so allocations are mostly due to opening files and directories
+	 */
+	unsigned checkArchive(IFS::FileSystem& fs, size_t bufferSize)
+	{
+		IFS::FWFS::ArchiveStream::VolumeInfo volumeInfo;
+		IFS::FWFS::ArchiveStream archive(&fs, volumeInfo);
+		archive.setBufferSize(bufferSize);
+
+		auto count = MallocCount::getAllocCount();
+		MallocCount::resetPeak();
+		auto heapStart = MallocCount::getCurrent();
+		size_t size{0};
+		char buffer[512];
+		while(!archive.isFinished()) {
+			auto len = archive.readMemoryBlock(buffer, sizeof(buffer));
+			archive.seek(len);
+			size += len;
+		}
+		unsigned allocs = MallocCount::getAllocCount() - count;
+		auto heapPeak = MallocCount::getPeak() - heapStart;
+		CHECK(archive.isSuccess());
+
+		debug_i("Archive with %u byte buffers: %u bytes, %u allocations, peak heap %u, peak buffer usage %u",
+				bufferSize, size, allocs, heapPeak, archive.getPeakMemoryUsage());
+		return allocs;
+	}
+#endif
+};
+
+void REGISTER_TEST(Allocation)
+{
+	registerGroup<AllocationTest>();
+}
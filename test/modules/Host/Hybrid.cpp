@@ -11,6 +11,8 @@
 
 #include <IFS/Host/FileSystem.h>
 #include <IFS/Helpers.h>
+#include <IFS/FWFS/PatchStream.h>
+#include <IFS/HYFS/CowFile.h>
 #include <Storage/FileDevice.h>
 #include <Storage/ProgMem.h>
 #include <Crypto/Md5.h>
@@ -18,6 +20,8 @@
 #include <LittleFS.h>
 
 using SubType = Storage::Partition::SubType::Data;
+using HybridFlag = IFS::HYFS::FileSystem::Flag;
+using HybridFlags = IFS::HYFS::FileSystem::Flags;
 
 namespace
 {
@@ -31,8 +35,23 @@ DEFINE_FSTR(FS_PART_FWFS2, "fwfs2")
 
 IMPORT_FSTR(fwfsImage1, PROJECT_DIR "/out/fwfsImage1.bin")
 
+// Builds fwfsImage1 from the backup image it contains
+IMPORT_FSTR(fwfsPatch, PROJECT_DIR "/out/fwfsImage1.patch")
+
 DEFINE_FSTR(BACKUP_FWFS, "backup.fwfs.bin")
 
+// Flattened hybrid filesystem
+DEFINE_FSTR(FLAT_IMGFILE, "out/flat-fwfs.bin")
+
+// Result of applying fwfsPatch
+DEFINE_FSTR(PATCHED_IMGFILE, "out/patched-fwfs.bin")
+
+// Patch image for union test
+DEFINE_FSTR(PATCH_IMGFILE, "out/patch-fwfs.bin")
+
+// Large uncompressed file for copy-on-write test
+DEFINE_FSTR(COW_FILENAME, "large-random.bin")
+
 // Flash Filesystem parameters
 #define FFS_FLASH_SIZE (2 * 1024 * 1024)
 
@@ -69,17 +88,118 @@ public:
 			destroyStorageDevice(LFS_IMGFILE);
 		}
 
+		TEST_CASE("Verify Hybrid LittleFS copy-on-write")
+		{
+			verify(part, SubType::littlefs, HybridFlag::copyOnWrite);
+			destroyStorageDevice(LFS_IMGFILE);
+		}
+
+		TEST_CASE("Verify Hybrid LittleFS lazy copy")
+		{
+			verify(part, SubType::littlefs, HybridFlag::lazyCopy);
+			destroyStorageDevice(LFS_IMGFILE);
+		}
+
+		TEST_CASE("Hybrid LittleFS journal")
+		{
+			journalTest(part, SubType::littlefs);
+			destroyStorageDevice(LFS_IMGFILE);
+		}
+
+		TEST_CASE("Flatten Hybrid LittleFS")
+		{
+			flattenTest(part, SubType::littlefs);
+			destroyStorageDevice(LFS_IMGFILE);
+		}
+
+		TEST_CASE("Union of FWFS images")
+		{
+			unionTest(part);
+			destroyStorageDevice(LFS_IMGFILE);
+		}
+
+		TEST_CASE("Apply FWFS delta patch")
+		{
+			patchTest(part);
+		}
+
+		TEST_CASE("Directory cookies")
+		{
+			pagedListTest(*fwfsRef, nullptr);
+			pagedListTest(*fwfsRef, "A Subdirectory");
+			pagedListTest(IFS::Host::getFileSystem(), "files");
+
+			// LittleFS doesn't support telldir() so entry numbers are used for the FFS layer
+			auto fs = initFWFS(part, SubType::littlefs);
+			REQUIRE(fs != nullptr);
+			REQUIRE(fs->format() >= 0);
+			CHECK(fs->setContent(F("README.rst"), F("Overridden")) >= 0);
+			CHECK(fs->setContent(F("paged.txt"), F("New file")) >= 0);
+			CHECK(fs->setContent(F("A Subdirectory/paged.txt"), F("New file")) >= 0);
+			pagedListTest(*fs, nullptr);
+			pagedListTest(*fs, "A Subdirectory");
+			delete fs;
+			destroyStorageDevice(LFS_IMGFILE);
+		}
+
 		listPartitions(Serial);
 		listDevices(Serial);
 	}
 
-	void verify(Storage::Partition fwfsPart, SubType subtype)
+	/*
+	 * Check listing can be resumed from any position using a new directory handle
+	 */
+	void pagedListTest(FileSystem& fs, const String& path)
 	{
-		auto fs = initFWFS(fwfsPart, subtype);
+		const unsigned pageSize{3};
+
+		Vector<String> names;
+		Vector<IFS::DirCookie> cookies;
+		{
+			IFS::Directory dir(&fs);
+			REQUIRE(dir.open(path));
+			for(;;) {
+				IFS::DirCookie cookie;
+				if(!dir.tell(cookie)) {
+					debug_e("telldir('%s'): %s", path.c_str(), dir.getLastErrorString().c_str());
+					TEST_ASSERT(false);
+				}
+				if(!dir.next()) {
+					break;
+				}
+				cookies.add(cookie);
+				names.add(dir.stat().name.c_str());
+			}
+		}
+
+		for(unsigned i = 0; i < names.count(); ++i) {
+			IFS::Directory dir(&fs);
+			REQUIRE(dir.open(path));
+			REQUIRE(dir.seek(cookies[i]));
+			for(unsigned j = i; j < names.count() && j < i + pageSize; ++j) {
+				REQUIRE(dir.next());
+				CHECK_EQ(String(dir.stat().name.c_str()), names[j]);
+			}
+		}
+
+		debug_i("Paged listing of '%s' OK, %u entries", path.c_str(), names.count());
+	}
+
+	void verify(Storage::Partition fwfsPart, SubType subtype, HybridFlags hybridFlags = 0)
+	{
+		auto fs = initFWFS(fwfsPart, subtype, hybridFlags);
 		CHECK(fs != nullptr);
 		if(fs != nullptr) {
 			fstest(*fs, Flag::readFileTest | Flag::writeThroughTest);
 
+			if(hybridFlags[HybridFlag::copyOnWrite]) {
+				copyOnWriteTest(*fs);
+			}
+
+			if(hybridFlags[HybridFlag::lazyCopy]) {
+				lazyCopyTest(*fs);
+			}
+
 			Serial.println();
 
 			auto part = createFwfsPartition(*fs, BACKUP_FWFS);
@@ -287,14 +407,14 @@ public:
 		}
 	}
 
-	FileSystem* initFWFS(Storage::Partition fwfsPart, SubType subtype)
+	FileSystem* initFWFS(Storage::Partition fwfsPart, SubType subtype, HybridFlags hybridFlags = 0)
 	{
 		FileSystem* fs;
 		if(subtype == SubType::fwfs) {
 			fs = IFS::createFirmwareFilesystem(fwfsPart);
 		} else {
 			auto ffs = createFilesystem(subtype);
-			fs = ffs ? IFS::createHybridFilesystem(fwfsPart, ffs) : nullptr;
+			fs = ffs ? IFS::createHybridFilesystem(fwfsPart, ffs, hybridFlags) : nullptr;
 		}
 		CHECK(fs != nullptr);
 		if(fs == nullptr) {
@@ -311,6 +431,417 @@ public:
 		return fs;
 	}
 
+	/*
+	 * Modify a large FW file and check only changed blocks get stored
+	 */
+	void copyOnWriteTest(FileSystem& fs)
+	{
+		const String filename(COW_FILENAME);
+		auto original = fwfsRef->getContent(filename);
+		REQUIRE(original.length() > 4 * HYFS_COW_BLOCK_SIZE);
+
+		auto expected = original;
+		DEFINE_FSTR_LOCAL(patch, "This block has been modified")
+		DEFINE_FSTR_LOCAL(tail, "Appended to end of file")
+		const unsigned patchOffset = HYFS_COW_BLOCK_SIZE + 100;
+		memcpy(expected.begin() + patchOffset, String(patch).c_str(), patch.length());
+		expected += tail;
+
+		IFS::File file(&fs);
+		REQUIRE(file.open(filename, IFS::File::ReadWrite));
+		CHECK_EQ(file.seek(patchOffset, SeekOrigin::Start), int(patchOffset));
+		CHECK(file.write(patch));
+		REQUIRE(file.open(filename, IFS::File::WriteOnly | IFS::File::Append));
+		CHECK(file.write(tail));
+		file.close();
+
+		CHECK(fs.getContent(filename) == expected);
+
+		// Sidecar holds only the modified blocks
+		IFS::Stat stat;
+		REQUIRE(fs.stat(filename, &stat) >= 0);
+		CHECK_EQ(stat.size, expected.length());
+		REQUIRE(fs.stat(filename + HYFS_COW_SUFFIX, &stat) >= 0);
+		debug_i("Sidecar size %u for file size %u", unsigned(stat.size), expected.length());
+		CHECK(stat.size < 4 * HYFS_COW_BLOCK_SIZE);
+
+		// File listed once, with correct size, and sidecar hidden
+		unsigned count{0};
+		IFS::Directory dir(&fs);
+		REQUIRE(dir.open());
+		while(dir.next()) {
+			CHECK(!dir.stat().name.endsWith(HYFS_COW_SUFFIX));
+			if(filename == dir.stat().name.c_str()) {
+				++count;
+				CHECK_EQ(dir.stat().size, expected.length());
+			}
+		}
+		CHECK_EQ(count, 1);
+
+		// Simulate an image update by changing the sidecar header
+		IFS::HYFS::CowFile::Header header;
+		auto updateHeader = [&](void (*modify)(IFS::HYFS::CowFile::Header& header)) {
+			auto sidecar = fs.open(filename + HYFS_COW_SUFFIX, IFS::File::ReadWrite);
+			REQUIRE(sidecar >= 0);
+			CHECK_EQ(fs.read(sidecar, &header, sizeof(header)), int(sizeof(header)));
+			auto modified = header;
+			modify(modified);
+			CHECK(fs.lseek(sidecar, 0, SeekOrigin::Start) == 0);
+			CHECK_EQ(fs.write(sidecar, &modified, sizeof(modified)), int(sizeof(modified)));
+			fs.close(sidecar);
+		};
+
+		// Base file unchanged in new image, so sidecar is still used
+		updateHeader([](IFS::HYFS::CowFile::Header& header) { header.fwCreationTime = header.fwCreationTime + 1; });
+		CHECK(fs.getContent(filename) == expected);
+
+		// Base file changed, so blocks can't be used
+		updateHeader([](IFS::HYFS::CowFile::Header& header) {
+			header.fwCreationTime = header.fwCreationTime + 1;
+			header.fwMtime = header.fwMtime + 1;
+		});
+		CHECK_EQ(fs.open(filename), IFS::Error::BadObject);
+		CHECK_EQ(fs.stat(filename, nullptr), IFS::Error::BadObject);
+		{
+			IFS::DirHandle dir;
+			REQUIRE(fs.opendir(nullptr, dir) >= 0);
+			unsigned errorCount{0};
+			int res;
+			while((res = fs.readdir(dir, stat)) >= 0 || res == IFS::Error::BadObject) {
+				if(res < 0) {
+					CHECK(filename == stat.name.c_str());
+					++errorCount;
+				}
+			}
+			fs.closedir(dir);
+			CHECK_EQ(errorCount, 1);
+		}
+		updateHeader([](IFS::HYFS::CowFile::Header& header) { header.fwMtime = header.fwMtime - 1; });
+
+		// Sidecar converted into a full copy which no longer depends on FW image
+		auto& hyfs = static_cast<IFS::HYFS::FileSystem&>(static_cast<IFS::IFileSystem&>(fs));
+		CHECK_EQ(hyfs.expandSidecars(), 1);
+		CHECK_EQ(fs.stat(filename + HYFS_COW_SUFFIX, nullptr), IFS::Error::NotFound);
+		CHECK(fs.getContent(filename) == expected);
+
+		// Removing the file reveals the original
+		CHECK(fs.remove(filename) >= 0);
+		CHECK(fs.getContent(filename) == original);
+	}
+
+	/*
+	 * Determine if a hybrid file has been copied from FWFS
+	 */
+	bool isCopied(FileSystem& fs, const String& filename)
+	{
+		IFS::Stat stat;
+		int err = fs.stat(filename, &stat);
+		CHECK(err >= 0);
+		if(err < 0) {
+			return false;
+		}
+		IFS::FileSystem::Info info;
+		stat.fs->getinfo(info);
+		return info.type != IFS::FileSystem::Type::FWFS;
+	}
+
+	/*
+	 * Check files opened for writing are only copied when modified
+	 */
+	void lazyCopyTest(FileSystem& fs)
+	{
+		const String filename(COW_FILENAME);
+
+		// Call during fstest() will have copied the file, so revert it
+		fs.remove(filename);
+
+		REQUIRE(!isCopied(fs, filename));
+
+		IFS::File file(&fs);
+		REQUIRE(file.open(filename, IFS::File::ReadWrite));
+		char buffer[64];
+		CHECK_EQ(file.read(buffer, sizeof(buffer)), int(sizeof(buffer)));
+		IFS::Stat stat;
+		CHECK(file.stat(stat));
+		file.close();
+		CHECK(!isCopied(fs, filename));
+
+		// First write copies file, preserving file position
+		auto original = fs.getContent(filename);
+		REQUIRE(file.open(filename, IFS::File::ReadWrite));
+		CHECK_EQ(file.seek(100, SeekOrigin::Start), 100);
+		CHECK(!isCopied(fs, filename));
+		CHECK(file.write(F("modified")));
+		file.close();
+		CHECK(isCopied(fs, filename));
+
+		memcpy(original.begin() + 100, "modified", 8);
+		CHECK(fs.getContent(filename) == original);
+
+		// Second handle pending on the same file must use the copy made by the first
+		fs.remove(filename);
+		auto expected = fs.getContent(filename);
+		IFS::File file2(&fs);
+		REQUIRE(file.open(filename, IFS::File::ReadWrite));
+		REQUIRE(file2.open(filename, IFS::File::ReadWrite));
+		CHECK(file.write(F("first")));
+		file.close();
+		CHECK_EQ(file2.seek(200, SeekOrigin::Start), 200);
+		CHECK(file2.write(F("second")));
+		file2.close();
+		memcpy(expected.begin(), "first", 5);
+		memcpy(expected.begin() + 200, "second", 6);
+		CHECK(fs.getContent(filename) == expected);
+	}
+
+	/*
+	 * Count number of times a name appears in a directory listing
+	 */
+	unsigned countListed(FileSystem& fs, const String& path, const String& name)
+	{
+		unsigned count{0};
+		IFS::Directory dir(&fs);
+		CHECK(dir.open(path));
+		while(dir.next()) {
+			if(name == dir.stat().name.c_str()) {
+				++count;
+			}
+		}
+		return count;
+	}
+
+	/*
+	 * Check deleted and overridden FW files are remembered after remounting
+	 */
+	void journalTest(Storage::Partition fwfsPart, SubType subtype)
+	{
+		const String deletedFile(COW_FILENAME);
+		const String overriddenFile(F("README.rst"));
+		const String subdir(F("A Subdirectory"));
+		const String newFile(F("A Subdirectory/a/new.txt"));
+		const String content(F("New content"));
+
+		auto fs = initFWFS(fwfsPart, subtype);
+		REQUIRE(fs != nullptr);
+		REQUIRE(fs->format() >= 0);
+
+		REQUIRE(fs->stat(deletedFile, nullptr) >= 0);
+		CHECK(fs->remove(deletedFile) >= 0);
+		CHECK_EQ(fs->stat(deletedFile, nullptr), IFS::Error::NotFound);
+		CHECK_EQ(countListed(*fs, "", deletedFile), 0);
+
+		CHECK(fs->setContent(overriddenFile, content) >= 0);
+		// Creates FFS directories which override FW ones
+		CHECK(fs->setContent(newFile, content) >= 0);
+		delete fs;
+
+		fs = initFWFS(fwfsPart, subtype);
+		REQUIRE(fs != nullptr);
+
+		CHECK_EQ(fs->stat(deletedFile, nullptr), IFS::Error::NotFound);
+		CHECK_EQ(countListed(*fs, "", deletedFile), 0);
+		CHECK_EQ(countListed(*fs, "", HYFS_JOURNAL_NAME), 0);
+		CHECK_EQ(countListed(*fs, "", overriddenFile), 1);
+		CHECK_EQ(countListed(*fs, "", subdir), 1);
+		CHECK_EQ(countListed(*fs, subdir, "a"), 1);
+		CHECK(fs->getContent(overriddenFile) == content);
+		CHECK(fs->getContent(newFile) == content);
+
+		// A new file may be created in place of a deleted one
+		CHECK(fs->setContent(deletedFile, content) >= 0);
+		CHECK(fs->getContent(deletedFile) == content);
+		CHECK_EQ(countListed(*fs, "", deletedFile), 1);
+		CHECK(fs->remove(deletedFile) >= 0);
+		CHECK_EQ(fs->stat(deletedFile, nullptr), IFS::Error::NotFound);
+
+		// Formatting restores everything
+		CHECK(fs->format() >= 0);
+		CHECK(fs->stat(deletedFile, nullptr) >= 0);
+		CHECK(fs->getContent(overriddenFile) == fwfsRef->getContent(overriddenFile));
+		delete fs;
+
+		// Removing an open FW file, or one with a pending copy, records a whiteout
+		fs = initFWFS(fwfsPart, subtype, HybridFlag::lazyCopy);
+		REQUIRE(fs != nullptr);
+		for(auto flags : {IFS::File::ReadOnly, IFS::File::ReadWrite}) {
+			IFS::File file(fs);
+			REQUIRE(file.open(deletedFile, flags));
+			CHECK(file.remove());
+			CHECK_EQ(fs->stat(deletedFile, nullptr), IFS::Error::NotFound);
+			CHECK(fs->format() >= 0);
+		}
+		delete fs;
+	}
+
+	/*
+	 * Write merged view of hybrid filesystem into a new FWFS image and check content
+	 */
+	void flattenTest(Storage::Partition fwfsPart, SubType subtype)
+	{
+		const String deletedFile(COW_FILENAME);
+		const String modifiedFile(F("README.rst"));
+		const String unmodifiedFile(F("error.html"));
+		const String newFile(F("A Subdirectory/new.txt"));
+		const String content(F("New content"));
+
+		auto fs = initFWFS(fwfsPart, subtype);
+		REQUIRE(fs != nullptr);
+		REQUIRE(fs->format() >= 0);
+		CHECK(fs->remove(deletedFile) >= 0);
+		CHECK(fs->setContent(modifiedFile, content) >= 0);
+		CHECK(fs->setContent(newFile, content) >= 0);
+
+		auto flatPart = createPartition(FLAT_IMGFILE, fwfsPart.size() + 0x10000, F("flat"), SubType::fwfs);
+		REQUIRE(flatPart);
+		IFS::FWFS::ArchiveStream::VolumeInfo volumeInfo;
+		volumeInfo.name = F("Flattened volume");
+		volumeInfo.id = 0x464c4154;
+		int err = IFS::createFirmwareImage(*fs, flatPart, volumeInfo);
+		debug_ifs(fs, err, "createFirmwareImage");
+		CHECK(err >= 0);
+		delete fs;
+
+		fs = initFWFS(flatPart, SubType::fwfs);
+		REQUIRE(fs != nullptr);
+		CHECK_EQ(fs->check(), FS_OK);
+		CHECK_EQ(fs->stat(deletedFile, nullptr), IFS::Error::NotFound);
+		CHECK(fs->getContent(modifiedFile) == content);
+		CHECK(fs->getContent(newFile) == content);
+		CHECK(fs->getContent(unmodifiedFile) == fwfsRef->getContent(unmodifiedFile));
+		delete fs;
+
+		destroyStorageDevice(FLAT_IMGFILE);
+	}
+
+	/*
+	 * Mount a small patch image above the main one and check it shadows the original content
+	 */
+	void unionTest(Storage::Partition fwfsPart)
+	{
+		const String patchedFile(F("README.rst"));
+		const String unpatchedFile(F("error.html"));
+		const String subdir(F("A Subdirectory"));
+		const String newFile(F("A Subdirectory/patch.txt"));
+		const String content(F("Patched content"));
+
+		// Build patch image from a scratch LittleFS volume
+		auto ffs = createFilesystem(SubType::littlefs);
+		REQUIRE(ffs != nullptr);
+		CHECK(ffs->format() >= 0);
+		CHECK(ffs->mount() >= 0);
+		CHECK(ffs->setContent(patchedFile, content) >= 0);
+		CHECK(ffs->makedirs(subdir) >= 0);
+		CHECK(ffs->setContent(newFile, content) >= 0);
+
+		auto patchPart = createPartition(PATCH_IMGFILE, 0x10000, F("patch"), SubType::fwfs);
+		REQUIRE(patchPart);
+		IFS::FWFS::ArchiveStream::VolumeInfo volumeInfo;
+		volumeInfo.name = F("Patch volume");
+		int err = IFS::createFirmwareImage(*ffs, patchPart, volumeInfo);
+		debug_ifs(ffs, err, "createFirmwareImage");
+		CHECK(err >= 0);
+		delete ffs;
+
+		auto fs = IFS::createUnionFilesystem({fwfsPart, patchPart});
+		REQUIRE(fs != nullptr);
+		err = fs->mount();
+		debug_ifs(fs, err, "mount");
+		REQUIRE(err >= 0);
+
+		auto& ufs = static_cast<IFS::Union::FileSystem&>(static_cast<IFS::IFileSystem&>(*fs));
+		CHECK(ufs.getIndexSize() != 0);
+
+		CHECK(fs->getContent(patchedFile) == content);
+		CHECK(fs->getContent(newFile) == content);
+		CHECK(fs->getContent(unpatchedFile) == fwfsRef->getContent(unpatchedFile));
+		CHECK_EQ(fs->stat(F("no-such-file"), nullptr), IFS::Error::NotFound);
+		CHECK_EQ(fs->setContent(unpatchedFile, content), IFS::Error::ReadOnly);
+
+		// Directories are merged, with no duplicate entries
+		CHECK_EQ(countListed(*fs, "", patchedFile), 1);
+		CHECK_EQ(countListed(*fs, "", unpatchedFile), 1);
+		CHECK_EQ(countListed(*fs, "", subdir), 1);
+		CHECK_EQ(countListed(*fs, subdir, "a"), 1);
+		CHECK_EQ(countListed(*fs, subdir, "patch.txt"), 1);
+
+		// Root directory can be opened, so the union can be archived
+		auto root = fs->open("");
+		CHECK(root >= 0);
+		fs->close(root);
+		auto flatPart = createPartition(FLAT_IMGFILE, fwfsPart.size() + 0x10000, F("flat"), SubType::fwfs);
+		REQUIRE(flatPart);
+		volumeInfo.name = F("Flattened union");
+		err = IFS::createFirmwareImage(*fs, flatPart, volumeInfo);
+		debug_ifs(fs, err, "createFirmwareImage");
+		CHECK(err >= 0);
+		auto flatFs = initFWFS(flatPart, SubType::fwfs);
+		REQUIRE(flatFs != nullptr);
+		CHECK(flatFs->getContent(patchedFile) == content);
+		CHECK(flatFs->getContent(unpatchedFile) == fwfsRef->getContent(unpatchedFile));
+		delete flatFs;
+		destroyStorageDevice(FLAT_IMGFILE);
+
+		delete fs;
+		destroyStorageDevice(PATCH_IMGFILE);
+	}
+
+	/*
+	 * Apply patch to backup image and check result matches main image
+	 */
+	void patchTest(Storage::Partition fwfsPart)
+	{
+		auto sourcePart = createFwfsPartition(*fwfsRef, BACKUP_FWFS);
+		REQUIRE(sourcePart);
+		auto targetPart = createPartition(PATCHED_IMGFILE, fwfsPart.size(), F("patched"), SubType::fwfs);
+		REQUIRE(targetPart);
+
+		String patch = fwfsPatch;
+		debug_i("Patch is %u bytes, image is %u bytes", patch.length(), fwfsImage1.length());
+
+		auto applyPatch = [&](Storage::Partition source) -> int {
+			IFS::FWFS::PatchStream patcher(source, targetPart);
+			// Odd-sized pieces ensure operations get split
+			const size_t blockSize{100};
+			for(unsigned offset = 0; offset < patch.length(); offset += blockSize) {
+				auto len = std::min(blockSize, patch.length() - offset);
+				if(patcher.write(reinterpret_cast<const uint8_t*>(&patch[offset]), len) != len) {
+					break;
+				}
+			}
+			if(patcher.isComplete()) {
+				return FS_OK;
+			}
+			int err = patcher.getLastError();
+			// Patch data ran out
+			return (err < 0) ? err : IFS::Error::BadObject;
+		};
+
+		CHECK_EQ(applyPatch(sourcePart), FS_OK);
+
+		char buf1[512];
+		char buf2[512];
+		for(unsigned offset = 0; offset < fwfsImage1.length(); offset += sizeof(buf1)) {
+			auto len = fwfsImage1.read(offset, buf1, sizeof(buf1));
+			REQUIRE(targetPart.read(offset, buf2, len));
+			REQUIRE(memcmp(buf1, buf2, len) == 0);
+		}
+
+		auto fs = initFWFS(targetPart, SubType::fwfs);
+		REQUIRE(fs != nullptr);
+		fstest(*fs, Flag::readFileTest);
+		delete fs;
+
+		// Source must match the one patch was built from
+		CHECK_EQ(applyPatch(fwfsPart), IFS::Error::BadChecksum);
+
+		// Corrupted data must be detected
+		patch[patch.length() / 2] ^= 0x55;
+		CHECK(applyPatch(sourcePart) < 0);
+
+		destroyStorageDevice(PATCHED_IMGFILE);
+		destroyStorageDevice(BACKUP_FWFS);
+	}
+
 	void readFileTest(FileSystem& fs, const String& filename, const IFS::Stat& stat)
 	{
 		Crypto::Md5 ctx;
@@ -443,6 +974,11 @@ public:
 		}
 
 		for(auto& name : files) {
+			// Files used internally by hybrid filesystem have no reference copy
+			if(name.endsWith(HYFS_COW_SUFFIX) || (path.length() == 0 && name.startsWith(HYFS_JOURNAL_NAME))) {
+				continue;
+			}
+
 			String filename = path;
 			if(filename.length() != 0) {
 				filename += '/';
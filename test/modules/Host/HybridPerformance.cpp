@@ -0,0 +1,203 @@
+/*
+ * HybridPerformance.cpp
+ *
+ * Benchmark hybrid filesystem with large numbers of overridden files
+ */
+
+#include <FsTest.h>
+#include <IFS/Host/FileSystem.h>
+#include <IFS/Helpers.h>
+#include <IFS/FWFS/ArchiveStream.h>
+#include <IFS/FileStream.h>
+#include <Storage/FileDevice.h>
+#include <LittleFS.h>
+#include <Platform/Timers.h>
+
+using SubType = Storage::Partition::SubType::Data;
+
+namespace
+{
+DEFINE_FSTR(SOURCE_DIR, "out/hyperf")
+DEFINE_FSTR(FWFS_IMGFILE, "out/hyperf-fwfs.bin")
+DEFINE_FSTR(LFS_IMGFILE, "out/hyperf-lfs.bin")
+
+#define FILE_COUNT 300
+#define LFS_SIZE (2 * 1024 * 1024)
+#define LIST_ITERATIONS 10
+// Simulate a web server repeatedly serving a set of assets
+#define ASSET_COUNT 16
+#define OPEN_ITERATIONS 50
+
+} // namespace
+
+class HybridPerformanceTest : public TestGroup
+{
+public:
+	HybridPerformanceTest() : TestGroup(_F("Hybrid performance"))
+	{
+	}
+
+	void execute() override
+	{
+		auto& hostfs = IFS::Host::getFileSystem();
+
+		TEST_CASE("Create source files")
+		{
+			hostfs.makedirs(String(SOURCE_DIR) + "/files/");
+			for(unsigned i = 0; i < FILE_COUNT; ++i) {
+				int err = hostfs.setContent(String(SOURCE_DIR) + '/' + getFilePath(i), F("Original content"));
+				REQUIRE(err >= 0);
+			}
+		}
+
+		TEST_CASE("Build FWFS image")
+		{
+			IFS::FWFS::ArchiveStream::VolumeInfo volumeInfo;
+			volumeInfo.name = F("Hybrid performance");
+			volumeInfo.id = 0x48595046;
+			IFS::FWFS::ArchiveStream archive(&hostfs, volumeInfo, SOURCE_DIR);
+			IFS::FileStream stream(&hostfs);
+			REQUIRE(stream.open(FWFS_IMGFILE, File::CreateNewAlways | File::WriteOnly));
+			stream.copyFrom(&archive);
+			stream.close();
+			REQUIRE(archive.isSuccess());
+		}
+
+		auto fwfsPart = createPartition(FWFS_IMGFILE, 0, F("hyperf-fwfs"), SubType::fwfs);
+		auto lfsPart = createPartition(LFS_IMGFILE, LFS_SIZE, F("hyperf-lfs"), SubType::littlefs);
+		REQUIRE(fwfsPart && lfsPart);
+
+		auto lfs = IFS::createLfsFilesystem(lfsPart);
+		REQUIRE(lfs != nullptr);
+		std::unique_ptr<IFS::FileSystem> fs(IFS::createHybridFilesystem(fwfsPart, lfs));
+		REQUIRE(fs != nullptr);
+		REQUIRE(fs->mount() >= 0);
+		// Start with no overrides
+		REQUIRE(fs->format() >= 0);
+
+		TEST_CASE("List with no overrides")
+		{
+			profileListing(*fs);
+		}
+
+		TEST_CASE("Repeated asset opens")
+		{
+			profileOpens(*fs);
+		}
+
+		TEST_CASE("Override files")
+		{
+			OneShotFastMs timer;
+			for(unsigned i = 0; i < FILE_COUNT; ++i) {
+				// Opening for write copies FW file to FFS
+				IFS::File file(fs.get());
+				REQUIRE(file.open(getFilePath(i), File::WriteOnly | File::Append));
+			}
+			auto time = timer.elapsedTime();
+			Serial.print(_F("Copy-up of "));
+			Serial.print(FILE_COUNT);
+			Serial.print(_F(" files = "));
+			Serial.println(time.toString());
+		}
+
+		TEST_CASE("List with all files overridden")
+		{
+			profileListing(*fs);
+		}
+
+		fs.reset();
+		Storage::unRegisterDevice(Storage::findDevice(FWFS_IMGFILE));
+		Storage::unRegisterDevice(Storage::findDevice(LFS_IMGFILE));
+	}
+
+	static String getFilePath(unsigned index)
+	{
+		char name[32];
+		m_snprintf(name, sizeof(name), "files/file%04u.txt", index);
+		return name;
+	}
+
+	void profileListing(IFS::FileSystem& fs)
+	{
+		unsigned count{0};
+		OneShotFastUs timer;
+		for(unsigned i = 0; i < LIST_ITERATIONS; ++i) {
+			count = 0;
+			IFS::Directory dir(&fs);
+			REQUIRE(dir.open(F("files")));
+			while(dir.next()) {
+				++count;
+			}
+		}
+		auto time = timer.elapsedTime();
+		Serial.print(_F("Listing "));
+		Serial.print(count);
+		Serial.print(_F(" files, time per iteration = "));
+		time.time = (time.time + LIST_ITERATIONS / 2) / LIST_ITERATIONS;
+		Serial.println(time.toString());
+
+		// Overridden FW files must not be listed twice
+		CHECK_EQ(count, FILE_COUNT);
+	}
+
+	void profileOpens(IFS::FileSystem& fs)
+	{
+		auto& hyfs = static_cast<IFS::HYFS::FileSystem&>(static_cast<IFS::IFileSystem&>(fs));
+		hyfs.resetLookupStats();
+
+		char buffer[64];
+		OneShotFastUs timer;
+		for(unsigned i = 0; i < OPEN_ITERATIONS; ++i) {
+			for(unsigned j = 0; j < ASSET_COUNT; ++j) {
+				IFS::File file(&fs);
+				REQUIRE(file.open(getFilePath(j)));
+				CHECK(file.read(buffer, sizeof(buffer)) > 0);
+			}
+		}
+		auto time = timer.elapsedTime();
+		const unsigned count = OPEN_ITERATIONS * ASSET_COUNT;
+		time.time = (time.time + count / 2) / count;
+
+		auto& stats = hyfs.getLookupStats();
+		Serial.print(_F("Open and read "));
+		Serial.print(count);
+		Serial.print(_F(" assets, time per file = "));
+		Serial.print(time.toString());
+		Serial.print(_F(", negative cache hits "));
+		Serial.print(stats.hits);
+		Serial.print(_F(", misses "));
+		Serial.println(stats.misses);
+
+#if HYFS_NEGCACHE_SIZE != 0
+		// Only the first open of each asset should query FFS
+		CHECK(stats.hits > stats.misses);
+#endif
+	}
+
+	Storage::Partition createPartition(const String& imgfile, size_t size, const String& name, SubType subtype)
+	{
+		auto& hostfs = IFS::Host::getFileSystem();
+		auto file = hostfs.open(imgfile, File::Create | File::ReadWrite);
+		debug_ifs(&hostfs, file, "open('%s')", imgfile.c_str());
+		if(file < 0) {
+			TEST_ASSERT(false);
+			return Storage::Partition{};
+		}
+
+		size_t curSize = hostfs.getSize(file);
+		if(curSize < size) {
+			hostfs.ftruncate(file, size);
+		}
+		auto dev = new Storage::FileDevice(imgfile, hostfs, file);
+		Storage::registerDevice(dev);
+		if(curSize < size) {
+			dev->erase_range(curSize, size - curSize);
+		}
+		return dev->editablePartitions().add(name, subtype, 0, dev->getSize());
+	}
+};
+
+void REGISTER_TEST(HybridPerformance)
+{
+	registerGroup<HybridPerformanceTest>();
+}
@@ -7,8 +7,11 @@
 
 #include <FsTest.h>
 #include <IFS/Helpers.h>
+#include <IFS/Crc32c.h>
+#include <IFS/FWFS/FileSystem.h>
 #include <LittleFS.h>
 #include <Platform/Timers.h>
+#include "../out/fwfsImage1.h"
 
 DEFINE_FSTR_LOCAL(TEST_READ_FILENAME, "apple-touch-icon-180x180.png")
 DEFINE_FSTR_LOCAL(TEST_WRITE_FILENAME, "testwrite.png")
@@ -49,6 +52,11 @@ public:
 			printHeap(heapSize);
 			benchmark(true);
 		}
+
+		TEST_CASE("FWFS checksum benchmark")
+		{
+			checksumBenchmark();
+		}
 	}
 
 	void printHeap(size_t initialHeapSize)
@@ -77,6 +85,49 @@ public:
 		Serial.println(time.toString());
 	}
 
+	void printThroughput(const String& func, size_t size, uint32_t us)
+	{
+		auto usPerMB = uint64_t(us) * 0x100000 / size;
+		m_printf("%10s: %u bytes in %u us, %u us per MB\r\n", func.c_str(), size, us, unsigned(usPerMB));
+	}
+
+	/*
+	 * Report verification speed so applications can decide whether to check image at every boot
+	 */
+	void checksumBenchmark()
+	{
+		// Calculation only
+		const size_t blockSize{FWFS_CHECK_BUFFER_SIZE};
+		std::unique_ptr<uint8_t[]> buffer(new uint8_t[blockSize]);
+		for(unsigned i = 0; i < blockSize; ++i) {
+			buffer[i] = i;
+		}
+		const unsigned blockCount{256};
+		OneShotFastUs timer;
+		uint32_t crc{0};
+		for(unsigned i = 0; i < blockCount; ++i) {
+			crc = IFS::crc32c(buffer.get(), blockSize, crc);
+		}
+		printThroughput(F("crc32c"), blockSize * blockCount, timer.elapsedTime().time);
+
+		// Reading partition as well
+		auto part = Storage::findDefaultPartition(Storage::Partition::SubType::Data::fwfs);
+		REQUIRE(part);
+		timer.start();
+		for(storage_size_t offset = 0; offset < part.size(); offset += blockSize) {
+			auto len = std::min(storage_size_t(blockSize), part.size() - offset);
+			CHECK(part.read(offset, buffer.get(), len));
+			crc = IFS::crc32c(buffer.get(), len, crc);
+		}
+		printThroughput(F("partition"), part.size(), timer.elapsedTime().time);
+
+		auto fs = IFS::createFirmwareFilesystem(part);
+		REQUIRE(fs != nullptr);
+		CHECK(fs->mount() == FS_OK);
+		profile(F("check"), 10, [&]() { CHECK(fs->check() == FS_OK); });
+		delete fs;
+	}
+
 	void benchmark(bool readOnly)
 	{
 		String filename;
@@ -94,6 +145,53 @@ public:
 			fileClose(file);
 		});
 
+		if(readOnly) {
+			// Re-open using identifier obtained from stat, as when serving a directory listing
+			auto fs = getFileSystem();
+			FileStat stat;
+			int err = fileStats(filename, stat);
+			CHECK(err >= 0);
+			profile(F("openById"), 100, [&]() {
+				FileHandle file = fs->openById(stat.id, File::ReadOnly);
+				CHECK(file >= 0);
+				fs->close(file);
+			});
+
+			IFS::Stat idStat;
+			err = fs->statById(stat.id, &idStat);
+			CHECK(err >= 0);
+			CHECK_EQ(idStat.id, stat.id);
+			CHECK_EQ(idStat.size, stat.size);
+
+			// Start of image contains marker, not an object
+			CHECK_EQ(fs->openById(0, File::ReadOnly), IFS::Error::NotFound);
+
+			// Use identifiers generated at build time
+			auto& obj = FwfsImage::apple_touch_icon_180x180_png;
+			CHECK_EQ(obj.id, stat.id);
+			CHECK(FwfsImage::image.isValid(*fs));
+			profile(F("openStatic"), 100, [&]() {
+				FileHandle file = FwfsImage::image.open(*fs, obj);
+				CHECK(file >= 0);
+				fs->close(file);
+			});
+			err = FwfsImage::image.stat(*fs, obj, &idStat);
+			CHECK(err >= 0);
+			CHECK_EQ(idStat.size, obj.size);
+
+			// Open relative to directory
+			IFS::Directory dir(fs);
+			REQUIRE(dir.open());
+			profile(F("openat"), 100, [&]() {
+				FileHandle file = dir.openat(filename.c_str());
+				CHECK(file >= 0);
+				fs->close(file);
+			});
+			IFS::Stat atStat;
+			CHECK(dir.statat(filename.c_str(), atStat));
+			CHECK_EQ(atStat.id, stat.id);
+		}
+
 		FileHandle file = fileOpen(filename);
 		CHECK(file >= 0);
 		profile(F("seek"), 500, [&]() {
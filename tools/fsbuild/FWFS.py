@@ -32,6 +32,8 @@ class FwObt(IntEnum):
     WriteACE = 6,  # minimum UserRole for write access
     VolumeIndex = 7, # Volume index number
     Md5Hash = 8, # MD5 Hash Value
+    DataChecksum = 11, # CRC32C of preceding data object
+    BaseData = 12, # File content held in base image, see ArchiveStream::setBase()
     # 2-byte sized
     Data16 = 32,
     # Named
@@ -317,6 +319,16 @@ class ID32Object(Object8):
         return self.__value
 
 
+class DataChecksumObject(Object8):
+    """CRC32C of data object content, follows the data object in its parent"""
+    def __init__(self, parent, data):
+        super().__init__(parent, FwObt.DataChecksum)
+        self.__crc = util.crc32c(data)
+
+    def content(self):
+        return struct.pack("<L", self.__crc)
+
+
 class EndObject(Object8):
     def __init__(self, parent, checksum):
         super().__init__(parent, FwObt.End)
@@ -455,7 +467,7 @@ class NamedObject(Object16):
                 return child
         return None
 
-    def appendData(self, content):
+    def appendData(self, content, checksum = False):
         length = len(content)
         if length <= 0xff:
             Object8(self, FwObt.Data8, content)
@@ -466,11 +478,16 @@ class NamedObject(Object16):
         else:
             print("Object data too large")
             exit(1)
+        if checksum:
+            DataChecksumObject(self, content)
         self.__dataSize += len(content)
 
     def childCount(self):
         return len(self.__children)
 
+    def children(self):
+        return self.__children
+
     def fileCount(self, recursive):
         count = 0
         for child in self.__children:
@@ -572,8 +589,8 @@ class File(NamedObject):
         super().__init__(parent, FwObt.File, name)
         self.__md5 = Md5Object(self)
 
-    def appendData(self, content):
-        super().appendData(content)
+    def appendData(self, content, checksum = False):
+        super().appendData(content, checksum)
         self.__md5.update(content)
 
 
@@ -581,7 +598,7 @@ class File(NamedObject):
 class Image:
     def __init__(self, volumeName, volumeID):
         self.__objectCount = 0  # Number of objects written
-        self.__checksum = 0  # @todo update this from objects
+        self.__checksum = 0  # CRC32C of all data preceding End object
         self.__vol = Volume(volumeName)
         ID32Object(self.__vol, FwObt.ID32, volumeID)
         self.__root = Directory(self.__vol, "")
@@ -594,7 +611,9 @@ class Image:
     def writeToFile(self, filename):
         self.__root.prune()
         self.__fout = open(filename, "wb")
-        self.__fout.write(struct.pack("<L", SYS_START_MARKER))
+        marker = struct.pack("<L", SYS_START_MARKER)
+        self.__fout.write(marker)
+        self.__checksum = util.crc32c(marker)
         self.__vol.emit(self)
         end = EndObject(None, self.__checksum)
         end.emit(self)
@@ -605,6 +624,12 @@ class Image:
     def root(self):
         return self.__root
 
+    def volumeID(self):
+        return self.__vol.findObject(FwObt.ID32).value()
+
+    def creationTime(self):
+        return round(self.__vol.mtime)
+
     def offset(self):
         return self.__fout.tell()
 
@@ -613,6 +638,7 @@ class Image:
         objID = self.__fout.tell()
         self.__fout.write(header)
         self.__fout.write(content)
+        self.__checksum = util.crc32c(content, util.crc32c(header, self.__checksum))
         self.__objectCount += 1
         return objID
 
@@ -9,5 +9,6 @@ from enum import IntEnum
 #
 class CompressionType(IntEnum):
     none = 0,
-    gzip = 1
+    gzip = 1,
+    lz4 = 2
 
@@ -0,0 +1,234 @@
+#!/usr/bin/env python3
+#
+# Script to create binary delta patches between Firmware Filesystem images
+#
+# See README.rst for further information
+#
+
+import struct, sys, argparse
+import util, FWFS
+from FWFS import FwObt, FWOBT_REF
+
+# Patch files start with this word, see IFS::FWFS::PatchStream
+PATCH_MAGIC = 0x50445746 # "FWDP"
+
+# Patch operations
+OP_COPY = 1 # uint32_t offset, uint32_t length
+OP_INSERT = 2 # uint32_t length, data
+
+# Size of encoded operations, excluding inserted data
+COPY_OP_SIZE = 9
+INSERT_OP_SIZE = 5
+
+# Data within objects is matched against the source image in blocks of this size
+BLOCK_SIZE = 32
+
+
+def parseObjects(image):
+    """Split image into list of (offset, size) tuples, one for each object"""
+    if len(image) < 4 or struct.unpack_from("<L", image)[0] != FWFS.SYS_START_MARKER:
+        raise ValueError("Not an FWFS image")
+    objects = [(0, 4)]
+    offset = 4
+    while offset < len(image):
+        obt = image[offset]
+        if (obt & FWOBT_REF) or obt < FwObt.Data16:
+            size = 2 + image[offset + 1]
+        elif obt < FwObt.Data24:
+            size = 3 + struct.unpack_from("<H", image, offset + 1)[0]
+        else:
+            lo, hi = struct.unpack_from("<HB", image, offset + 1)
+            size = 4 + ((hi << 16) | lo)
+        objects.append((offset, size))
+        offset += size
+        if obt == FwObt.End:
+            break
+    # End marker
+    if offset < len(image):
+        objects.append((offset, len(image) - offset))
+    return objects
+
+
+class Delta:
+    """Sequence of operations to build target image"""
+
+    def __init__(self):
+        self.ops = []
+        self.copyCount = 0
+        self.copySize = 0
+        self.insertSize = 0
+
+    def follows(self, offset):
+        """Determine if copying from offset would extend the previous operation"""
+        if not self.ops or self.ops[-1][0] != OP_COPY:
+            return False
+        prev = self.ops[-1][1]
+        return prev[0] + prev[1] == offset
+
+    def copy(self, offset, length):
+        if length == 0:
+            return
+        self.copySize += length
+        if self.follows(offset):
+            prev = self.ops[-1][1]
+            self.ops[-1] = (OP_COPY, (prev[0], prev[1] + length))
+        else:
+            self.ops.append((OP_COPY, (offset, length)))
+            self.copyCount += 1
+
+    def insert(self, data):
+        if len(data) == 0:
+            return
+        self.insertSize += len(data)
+        if self.ops and self.ops[-1][0] == OP_INSERT:
+            self.ops[-1][1].extend(data)
+        else:
+            self.ops.append((OP_INSERT, bytearray(data)))
+
+    def serialize(self):
+        out = bytearray()
+        for op, arg in self.ops:
+            if op == OP_COPY:
+                out += struct.pack("<BLL", OP_COPY, arg[0], arg[1])
+            else:
+                out += struct.pack("<BL", OP_INSERT, len(arg)) + arg
+        return out
+
+
+class Matcher:
+    """Locate target data within source image"""
+
+    def __init__(self, source):
+        self.source = source
+        # Complete objects keyed by content
+        self.objects = {}
+        for offset, size in parseObjects(source):
+            self.objects.setdefault(source[offset:offset+size], offset)
+        # Aligned blocks keyed by content
+        self.blocks = {}
+        for offset in range(0, len(source) - BLOCK_SIZE + 1, BLOCK_SIZE):
+            self.blocks.setdefault(source[offset:offset+BLOCK_SIZE], offset)
+
+    def addObject(self, delta, data):
+        src = self.objects.get(data)
+        if src is not None and (len(data) > COPY_OP_SIZE or delta.follows(src)):
+            delta.copy(src, len(data))
+            return
+        if len(data) < BLOCK_SIZE:
+            delta.insert(data)
+            return
+
+        # Object has changed, or contains references which have moved, so look for unchanged blocks
+        source = self.source
+        literal = 0
+        pos = 0
+        while pos + BLOCK_SIZE <= len(data):
+            src = self.blocks.get(data[pos:pos+BLOCK_SIZE])
+            if src is None:
+                pos += 1
+                continue
+            # Extend match backwards into pending literal data, then forwards
+            while pos > literal and src > 0 and data[pos-1] == source[src-1]:
+                pos -= 1
+                src -= 1
+            length = BLOCK_SIZE
+            while pos + length < len(data) and src + length < len(source) and data[pos+length] == source[src+length]:
+                length += 1
+            if length <= COPY_OP_SIZE + INSERT_OP_SIZE:
+                pos += 1
+                continue
+            delta.insert(data[literal:pos])
+            delta.copy(src, length)
+            pos += length
+            literal = pos
+        delta.insert(data[literal:])
+
+
+def createPatch(source, target):
+    """Create patch to build target image from source image"""
+    matcher = Matcher(source)
+    delta = Delta()
+    for offset, size in parseObjects(target):
+        matcher.addObject(delta, target[offset:offset+size])
+
+    header = struct.pack("<LLLLL", PATCH_MAGIC, len(source), util.crc32c(source), len(target), util.crc32c(target))
+    return header + delta.serialize(), delta
+
+
+def applyPatch(source, patch):
+    """Apply patch to source image, returns target image"""
+    magic, sourceSize, sourceChecksum, targetSize, targetChecksum = struct.unpack_from("<LLLLL", patch)
+    if magic != PATCH_MAGIC:
+        raise ValueError("Not a patch file")
+    if sourceSize > len(source) or util.crc32c(source[:sourceSize]) != sourceChecksum:
+        raise ValueError("Source image does not match patch")
+    target = bytearray()
+    pos = 20
+    while pos < len(patch):
+        op = patch[pos]
+        if op == OP_COPY:
+            offset, length = struct.unpack_from("<LL", patch, pos + 1)
+            target += source[offset:offset+length]
+            pos += COPY_OP_SIZE
+        elif op == OP_INSERT:
+            length = struct.unpack_from("<L", patch, pos + 1)[0]
+            pos += INSERT_OP_SIZE
+            target += patch[pos:pos+length]
+            pos += length
+        else:
+            raise ValueError("Bad patch operation %u at offset %u" % (op, pos))
+    if len(target) != targetSize or util.crc32c(target) != targetChecksum:
+        raise ValueError("Target checksum mismatch")
+    return target
+
+
+def readFile(filename):
+    with open(util.ospath(filename), "rb") as f:
+        return f.read()
+
+
+def writeFile(filename, data):
+    with open(util.ospath(filename), "wb") as f:
+        f.write(data)
+
+
+if __name__ == "__main__":
+
+    parser = argparse.ArgumentParser(description='Firmware Filesystem delta patch tool')
+    parser.add_argument('source', help='Source (existing) image file')
+    parser.add_argument('target', help='Target (new) image file, or patch file if applying')
+    parser.add_argument('-o', '--output', metavar='filename', required=True, help='Destination patch or image file')
+    parser.add_argument('-a', '--apply', action='store_true', help='Apply a patch instead of creating one')
+    parser.add_argument('-v', '--verbose', action='store_true', help='Show patch details')
+
+    args = parser.parse_args()
+
+    source = readFile(args.source)
+    try:
+        if args.apply:
+            target = applyPatch(source, readFile(args.target))
+            writeFile(args.output, target)
+            print("Image '%s' is %u bytes" % (args.output, len(target)))
+            sys.exit(0)
+
+        target = readFile(args.target)
+        patch, delta = createPatch(source, target)
+        # Ensure patch is good before anything relies on it
+        if applyPatch(source, patch) != target:
+            raise ValueError("Patch verification failed")
+    except ValueError as err:
+        print("Error: %s" % err)
+        sys.exit(1)
+
+    writeFile(args.output, patch)
+
+    if args.verbose:
+        for op, arg in delta.ops:
+            if op == OP_COPY:
+                print("COPY   0x%08x %u" % arg)
+            else:
+                print("INSERT %u" % len(arg))
+
+    pc = round(100 * len(patch) / len(target))
+    print("Patch '%s' is %u bytes (%u%% of target image), %u bytes copied in %u operations, %u bytes inserted"
+          % (args.output, len(patch), pc, delta.copySize, delta.copyCount, delta.insertSize))
@@ -5,7 +5,7 @@
 # See readme.md for further information
 #
 
-import os, json, sys
+import os, re, json, sys
 import util, FWFS, config
 from FWFS import FwObt, isNumberType
 from compress import CompressionType
@@ -59,7 +59,7 @@ def addFile(parent, name, sourcePath):
             print("Unsupported compression type: " + cmp.toString())
             sys.exit(1)
 
-    fileObj.appendData(dout)
+    fileObj.appendData(dout, args.data_checksums)
 
     # If required, write copy of generated file
     if outFilePath is not None:
@@ -135,6 +135,58 @@ def addDirectory(parent, name, sourcePath):
     return dirObj
 
 
+# Convert image path into a valid C++ identifier
+def makeIdentifier(path, used):
+    ident = re.sub(r'[^0-9A-Za-z_]', '_', path)
+    if ident == '' or ident[0].isdigit():
+        ident = '_' + ident
+    base = ident
+    n = 1
+    while ident in used:
+        n += 1
+        ident = "%s_%u" % (base, n)
+    used.add(ident)
+    return ident
+
+
+# Emit a C++ header containing object IDs for all files in the image
+# Must be called after the image has been written so object IDs are assigned
+def writeHeader(filename, namespace):
+    objects = []
+    def scan(dirObj):
+        for child in dirObj.children():
+            if child.obt() == FwObt.File:
+                objects.append(child)
+            elif child.obt() == FwObt.Directory:
+                scan(child)
+    scan(img.root())
+
+    used = set(['volumeID', 'creationTime', 'image', 'objects'])
+    with open(filename, "w") as f:
+        f.write("/*\n")
+        f.write(" * Object identifiers for FWFS image '%s'\n" % os.path.basename(args.output))
+        f.write(" *\n")
+        f.write(" * Generated by fsbuild from '%s', do not edit.\n" % os.path.basename(args.input))
+        f.write(" */\n\n")
+        f.write("#pragma once\n\n")
+        f.write("#include <IFS/FWFS/StaticObject.h>\n\n")
+        f.write("namespace %s\n{\n" % namespace)
+        f.write("constexpr uint32_t volumeID{0x%08x};\n" % img.volumeID())
+        f.write("constexpr uint32_t creationTime{%u};\n\n" % img.creationTime())
+        f.write("inline IFS::FWFS::StaticImage image{volumeID, creationTime};\n\n")
+        idents = []
+        for obj in objects:
+            path = obj.path().lstrip('/')
+            ident = makeIdentifier(path, used)
+            idents.append(ident)
+            f.write("constexpr IFS::FWFS::StaticObject %s{%s, 0x%08x, %u};\n" % (ident, json.dumps(path), obj.id(), obj.dataSize()))
+        f.write("\nconstexpr const IFS::FWFS::StaticObject* objects[]{\n")
+        for ident in idents:
+            f.write("\t&%s,\n" % ident)
+        f.write("};\n\n")
+        f.write("} // namespace %s\n" % namespace)
+
+
 if __name__ == "__main__":
 
     parser = argparse.ArgumentParser(description='Firmware Filesystem Builder')
@@ -144,6 +196,9 @@ if __name__ == "__main__":
     parser.add_argument('-o', '--output', metavar='filename', required=True, help='Destination image file')
     parser.add_argument('-v', '--verbose', action='store_true', help='Show build details')
     parser.add_argument('-n', '--nominify', action='store_true', help='Do not minify Javasript or JSON')
+    parser.add_argument('--data-checksums', action='store_true', help='Add checksum for each data object, verified when first read')
+    parser.add_argument('--header', metavar='filename', help='Create C++ header containing file object IDs')
+    parser.add_argument('--namespace', metavar='name', default='FwfsImage', help='C++ namespace for generated header')
 
     args = parser.parse_args()
 
@@ -193,6 +248,12 @@ if __name__ == "__main__":
         print("Writing image to '" + imgFilePath + "'")
     img.writeToFile(imgFilePath)
 
+    if args.header:
+        headerFilePath = util.ospath(args.header)
+        if args.verbose:
+            print("Writing header to '" + headerFilePath + "'")
+        writeHeader(headerFilePath, args.namespace)
+
     totalDataSize = img.root().totalDataSize()
     totalOriginalDataSize = img.root().totalOriginalDataSize()
     if totalOriginalDataSize == 0:
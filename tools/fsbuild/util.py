@@ -48,3 +48,24 @@ def compress(data):
         gz.close()
     tmp.seek(0)
     return tmp.read()
+
+
+# CRC32C (Castagnoli) table, as used by IFS::crc32c()
+def _crc32cTable():
+    table = []
+    for i in range(256):
+        crc = i
+        for _ in range(8):
+            crc = (crc >> 1) ^ (0x82f63b78 if crc & 1 else 0)
+        table.append(crc)
+    return table
+
+_CRC32C_TABLE = _crc32cTable()
+
+def crc32c(data, crc = 0):
+    """Calculate CRC32C checksum, pass previous result to continue calculation"""
+    crc ^= 0xffffffff
+    table = _CRC32C_TABLE
+    for b in data:
+        crc = table[(crc ^ b) & 0xff] ^ (crc >> 8)
+    return crc ^ 0xffffffff